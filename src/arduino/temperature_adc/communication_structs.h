@@ -0,0 +1 @@
+../../protocol_definitions/communication_structs.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../protocol_definitions/protocol_codec.h
\ No newline at end of file
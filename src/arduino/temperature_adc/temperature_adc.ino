@@ -21,15 +21,25 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <Wire.h>
+#include <avr/interrupt.h>
 #include <avr/power.h>
 #include <avr/sleep.h>
+#include <avr/wdt.h>
 
 #include "communication_structs.h" 
+#include "protocol_codec.h"
 
 // RTC definitions
 static const char RTC_I2C_ADDRESS = 0x68;
 static const int RTC_INTERRUPT_PIN = 2; // pin 2
 static const int RTC_INTERRUPT_NR = 0;
+// upper bound for the pull-up to raise the released alarm line before we go to sleep
+static const unsigned long RTC_INTERRUPT_SETTLE_US = 1000;
+// DS3231 registers, the timekeeping registers start at 0x00
+static const unsigned char RTC_ALARM1_REGISTER = 0x07;
+static const unsigned char RTC_STATUS_REGISTER = 0x0F;
+// INTCN | A1IE, alarm 1 drives the INT pin
+static const unsigned char RTC_CONTROL_ALARM1_INTERRUPT = 0x05;
 
 // temperature sensors definitions
 static const int TEMP_SENSORS_POWER_PIN = 9; // pin 9
@@ -37,20 +47,59 @@ static const int TEMP_SENSORS_INPUT_1 = A0; // pin 23
 static const int TEMP_SENSORS_INPUT_2 = A1; // pin 24
 static const int TEMP_SENSORS_INPUT_3 = A2; // pin 25
 static const int TEMP_SENSORS_INPUT_4 = A3; // pin 26
+// ADC channels in the order the sensors are packed into a reading
+static const unsigned char TEMP_SENSORS_CHANNELS[] = {TEMP_SENSORS_INPUT_1 - A0,
+	TEMP_SENSORS_INPUT_2 - A0, TEMP_SENSORS_INPUT_3 - A0, TEMP_SENSORS_INPUT_4 - A0};
+static const unsigned char ADC_BITS = 10;
+// reading format of this node, announced to the master in every header
+typedef PackedReading<sizeof(TEMP_SENSORS_CHANNELS), ADC_BITS> NodeReading;
+// time the LM35 outputs need after power up before they are sampled
+static const unsigned long TEMP_SENSORS_SETTLE_MS = 50;
+// every temperature value is the mean of 2^ADC_OVERSAMPLING_SHIFT conversions,
+// the CPU sleeps in ADC noise reduction mode during all of them (at most 6, the sum is 16 bit)
+static const unsigned char ADC_OVERSAMPLING_SHIFT = 0;
+// ADC input of the internal 1.1V bandgap, measured against AVcc it gives the supply voltage
+static const unsigned char ADC_BANDGAP_CHANNEL = 0x0E;
+static const unsigned long ADC_BANDGAP_MILLIVOLTS = 1100;
 
 // Bleutooth definitions
 static const int BT_POWER_PIN = 11; // pin 11
-
-enum node_state_t { INIT, DATA, DUMP, TIME, SLEEP, TEST, COLLECT };
-enum message_enum { OKAY_MSG = 0,  INIT_MSG = 1, DATA_MSG = 2, DUMP_MSG = 3, TIME_MSG = 4, TEST_MSG = 5, FINI_MSG = 6 };
+// Longest wait for the master OKAY with the radio on. The master retries a missed connect
+// for a few minutes and probes nodes it lost every 300 seconds afterwards. Both waits may be
+// longer than the sampling interval, RTC alarms falling into a wait are served within it.
+static const unsigned int MASTER_WAIT_SECONDS = 180;
+static const unsigned int MASTER_RETRY_WAIT_SECONDS = 330;
+// failed rendezvous are retried after 1, 2, 4, ... wake-ups up to this many
+static const unsigned char MAX_RENDEZVOUS_BACKOFF = 16;
+// longest wait for a message of the master once connected, the rendezvous answer follows
+// the scheduling of the master
+static const unsigned long MASTER_ANSWER_TIMEOUT_MS = 5000;
+// readings taken while a full buffer waits for the master, two full buffers do not fit
+// into the 2 KB of SRAM
+static const unsigned int MAX_NUMBER_OF_PENDING_READINGS = 60;
+
+// watchdog timer definitions
+static const unsigned int WDT_PERIOD_SECONDS = 8;
+
+enum node_state_t { INIT, DATA, DUMP, TIME, SLEEP, TEST, COLLECT, RENDEZVOUS };
 
 volatile node_state_t node_state = INIT;
 
-char receive_array[sizeof(rendezvous_answer) + sizeof(timestamp)] = {0};
+unsigned char receive_array[RENDEZVOUS_ANSWER_WIRE_BYTES + TIMESTAMP_WIRE_BYTES] = {0};
 
 struct temperature_readings_header temperature_data_header;
-static const unsigned int MAX_NUMBER_OF_READINGS = 150;
-unsigned char temperature_readings[sizeof(temperature_reading) * MAX_NUMBER_OF_READINGS] = {0};
+unsigned char temperature_readings[NodeReading::BYTES * MAX_NUMBER_OF_READINGS] = {0};
+
+// While temperature_readings is full and waits for the master, sampling continues here.
+// The master receives the full buffer as DUMP followed by these readings as DATA.
+bool readings_wait_for_master = false;
+struct temperature_readings_header pending_data_header;
+unsigned char pending_readings[NodeReading::BYTES * MAX_NUMBER_OF_PENDING_READINGS] = {0};
+// wake-ups until the next rendezvous attempt and the current backoff
+unsigned char wake_ups_until_rendezvous = 0;
+unsigned char rendezvous_backoff = 1;
+
+volatile unsigned int watchdog_wake_ups = 0;
 
 struct timestamp current_alarm_times;
 
@@ -64,6 +113,49 @@ void isr_RTC_alarm()
 
 }
 
+// The conversion complete interrupt only has to wake the CPU from ADC noise reduction mode.
+EMPTY_INTERRUPT(ADC_vect);
+
+// The watchdog runs in interrupt mode only, it bounds waits and naps.
+ISR(WDT_vect)
+{
+	++watchdog_wake_ups;
+}
+
+void StartWatchdogTimer()
+{
+	watchdog_wake_ups = 0;
+	cli();
+	wdt_reset();
+	MCUSR &= ~_BV(WDRF);
+	// timed sequence, interrupt every 8 seconds without system reset
+	WDTCSR = _BV(WDCE) | _BV(WDE);
+	WDTCSR = _BV(WDIE) | _BV(WDP3) | _BV(WDP0);
+	sei();
+}
+
+void StopWatchdogTimer()
+{
+	cli();
+	wdt_reset();
+	MCUSR &= ~_BV(WDRF);
+	WDTCSR = _BV(WDCE) | _BV(WDE);
+	WDTCSR = 0;
+	sei();
+}
+
+// Sleeps in power down for about seconds, woken by the watchdog.
+void DeepSleepSeconds(const unsigned long seconds)
+{
+	StartWatchdogTimer();
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	while((unsigned long) watchdog_wake_ups * WDT_PERIOD_SECONDS < seconds)
+	{
+		sleep_mode();
+	}
+	StopWatchdogTimer();
+}
+
 void SleepNWakeOnUSART()
 {
 	set_sleep_mode(SLEEP_MODE_IDLE);
@@ -78,6 +170,8 @@ void SleepNWakeOnUSART()
 	sleep_mode();
 	sleep_disable();
 	power_all_enable();
+	// the TWI has to be initialized again after its clock was stopped
+	Wire.begin();
 
 }
 
@@ -88,7 +182,12 @@ void DeepSleepWakeOnRTC()
 	pinMode(13, INPUT);
 
         pinMode(RTC_INTERRUPT_PIN, INPUT_PULLUP);
-        delay(200);
+	// The pull-up raises the released line within microseconds. A line that stays low
+	// is an alarm that is already due, the low level interrupt then wakes us right away.
+	const unsigned long pullup_start_us = micros();
+	while(digitalRead(RTC_INTERRUPT_PIN) == LOW &&
+			micros() - pullup_start_us < RTC_INTERRUPT_SETTLE_US)
+	{}
 	attachInterrupt(0, isr_RTC_alarm, LOW);
 
 	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
@@ -98,13 +197,19 @@ void DeepSleepWakeOnRTC()
 
 	detachInterrupt(RTC_INTERRUPT_NR);
         ClearRTCAlarmFlags();
+	temperature_data_header.energy.wake_ups += 1;
         
         node_state = COLLECT;
 
 }
 
 
-void PowerOnBTAndWaitForMasterOK()
+// Powers up Bluetooth and waits up to timeout_seconds for the master OKAY. Returns false if
+// the master did not show up, the radio is still powered then. With collect_while_waiting
+// every RTC alarm that goes off during the wait is sampled at the next watchdog or USART
+// wake-up, so readings stay on the grid of the alarms.
+bool PowerOnBTAndWaitForMasterOK(const unsigned int timeout_seconds,
+		const bool collect_while_waiting)
 {
 			// set GPIO pin VCC of BT module to Output and HIGH
 			// power up BT module
@@ -113,15 +218,70 @@ void PowerOnBTAndWaitForMasterOK()
 
 			// setup BT modlue serial connection
 			Serial.begin(9600);
+			Serial.setTimeout(MASTER_ANSWER_TIMEOUT_MS);
+
+			// millis() stands still during the naps, the RTC counts the wait
+			timestamp wait_start;
+			RTCTime(&wait_start);
+
 			// wait for receive Master OK
-			// take a nap while nothing happens on UART
-			while( !Serial.available() )
+			// take a nap while nothing happens on UART, the watchdog ends the wait
+			StartWatchdogTimer();
+			while( !Serial.available() &&
+					watchdog_wake_ups * WDT_PERIOD_SECONDS < timeout_seconds )
 			{
 				SleepNWakeOnUSART();
+				if(collect_while_waiting && digitalRead(RTC_INTERRUPT_PIN) == LOW)
+				{
+					ClearRTCAlarmFlags();
+					temperature_data_header.energy.wake_ups += 1;
+					CollectReading();
+				}
 			}
+			StopWatchdogTimer();
+
+			timestamp wait_end;
+			RTCTime(&wait_end);
+			// waits are counted modulo a day
+			temperature_data_header.energy.master_wait_seconds +=
+				(SecondsOfDay(wait_end) + 86400UL - SecondsOfDay(wait_start)) % 86400UL;
+
+			if( !Serial.available() )
+				return false;
 
 			unsigned char master_message;
 			master_message = (unsigned char)  Serial.read();
+			return true;
+}
+
+// Reads length bytes of the master, false if they did not arrive in time.
+bool ReceiveFromMaster(unsigned char * bytes, const size_t length)
+{
+	return Serial.readBytes(bytes, length) == length;
+}
+
+// Waits for the master with the radio switched off in between, longer after every miss.
+void WaitForMasterWithBackoff()
+{
+	unsigned long backoff_seconds = MASTER_WAIT_SECONDS;
+	while(!PowerOnBTAndWaitForMasterOK(MASTER_RETRY_WAIT_SECONDS, false))
+	{
+		PowerOffBT();
+		DeepSleepSeconds(backoff_seconds);
+		if(backoff_seconds < MAX_RENDEZVOUS_BACKOFF * (unsigned long) MASTER_WAIT_SECONDS)
+			backoff_seconds *= 2;
+	}
+}
+
+// Ends a rendezvous the master did not complete, the readings are kept and sent at the next
+// attempt.
+void BackOffRendezvous()
+{
+	PowerOffBT();
+	wake_ups_until_rendezvous = rendezvous_backoff - 1;
+	if(rendezvous_backoff < MAX_RENDEZVOUS_BACKOFF)
+		rendezvous_backoff *= 2;
+	node_state = SLEEP;
 }
 
 void PowerOffBT()
@@ -135,13 +295,21 @@ void PowerOffBT()
 void setup()
 {
 
-	// Configure the analog reference voltage source
-	// to be the internal 1.1V source.
-	analogReference(INTERNAL);
+	// The ADC is configured for the internal 1.1V reference in EnableADC()
+	// and only powered while temperatures are read.
+	DisableADC();
+
+	// The RTC is the only I2C device, the bus stays initialized from here on.
+	Wire.begin();
+
+	temperature_data_header.sensor_count = NodeReading::SENSOR_COUNT;
+	temperature_data_header.adc_bits = NodeReading::ADC_BITS;
+	temperature_data_header.reading_bytes = NodeReading::BYTES;
 
 	node_state = INIT;
 
-	PowerOnBTAndWaitForMasterOK();
+	// nothing to collect before the master initialized us, back off while it is away
+	WaitForMasterWithBackoff();
 }
 
 void loop()
@@ -169,9 +337,14 @@ void loop()
         
 	// setup BT modlue serial connection
 
-	const struct timestamp * time_ptr;
-	const struct rendezvous_answer * receive_ptr;
-        struct temperature_reading * data_reading_ptr;
+	struct timestamp received_time;
+	struct rendezvous_answer answer;
+	unsigned char header_bytes[HEADER_WIRE_BYTES];
+
+	// millis() stands still in power down and while napping for the USART, so it
+	// counts the time spent awake in this state
+	const node_state_t awake_state = node_state;
+	const unsigned long awake_start_ms = millis();
         
 	switch (node_state) {
 		case INIT:
@@ -181,34 +354,34 @@ void loop()
 			Serial.write(INIT_MSG);
 
 			// Master OKAY
-			Serial.readBytes(receive_array, 1);
 			// Master rendezvous answer and new time
-			Serial.readBytes(receive_array, sizeof(rendezvous_answer) + 
-					sizeof(timestamp));
+			if(!ReceiveFromMaster(receive_array, 1) ||
+					!ReceiveFromMaster(receive_array, RENDEZVOUS_ANSWER_WIRE_BYTES +
+						TIMESTAMP_WIRE_BYTES))
+			{
+				// still without a schedule, initialize again once the master is back
+				PowerOffBT();
+				WaitForMasterWithBackoff();
+				break;
+			}
 
 			// update received time in RTC module
-			time_ptr = (const timestamp * const) (receive_array + sizeof(rendezvous_answer));
+			received_time = DecodeTimestamp(receive_array + RENDEZVOUS_ANSWER_WIRE_BYTES);
 
 			// end communication
 			Serial.write(FINI_MSG);
-			SetRTCTime(*time_ptr);
 			Serial.flush();
 
-			receive_ptr = (const rendezvous_answer * const) receive_array;
-                        delay(10);
-                        ClearRTCAlarmFlags();
-                        delay(10);
-			SetRTCAlarmFromTimestamp(receive_ptr->collection_start_time);
-                        delay(10);
-			EnableRTCAlarm1();
+			answer = DecodeRendezvousAnswer(receive_array);
+			SetRTCTimeAndAlarm1(received_time, answer.collection_start_time);
 
-			temperature_data_header.start_time = receive_ptr->collection_start_time;
-			temperature_data_header.interval_length_seconds = receive_ptr->interval_length_seconds;
+			temperature_data_header.start_time = answer.collection_start_time;
+			temperature_data_header.interval_length_seconds = answer.interval_length_seconds;
 			temperature_data_header.number_of_readings = 0;
 
-			current_alarm_times.seconds = receive_ptr->collection_start_time.seconds;
-			current_alarm_times.minutes = receive_ptr->collection_start_time.minutes;
-			current_alarm_times.hour = receive_ptr->collection_start_time.hour;
+			current_alarm_times.seconds = answer.collection_start_time.seconds;
+			current_alarm_times.minutes = answer.collection_start_time.minutes;
+			current_alarm_times.hour = answer.collection_start_time.hour;
 			
                         //delay(10);
                         PowerOffBT();
@@ -222,20 +395,46 @@ void loop()
 			// send back DUMP request to master
 			Serial.write(DUMP_MSG);
 
-			// receive master OKAY
-			Serial.readBytes(receive_array, 1);
+			// receive master OKAY, without it the master cannot store the dump
+			if(!ReceiveFromMaster(receive_array, 1))
+			{
+				BackOffRendezvous();
+				break;
+			}
 
-			// send out data
-			Serial.write((unsigned char *) &temperature_data_header, sizeof(temperature_readings_header));
-			Serial.write(temperature_readings, temperature_data_header.number_of_readings * sizeof(temperature_reading));
+			// send out data, the energy telemetry goes with the DATA following the dump
+			const bool data_follows = pending_data_header.number_of_readings;
+			struct temperature_readings_header dump_header = temperature_data_header;
+			if(data_follows)
+				memset(&dump_header.energy, 0, sizeof(energy_telemetry));
+			else
+				dump_header.energy.supply_millivolts = ReadSupplyMillivolts();
+			RTCTime(&dump_header.node_time);
+			EncodeHeader(dump_header, header_bytes);
+			Serial.write(header_bytes, HEADER_WIRE_BYTES);
+			Serial.write(temperature_readings, temperature_data_header.number_of_readings * NodeReading::BYTES);
 			Serial.flush();
 
-			PowerOffBT();
-
 			// zero out old temperature data
 			temperature_data_header.number_of_readings = 0;
 			memset(temperature_readings, 0, sizeof(temperature_readings));
 
+			// readings taken while waiting for the master follow as DATA in the same session
+			if(data_follows)
+			{
+				TakeOverPendingReadings();
+				node_state = DATA;
+				break;
+			}
+
+			memset(&temperature_data_header.energy, 0, sizeof(energy_telemetry));
+
+			// end communication
+			Serial.write(FINI_MSG);
+			Serial.flush();
+			PowerOffBT();
+
+			readings_wait_for_master = false;
 			SetNextRTCAlarm();
 			node_state = SLEEP;
 			break;
@@ -247,47 +446,62 @@ void loop()
 			Serial.write(DATA_MSG);
 			Serial.flush();
 
-			// receive master OKAY 
-			Serial.readBytes(receive_array, 1);
-			delay(10);
+			// receive master OKAY, without it the master cannot store the data
+			if(!ReceiveFromMaster(receive_array, 1))
+			{
+				BackOffRendezvous();
+				break;
+			}
 
-			// commence data transmission
-			//Serial.write((char *) &temperature_data_header, sizeof(temperature_readings_header));
-			for(unsigned int i = 0; i < sizeof(temperature_readings_header); ++i)
+			// commence data transmission, the master estimates our clock drift from node_time
+			temperature_data_header.energy.supply_millivolts = ReadSupplyMillivolts();
+			RTCTime(&temperature_data_header.node_time);
+			EncodeHeader(temperature_data_header, header_bytes);
+			for(unsigned int i = 0; i < HEADER_WIRE_BYTES; ++i)
 			{
-				Serial.write( ((char *) &temperature_data_header)[i] );
+				Serial.write(header_bytes[i]);
 				Serial.flush();
 				delay(15);
 			}
-			//Serial.write(temperature_readings, temperature_data_header.number_of_readings * sizeof(temperature_reading));
-			const unsigned int bytes_to_send = temperature_data_header.number_of_readings * sizeof(temperature_reading);
+			//Serial.write(temperature_readings, temperature_data_header.number_of_readings * NodeReading::BYTES);
+			const unsigned int bytes_to_send = temperature_data_header.number_of_readings * NodeReading::BYTES;
 			for(unsigned int i = 0; i <  bytes_to_send; ++i)
 			{
 				Serial.write(temperature_readings[i]);
 				Serial.flush();
 				delay(15);
 			}
-			Serial.readBytes(receive_array, sizeof(rendezvous_answer));
+			// the master answers only data it stored, without the answer the readings are
+			// kept and the old alarms stay
+			if(!ReceiveFromMaster(receive_array, RENDEZVOUS_ANSWER_WIRE_BYTES))
+			{
+				BackOffRendezvous();
+				break;
+			}
 			PowerOffBT();
 
-			receive_ptr = (rendezvous_answer *) receive_array;
+			answer = DecodeRendezvousAnswer(receive_array);
 
-			// set RTC alarm time as received
-			SetRTCAlarmFromTimestamp(receive_ptr->collection_start_time);
-			delay(10);
-			EnableRTCAlarm1();
+			// set RTC alarm time as received, the master sends its time only if our clock
+			// drifted too far
+			if(answer.time_sync.date)
+				SetRTCTimeAndAlarm1(answer.time_sync, answer.collection_start_time);
+			else
+				SetRTCAlarm1(answer.collection_start_time);
 
-			temperature_data_header.start_time = receive_ptr->collection_start_time;
-			temperature_data_header.interval_length_seconds = receive_ptr->interval_length_seconds;
+			temperature_data_header.start_time = answer.collection_start_time;
+			temperature_data_header.interval_length_seconds = answer.interval_length_seconds;
 			temperature_data_header.number_of_readings = 0;
 
-			current_alarm_times.seconds = receive_ptr->collection_start_time.seconds;
-			current_alarm_times.minutes = receive_ptr->collection_start_time.minutes;
-			current_alarm_times.hour = receive_ptr->collection_start_time.hour;
+			current_alarm_times.seconds = answer.collection_start_time.seconds;
+			current_alarm_times.minutes = answer.collection_start_time.minutes;
+			current_alarm_times.hour = answer.collection_start_time.hour;
 
 			// zero out temperature data
 			temperature_data_header.number_of_readings = 0;
 			memset(temperature_readings, 0, sizeof(temperature_readings));
+			memset(&temperature_data_header.energy, 0, sizeof(energy_telemetry));
+			readings_wait_for_master = false;
 			node_state = SLEEP;
 			break;
 		}
@@ -297,13 +511,16 @@ void loop()
 			Serial.write(TIME_MSG);
 			Serial.flush();
 			// receive master OKAY 
-			Serial.readBytes(receive_array, 1);
-			Serial.readBytes(receive_array, sizeof(timestamp));
+			if(!ReceiveFromMaster(receive_array, 1) ||
+					!ReceiveFromMaster(receive_array, TIMESTAMP_WIRE_BYTES))
+			{
+				BackOffRendezvous();
+				break;
+			}
 
 			// update received time in RTC module
-			time_ptr = (timestamp *) (receive_array);
-			SetRTCTime(*time_ptr);
-			delay(50);
+			received_time = DecodeTimestamp(receive_array);
+			SetRTCTime(received_time);
 
 			node_state = DATA;
 			break;
@@ -313,38 +530,36 @@ void loop()
                         //pinMode(13, OUTPUT);
                         //digitalWrite(13, HIGH);
 
-			// switch on temperature sensors
-			pinMode(TEMP_SENSORS_POWER_PIN, OUTPUT);
-			digitalWrite(TEMP_SENSORS_POWER_PIN, HIGH);
-
-			// do other stuff until temperature sensors are stabilized
+			CollectReading();
 
-			data_reading_ptr = 
-				(temperature_reading *) (temperature_readings + (temperature_data_header.number_of_readings * sizeof(temperature_reading)));
-                        
-                        temperature_data_header.number_of_readings += 1;
-                        
-			// memory full? if so we need to transmit the saved data next
-			if(temperature_data_header.number_of_readings >= MAX_NUMBER_OF_READINGS)
+			if(readings_wait_for_master && wake_ups_until_rendezvous-- == 0)
 			{
-				PowerOnBTAndWaitForMasterOK();
-				node_state = TIME;
+				node_state = RENDEZVOUS;
 			}
 			else
 			{
-				// set next alarm timer for wakeup
-				SetNextRTCAlarm();
 				node_state = SLEEP;
 
                                 pinMode(13, OUTPUT);
                                 digitalWrite(13, !digitalRead(13));
 			}
 
-			// now read temperature values 
-			ReadTemperatures(data_reading_ptr);
-			// switch off temperature sensors
-			digitalWrite(TEMP_SENSORS_POWER_PIN, LOW);
+			break;
+		}
+		case RENDEZVOUS:
+		{
+			// the first attempt falls into the window the master planned for us, later
+			// attempts have to catch one of its probes
+			const unsigned int timeout_seconds = rendezvous_backoff == 1 ?
+				MASTER_WAIT_SECONDS : MASTER_RETRY_WAIT_SECONDS;
+			if(PowerOnBTAndWaitForMasterOK(timeout_seconds, true))
+			{
+				node_state = pending_data_header.number_of_readings ? DUMP : DATA;
+				break;
+			}
 
+			// keep sampling with the radio off and try again later
+			BackOffRendezvous();
 			break;
 		}
 		case SLEEP:
@@ -356,62 +571,178 @@ void loop()
                         break;
 		// undefined state
 	}
+
+	CountAwakeTime(awake_state, millis() - awake_start_ms);
 }
 
-void SetNextRTCAlarm()
+// Takes the reading of the RTC alarm that just went off and sets the next alarm.
+void CollectReading()
 {
-        //pinMode(13, OUTPUT);
-        //digitalWrite(13, !digitalRead(13));
+	// switch on temperature sensors
+	pinMode(TEMP_SENSORS_POWER_PIN, OUTPUT);
+	digitalWrite(TEMP_SENSORS_POWER_PIN, HIGH);
+	const unsigned long sensors_on_ms = millis();
+
+	// do other stuff until temperature sensors are stabilized
+
+	unsigned char * const data_reading_ptr = NextReadingSlot();
+
+	// memory full? if so we need to transmit the saved data next
+	if(!readings_wait_for_master &&
+			temperature_data_header.number_of_readings >= MAX_NUMBER_OF_READINGS)
+	{
+		readings_wait_for_master = true;
+		wake_ups_until_rendezvous = 0;
+		rendezvous_backoff = 1;
+	}
+
+	// set next alarm timer for wakeup, a successful rendezvous replaces it
+	SetNextRTCAlarm();
 
-	const unsigned int seconds_of_next_alarm = 
-		temperature_data_header.interval_length_seconds + 
-		10*(current_alarm_times.seconds >> 4) + (current_alarm_times.seconds & 0x0F);
-	const unsigned int minutes_to_add = seconds_of_next_alarm / 60;
-	current_alarm_times.seconds = ((seconds_of_next_alarm % 60) / 10) << 4 | ((seconds_of_next_alarm % 60) % 10);
+	// now read temperature values, both buffers full drops the reading
+	if(data_reading_ptr)
+		ReadTemperatures(data_reading_ptr, sensors_on_ms);
+	// switch off temperature sensors
+	digitalWrite(TEMP_SENSORS_POWER_PIN, LOW);
+}
 
-	const unsigned int minutes_of_next_alarm = 
-		minutes_to_add + 
-		10*(current_alarm_times.minutes >> 4) + (current_alarm_times.minutes & 0x0F);
-	const unsigned int hours_to_add = minutes_of_next_alarm / 60;
-	current_alarm_times.minutes = ((minutes_of_next_alarm % 60) / 10) << 4 | ((minutes_of_next_alarm % 60) % 10);
+// Returns the slot for the next reading and counts it. Readings go to temperature_readings
+// until it is full and to pending_readings while it waits for the master. Returns nullptr if
+// both are full.
+unsigned char * NextReadingSlot()
+{
+	if(!readings_wait_for_master)
+	{
+		return temperature_readings +
+				(temperature_data_header.number_of_readings++ * NodeReading::BYTES);
+	}
 
-	const unsigned int hours_of_next_alarm = 
-		hours_to_add + 
-		10*(current_alarm_times.hour >> 4) + (current_alarm_times.hour & 0x0F);
-	current_alarm_times.hour = ((hours_of_next_alarm % 24) / 10) << 4 | ((hours_of_next_alarm % 24) % 10);
+	if(pending_data_header.number_of_readings >= MAX_NUMBER_OF_PENDING_READINGS)
+		return nullptr;
 
-	SetRTCAlarmFromTimestamp(current_alarm_times);
+	// the pending readings start with this wake-up of the RTC alarm
+	if(!pending_data_header.number_of_readings)
+	{
+		RTCTime(&pending_data_header.start_time);
+		pending_data_header.interval_length_seconds =
+			temperature_data_header.interval_length_seconds;
+	}
+
+	return pending_readings +
+			(pending_data_header.number_of_readings++ * NodeReading::BYTES);
 }
 
+// Moves the readings taken while waiting for the master into the emptied temperature_readings
+// so they are sent as DATA.
+void TakeOverPendingReadings()
+{
+	temperature_data_header.start_time = pending_data_header.start_time;
+	temperature_data_header.interval_length_seconds = pending_data_header.interval_length_seconds;
+	temperature_data_header.number_of_readings = pending_data_header.number_of_readings;
+	memcpy(temperature_readings, pending_readings,
+			pending_data_header.number_of_readings * NodeReading::BYTES);
+
+	pending_data_header.number_of_readings = 0;
+	memset(pending_readings, 0, sizeof(pending_readings));
+}
 
-void EnableRTCAlarm1()
+// Adds awake_ms spent in state to the energy telemetry sent with the next dump.
+void CountAwakeTime(const node_state_t state, const unsigned long awake_ms)
 {
-	Wire.begin();
-	Wire.beginTransmission(RTC_I2C_ADDRESS);
-	Wire.write(0x0E);
-	Wire.write(0x05);
-	Wire.endTransmission();
+	switch (state) {
+		case COLLECT:
+		case SLEEP:
+			temperature_data_header.energy.collect_awake_ms += awake_ms;
+			break;
+		default:
+			temperature_data_header.energy.transfer_awake_ms += awake_ms;
+			break;
+	}
 }
 
+// Seconds since midnight of a DS3231 timestamp in 24 hour mode.
+unsigned long SecondsOfDay(const timestamp & stamp)
+{
+	return 3600UL * (10 * ((stamp.hour >> 4) & 0x03) + (stamp.hour & 0x0F)) +
+		60UL * (10 * (stamp.minutes >> 4) + (stamp.minutes & 0x0F)) +
+		10 * (stamp.seconds >> 4) + (stamp.seconds & 0x0F);
+}
 
-// Sets Alarm 1 of RTC according to stamp.
-// Enables interrupt on hours, minutes and seconds match.
-void SetRTCAlarmFromTimestamp(const timestamp & stamp)
+// Packs 0 .. 99 into the BCD format of the DS3231 registers.
+unsigned char ToBCD(const unsigned char value)
 {
-	Wire.begin();
-	Wire.beginTransmission(RTC_I2C_ADDRESS);
-	Wire.write(0x07);
-        Wire.write(stamp.seconds);
+	return (value / 10) << 4 | (value % 10);
+}
+
+// Sets alarm 1 to the first alarm after the current RTC time on the grid of
+// current_alarm_times and the sampling interval. An alarm already in the past would only
+// match its hour, minute and second again a day later. Alarms up to half a day ahead are
+// kept as they are.
+void SetNextRTCAlarm()
+{
+	static const unsigned long SECONDS_PER_DAY = 86400UL;
+	const unsigned long interval_seconds = temperature_data_header.interval_length_seconds ?
+		temperature_data_header.interval_length_seconds : 1;
+
+	timestamp now;
+	RTCTime(&now);
+	unsigned long alarm_seconds = SecondsOfDay(current_alarm_times);
+	const unsigned long seconds_behind =
+		(SecondsOfDay(now) + SECONDS_PER_DAY - alarm_seconds) % SECONDS_PER_DAY;
+	if(seconds_behind < SECONDS_PER_DAY / 2)
+		alarm_seconds += (seconds_behind / interval_seconds + 1) * interval_seconds;
+	alarm_seconds %= SECONDS_PER_DAY;
+
+	current_alarm_times.seconds = ToBCD(alarm_seconds % 60);
+	current_alarm_times.minutes = ToBCD((alarm_seconds / 60) % 60);
+	current_alarm_times.hour = ToBCD(alarm_seconds / 3600);
+
+	SetRTCAlarm1(current_alarm_times);
+}
+
+
+// Writes the alarm registers up to the status register into the open transmission:
+// alarm 1 at stamp matching hours, minutes and seconds, the unused alarm 2, the control
+// register enabling the alarm 1 interrupt and finally the status register clearing stale
+// alarm flags.
+void WriteRTCAlarm1Registers(const timestamp & stamp)
+{
+	Wire.write(stamp.seconds);
 	Wire.write(stamp.minutes);
 	Wire.write(stamp.hour);
 	Wire.write(0x80 | stamp.date);
+	Wire.write(0);
+	Wire.write(0);
+	Wire.write(0);
+	Wire.write(RTC_CONTROL_ALARM1_INTERRUPT);
+	Wire.write(0);
+}
+
+
+// Sets and enables alarm 1 of the RTC in one I2C transaction.
+void SetRTCAlarm1(const timestamp & stamp)
+{
+	Wire.beginTransmission(RTC_I2C_ADDRESS);
+	Wire.write(RTC_ALARM1_REGISTER);
+	WriteRTCAlarm1Registers(stamp);
+	Wire.endTransmission();
+}
+
+
+// Sets the RTC time and enables alarm 1 at alarm in one I2C transaction, the alarm
+// registers directly follow the timekeeping registers.
+void SetRTCTimeAndAlarm1(const timestamp & stamp, const timestamp & alarm)
+{
+	Wire.beginTransmission(RTC_I2C_ADDRESS);
+	Wire.write(0x00);
+	Wire.write(((unsigned char *)&stamp) + 1, sizeof(timestamp) - 1);
+	WriteRTCAlarm1Registers(alarm);
 	Wire.endTransmission();
 }
 
 
 void SetRTCTime(const timestamp & stamp)
 {
-	Wire.begin();
 	Wire.beginTransmission(RTC_I2C_ADDRESS);
 	Wire.write(0x00);
 	Wire.write(((unsigned char *)&stamp) + 1, sizeof(timestamp) - 1);
@@ -421,38 +752,114 @@ void SetRTCTime(const timestamp & stamp)
 
 void ClearRTCAlarmFlags()
 {
-	Wire.begin();
 	Wire.beginTransmission(RTC_I2C_ADDRESS);
-	Wire.write(0x0F);
+	Wire.write(RTC_STATUS_REGISTER);
         Wire.write(0);
 	Wire.endTransmission();
 }
 
+// Reads the current time of the RTC into stamp, stamp stays zero if the RTC does not answer.
 void RTCTime(timestamp * stamp)
 {
-	//TODO
+	memset(stamp, 0, sizeof(timestamp));
+
+	Wire.beginTransmission(RTC_I2C_ADDRESS);
+	Wire.write(0x00);
+	if(Wire.endTransmission() != 0)
+		return;
+
+	// the RTC registers start with seconds, timestamp with the ignored cents
+	const int number_of_registers = sizeof(timestamp) - 1;
+	if(Wire.requestFrom((int) RTC_I2C_ADDRESS, number_of_registers) != number_of_registers)
+		return;
+	for(int i = 0; i < number_of_registers; ++i)
+		((unsigned char *) stamp)[i + 1] = Wire.read();
 }
 
-void ReadTemperatures(struct temperature_reading * const data_reading_ptr)
-{	
-	int temp_value;
+// Naps in idle mode until the temperature sensors switched on at sensors_on_ms have settled.
+// Timer0 keeps running in idle mode and wakes the CPU every millisecond.
+void WaitForTemperatureSensors(const unsigned long sensors_on_ms)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	while(millis() - sensors_on_ms < TEMP_SENSORS_SETTLE_MS)
+	{
+		sleep_mode();
+	}
+}
 
-	delay(50);
-	temp_value = analogRead(TEMP_SENSORS_INPUT_1);
-	data_reading_ptr->temperatures_packed[0] |= (temp_value & 0xFF);
-	data_reading_ptr->temperatures_packed[1] |= (temp_value >> 8);
+void EnableADC()
+{
+	power_adc_enable();
+	// internal 1.1V reference, prescaler 128, conversion complete interrupt
+	ADMUX = _BV(REFS1) | _BV(REFS0);
+	ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	// the first conversion after switching the reference is not accurate, throw it away
+	ReadADCInNoiseReduction(0);
+}
 
-	temp_value = analogRead(TEMP_SENSORS_INPUT_2);
-	data_reading_ptr->temperatures_packed[1] |= (temp_value & 0x3F) << 2;
-	data_reading_ptr->temperatures_packed[2] |= (temp_value >> 6);
+void DisableADC()
+{
+	// an enabled ADC keeps drawing current in power down mode
+	ADCSRA = 0;
+	power_adc_disable();
+}
 
-	temp_value = analogRead(TEMP_SENSORS_INPUT_3);
-	data_reading_ptr->temperatures_packed[2] |= (temp_value & 0x0F) << 4;
-	data_reading_ptr->temperatures_packed[3] |= (temp_value >> 4);
+// Converts channel while the CPU sleeps in ADC noise reduction mode, which starts each
+// conversion on entry. Timer0 is stopped meanwhile so that only the conversion complete
+// interrupt wakes the CPU. Returns the mean of 2^ADC_OVERSAMPLING_SHIFT conversions.
+int ReadADCInNoiseReduction(const unsigned char channel)
+{
+	unsigned int sum = 0;
+
+	ADMUX = (ADMUX & 0xF0) | (channel & 0x0F);
+
+	power_timer0_disable();
+	set_sleep_mode(SLEEP_MODE_ADC);
+	for(unsigned char i = 0; i < (1 << ADC_OVERSAMPLING_SHIFT); ++i)
+	{
+		sleep_enable();
+		sleep_cpu();
+		// some other interrupt (USART) woke us before the conversion completed
+		while(ADCSRA & _BV(ADSC))
+			sleep_cpu();
+		sleep_disable();
+
+		sum += ADC;
+	}
+	power_timer0_enable();
+
+	return sum >> ADC_OVERSAMPLING_SHIFT;
+}
+
+// Measures the internal bandgap against AVcc and returns the supply voltage, 0 if the
+// conversion failed.
+unsigned int ReadSupplyMillivolts()
+{
+	power_adc_enable();
+	ADMUX = _BV(REFS0) | ADC_BANDGAP_CHANNEL;
+	ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	// the bandgap needs some conversions to settle after switching to it
+	for(unsigned char i = 0; i < 4; ++i)
+		ReadADCInNoiseReduction(ADC_BANDGAP_CHANNEL);
+	const unsigned long bandgap = ReadADCInNoiseReduction(ADC_BANDGAP_CHANNEL);
+	DisableADC();
+
+	if(!bandgap)
+		return 0;
+	return (ADC_BANDGAP_MILLIVOLTS * 1023) / bandgap;
+}
+
+void ReadTemperatures(unsigned char * const data_reading_ptr,
+		const unsigned long sensors_on_ms)
+{	
+	WaitForTemperatureSensors(sensors_on_ms);
+	EnableADC();
 
-	temp_value = analogRead(TEMP_SENSORS_INPUT_4);
-	data_reading_ptr->temperatures_packed[3] |= (temp_value & 0x03) << 6;
-	data_reading_ptr->temperatures_packed[4] |= (temp_value >> 2);
+	uint16_t temperatures[NodeReading::SENSOR_COUNT];
+	for(unsigned char sensor = 0; sensor < NodeReading::SENSOR_COUNT; ++sensor)
+		temperatures[sensor] = ReadADCInNoiseReduction(TEMP_SENSORS_CHANNELS[sensor]);
+	NodeReading::PackAll(temperatures, data_reading_ptr);
 
+	DisableADC();
 }
 
@@ -65,7 +65,8 @@
 // Node		<---[BIN 2]---		Master
 //
 // Node sends collected data out and receives after that a new data collection start time and
-// rendezvous time.
+// rendezvous time. The answer carries the current time as well if the RTC of the node drifted
+// too far, nodes do not request [CASE C] before sending their data anymore.
 //
 // *****************************************************
 // *****************************************************
@@ -75,7 +76,12 @@
 // Node		<---'OKAY'----		Master
 // Node		 ---[BIN 1]--->		Master
 //
-// Node just sends collected data out.
+// Node		 ---'FINI'---->		Master
+// [--OR--]
+// [CASE B1]
+//
+// Node just sends collected data out. A node that could not reach the master when its buffer
+// was full dumps that buffer and sends the readings it kept taking meanwhile as [CASE B1].
 //
 // *****************************************************
 // *****************************************************
@@ -110,7 +116,12 @@
 
 #include <stdint.h>
 
-// enum message_enum { OKAY_MSG = 0,  INIT_MSG = 1, DATA_MSG = 2, DUMP_MSG = 3, TIME_MSG = 4, TEST_MSG = 5, FINI_MSG = 6 };
+// Number of readings a node collects before it powers up Bluetooth and sends them to the
+// master. The master derives the expected wake-up of a node from it.
+static const unsigned int MAX_NUMBER_OF_READINGS = 150;
+
+// Single byte messages a session is made of, requests of the node and the OKAY of the master.
+enum message_enum { OKAY_MSG = 0,  INIT_MSG = 1, DATA_MSG = 2, DUMP_MSG = 3, TIME_MSG = 4, TEST_MSG = 5, FINI_MSG = 6 };
 
 // Bundles a readout of all four connected temperature sensors as a 5 byte large datachunk.
 // [BIN T]
@@ -122,6 +133,10 @@
 // MSB ..............................................................................  LSB
 // d d d d d d d d | d d c c c c c c | c c c c b b b b | b b b b b b a a | a a a a a a a a
 //     BYTE 4      |     BYTE 3      |     BYTE 2      |     BYTE 1      |     BYTE 0
+//
+// This is the reading format of the current nodes and of [CASE D]. Dumps announce their
+// format in the header [BIN 1]: a reading packs sensor count values of ADC bits each the same
+// way, temperature 1 in the lowest bits, rounded up to whole bytes with zero bits.
 
 struct temperature_reading {
 	// four 10-Bit temperature readings packed into 5 Bytes
@@ -161,24 +176,67 @@ struct timestamp {
 	unsigned char year;
 };
 
+// Where the battery of a node went since it sent its previous dump, carried in the header.
+// Awake times are counted with the CPU clock running, power down sleep is not included.
+// [BIN E]
+// milliseconds awake collecting (wake-ups, sampling, setting alarms)	- a
+// milliseconds awake talking to the master (INIT, DATA, DUMP, TIME)	- b
+// seconds Bluetooth was powered waiting for the master OKAY		- c
+// number of wake-ups by the RTC alarm					- d
+// supply voltage in millivolts measured right before sending		- e
+//
+// MSB ..............................................................................  LSB
+//                                   | e e e e e e e e | e e e e e e e e | d d d d d d d d
+//                                   |     BYTE 15     |     BYTE 14     |     BYTE 13
+//                                   |                 |                 |
+// d d d d d d d d | c c c c c c c c | c c c c c c c c | c c c c c c c c | c c c c c c c c
+//     BYTE 12     |     BYTE 11     |     BYTE 10     |     BYTE 9      |     BYTE 8
+// BYTE 7 ---------------------------------- b ---------------------------------- BYTE 4
+// BYTE 3 ---------------------------------- a ---------------------------------- BYTE 0
+
+struct energy_telemetry {
+	uint32_t collect_awake_ms;
+	uint32_t transfer_awake_ms;
+	uint32_t master_wait_seconds;
+	uint16_t wake_ups;
+	uint16_t supply_millivolts;
+};
+
 // Definition of header data sent by Node (Arduino) before the temperature readings are pushed out.
 // [BIN 1]
 // interval length seconds	- a
 // number of readings		- b
+// sensor count			- c
+// ADC bits			- d
+// bytes per reading		- e
 // int
 // MSB ..............................................................................  LSB
+// e e e e e e e e | e e e e e e e e | d d d d d d d d | c c c c c c c c
+//     BYTE 43     |     BYTE 42     |     BYTE 41     |     BYTE 40
+// BYTE 39 ---------------------------------[BIN E]--------------------------------- BYTE 24
+// BYTE 23 ---------------------------------[BIN 0]--------------------------------- BYTE 16
 //                                   | b b b b b b b b | b b b b b b b b | b b b b b b b b
 //                                   |     BYTE 15     |     BYTE 14     |     BYTE 13
 //                                   |                 |                 |
 // b b b b b b b b | a a a a a a a a | a a a a a a a a | a a a a a a a a | a a a a a a a a
 //     BYTE 12     |     BYTE 11     |     BYTE 10     |     BYTE 9      |     BYTE 8
 // BYTE 7 ---------------------------------[BIN 0]--------------------------------- BYTE 0
+//
+// Bytes 16 to 23 hold the time of the node RTC read right before the header is sent, the
+// master estimates the drift of the node clock from it. Bytes 24 to 39 hold the
+// energy_telemetry [BIN E] of the node. Bytes 40 to 43 describe the format of the readings
+// that follow the header, bytes per reading is (sensor count * ADC bits + 7) / 8.
 
 struct temperature_readings_header {
 	timestamp start_time;
 	uint32_t interval_length_seconds;
 	uint32_t number_of_readings;
-	// followed by number_of_readings temperature_reading
+	timestamp node_time;
+	energy_telemetry energy;
+	uint8_t sensor_count;
+	uint8_t adc_bits;
+	uint16_t reading_bytes;
+	// followed by number_of_readings readings of reading_bytes each
 };
 
 // Binary part of the Node (Arduino).
@@ -187,15 +245,21 @@ struct temperature_readings_header {
 // collection start time 	- A
 // next rendezvous		- B
 // interval length in seconds	- C
+// time sync			- D
 //
-//                 | a a a a a a a a | a a a a a a a a | a a a a a a a a | a a a a a a a a
-//                 |     BYTE 11     |     BYTE 10     |     BYTE 9      |     BYTE 8
+// D BYTE 27---------------------------------[BIN 0]--------------------------------- BYTE 20
+//                 | c c c c c c c c | c c c c c c c c | c c c c c c c c | c c c c c c c c
+//                 |     BYTE 19     |     BYTE 18     |     BYTE 17     |     BYTE 16
 // B BYTE 15---------------------------------[BIN 0]--------------------------------- BYTE 8
 // A BYTE 7 ---------------------------------[BIN 0]--------------------------------- BYTE 0
+//
+// The master fills time sync with its current time right before sending the answer if the
+// node has to set its RTC. Otherwise all its bytes are zero.
 struct rendezvous_answer {
 	timestamp collection_start_time;
 	timestamp next_rendezvous;
 	uint32_t interval_length_seconds;
+	timestamp time_sync;
 };
 
 
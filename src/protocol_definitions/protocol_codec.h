@@ -0,0 +1,486 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef PROTOCOL_CODEC_H_Q8ZK3TVA
+#define PROTOCOL_CODEC_H_Q8ZK3TVA
+
+// Header-only encoding and decoding of the structs in communication_structs.h, shared by the
+// node sketch and the master. The wire format is the byte layout drawn in
+// communication_structs.h: no padding, integers little-endian. Decoding reads the bytes
+// explicitly, so neither side depends on the padding or byte order of its compiler. All
+// functions are inline and do not allocate, views decode fields straight from the receive
+// buffer when they are accessed.
+//
+// Only C headers are used, the AVR toolchain has no C++ standard library.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "communication_structs.h"
+
+// Sizes of the structs on the wire.
+static const unsigned int TIMESTAMP_WIRE_BYTES = 8;
+static const unsigned int TEMPERATURE_READING_WIRE_BYTES = 5;
+static const unsigned int ENERGY_TELEMETRY_WIRE_BYTES = 16;
+static const unsigned int HEADER_WIRE_BYTES = 44;
+static const unsigned int RENDEZVOUS_ANSWER_WIRE_BYTES = 28;
+
+// Offsets of the members of temperature_readings_header [BIN 1].
+static const unsigned int HEADER_START_TIME_OFFSET = 0;
+static const unsigned int HEADER_INTERVAL_LENGTH_OFFSET = 8;
+static const unsigned int HEADER_NUMBER_OF_READINGS_OFFSET = 12;
+static const unsigned int HEADER_NODE_TIME_OFFSET = 16;
+static const unsigned int HEADER_ENERGY_OFFSET = 24;
+static const unsigned int HEADER_SENSOR_COUNT_OFFSET = 40;
+static const unsigned int HEADER_ADC_BITS_OFFSET = 41;
+static const unsigned int HEADER_READING_BYTES_OFFSET = 42;
+
+// Offsets of the members of rendezvous_answer [BIN 2].
+static const unsigned int ANSWER_COLLECTION_START_OFFSET = 0;
+static const unsigned int ANSWER_NEXT_RENDEZVOUS_OFFSET = 8;
+static const unsigned int ANSWER_INTERVAL_LENGTH_OFFSET = 16;
+static const unsigned int ANSWER_TIME_SYNC_OFFSET = 20;
+
+static const unsigned int TEMPERATURE_BITS = 10;
+static const unsigned int TEMPERATURE_MASK = (1u << TEMPERATURE_BITS) - 1;
+static const unsigned int TEMPERATURES_PER_READING = 4;
+
+// Upper bounds of the reading formats a dump may announce, see ReadingDecoder.
+static const unsigned int MAX_SENSOR_COUNT = 8;
+static const unsigned int MAX_ADC_BITS = 12;
+static const unsigned int MAX_READING_BYTES = (MAX_SENSOR_COUNT * MAX_ADC_BITS + 7) / 8;
+
+// Both sides may copy whole structs as long as their layout matches the wire format. A
+// failing check means communication_structs.h changed without this codec.
+static_assert(sizeof(timestamp) == TIMESTAMP_WIRE_BYTES, "timestamp has to be 8 bytes");
+static_assert(sizeof(temperature_reading) == TEMPERATURE_READING_WIRE_BYTES &&
+		alignof(temperature_reading) == 1,
+		"temperature readings are read in place from receive buffers");
+static_assert(sizeof(energy_telemetry) == ENERGY_TELEMETRY_WIRE_BYTES,
+		"energy_telemetry has to match [BIN E]");
+static_assert(sizeof(temperature_readings_header) == HEADER_WIRE_BYTES &&
+		offsetof(temperature_readings_header, interval_length_seconds) ==
+			HEADER_INTERVAL_LENGTH_OFFSET &&
+		offsetof(temperature_readings_header, number_of_readings) ==
+			HEADER_NUMBER_OF_READINGS_OFFSET &&
+		offsetof(temperature_readings_header, node_time) == HEADER_NODE_TIME_OFFSET &&
+		offsetof(temperature_readings_header, energy) == HEADER_ENERGY_OFFSET &&
+		offsetof(temperature_readings_header, sensor_count) == HEADER_SENSOR_COUNT_OFFSET &&
+		offsetof(temperature_readings_header, adc_bits) == HEADER_ADC_BITS_OFFSET &&
+		offsetof(temperature_readings_header, reading_bytes) == HEADER_READING_BYTES_OFFSET,
+		"temperature_readings_header has to match [BIN 1]");
+static_assert(sizeof(rendezvous_answer) == RENDEZVOUS_ANSWER_WIRE_BYTES &&
+		offsetof(rendezvous_answer, next_rendezvous) == ANSWER_NEXT_RENDEZVOUS_OFFSET &&
+		offsetof(rendezvous_answer, interval_length_seconds) ==
+			ANSWER_INTERVAL_LENGTH_OFFSET &&
+		offsetof(rendezvous_answer, time_sync) == ANSWER_TIME_SYNC_OFFSET,
+		"rendezvous_answer has to match [BIN 2]");
+
+// Integers
+
+constexpr uint16_t DecodeUint16(const unsigned char * bytes)
+{
+	return uint16_t(bytes[0] | (uint16_t(bytes[1]) << 8));
+}
+
+constexpr uint32_t DecodeUint32(const unsigned char * bytes)
+{
+	return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) |
+		(uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+inline void EncodeUint16(const uint16_t value, unsigned char * bytes)
+{
+	bytes[0] = value & 0xFF;
+	bytes[1] = value >> 8;
+}
+
+inline void EncodeUint32(const uint32_t value, unsigned char * bytes)
+{
+	bytes[0] = value & 0xFF;
+	bytes[1] = (value >> 8) & 0xFF;
+	bytes[2] = (value >> 16) & 0xFF;
+	bytes[3] = value >> 24;
+}
+
+// timestamp [BIN 0]
+
+constexpr timestamp DecodeTimestamp(const unsigned char * bytes)
+{
+	return timestamp{bytes[0], bytes[1], bytes[2], bytes[3],
+		bytes[4], bytes[5], bytes[6], bytes[7]};
+}
+
+inline void EncodeTimestamp(const timestamp & stamp, unsigned char * bytes)
+{
+	bytes[0] = stamp.cents;
+	bytes[1] = stamp.seconds;
+	bytes[2] = stamp.minutes;
+	bytes[3] = stamp.hour;
+	bytes[4] = stamp.day;
+	bytes[5] = stamp.date;
+	bytes[6] = stamp.century_month;
+	bytes[7] = stamp.year;
+}
+
+// temperature_reading [BIN T], sensor 0 to 3 in the low to high bits
+
+constexpr uint16_t UnpackTemperature(const unsigned char * packed, const unsigned int sensor)
+{
+	return (DecodeUint16(packed + sensor * TEMPERATURE_BITS / 8) >>
+			(sensor * TEMPERATURE_BITS % 8)) & TEMPERATURE_MASK;
+}
+
+constexpr uint16_t UnpackTemperature(const temperature_reading & reading,
+		const unsigned int sensor)
+{
+	return UnpackTemperature(reading.temperatures_packed, sensor);
+}
+
+// Packs four raw ADC values, bits above the tenth are dropped.
+constexpr temperature_reading PackTemperatures(const uint16_t temperature_1,
+		const uint16_t temperature_2, const uint16_t temperature_3,
+		const uint16_t temperature_4)
+{
+	return temperature_reading{{
+		(unsigned char) (temperature_1 & 0xFF),
+		(unsigned char) (((temperature_1 >> 8) & 0x03) | ((temperature_2 & 0x3F) << 2)),
+		(unsigned char) (((temperature_2 >> 6) & 0x0F) | ((temperature_3 & 0x0F) << 4)),
+		(unsigned char) (((temperature_3 >> 4) & 0x3F) | ((temperature_4 & 0x03) << 6)),
+		(unsigned char) ((temperature_4 >> 2) & 0xFF)}};
+}
+
+static_assert(UnpackTemperature(PackTemperatures(0x3FF, 0, 0, 0), 0) == 0x3FF &&
+		UnpackTemperature(PackTemperatures(0x155, 0x2AA, 0x0F0, 0x30F), 1) == 0x2AA &&
+		UnpackTemperature(PackTemperatures(0x155, 0x2AA, 0x0F0, 0x30F), 2) == 0x0F0 &&
+		UnpackTemperature(PackTemperatures(0x155, 0x2AA, 0x0F0, 0x30F), 3) == 0x30F,
+		"10 bit packing has to round trip");
+
+// Readings of any format [BIN T]
+
+constexpr unsigned int ReadingBytes(const unsigned int sensor_count, const unsigned int adc_bits)
+{
+	return (sensor_count * adc_bits + 7) / 8;
+}
+
+// Decodes the first N little-endian bytes, N is at most 4.
+template<unsigned int N>
+constexpr uint32_t DecodeBytes(const unsigned char * bytes)
+{
+	return (uint32_t(bytes[N - 1]) << (8 * (N - 1))) | DecodeBytes<N - 1>(bytes);
+}
+
+template<>
+constexpr uint32_t DecodeBytes<0>(const unsigned char *)
+{
+	return 0;
+}
+
+// Adds the low N bytes of bits to the first N bytes, N is at most 4.
+template<unsigned int N>
+inline void EncodeOrBytes(const uint32_t bits, unsigned char * bytes)
+{
+	bytes[N - 1] |= (bits >> (8 * (N - 1))) & 0xFF;
+	EncodeOrBytes<N - 1>(bits, bytes);
+}
+
+template<>
+inline void EncodeOrBytes<0>(const uint32_t, unsigned char *)
+{}
+
+// Unrolls the per sensor kernels of Reading, sensors 0 to Sensor - 1.
+template<typename Reading, unsigned int Sensor = Reading::SENSOR_COUNT>
+struct PackedKernel
+{
+	static void Unpack(const unsigned char * packed, uint16_t * values)
+	{
+		PackedKernel<Reading, Sensor - 1>::Unpack(packed, values);
+		values[Sensor - 1] = Reading::template Unpack<Sensor - 1>(packed);
+	}
+
+	static void Pack(const uint16_t * values, unsigned char * packed)
+	{
+		PackedKernel<Reading, Sensor - 1>::Pack(values, packed);
+		Reading::template Pack<Sensor - 1>(values[Sensor - 1], packed);
+	}
+};
+
+template<typename Reading>
+struct PackedKernel<Reading, 0>
+{
+	static void Unpack(const unsigned char *, uint16_t *) {}
+	static void Pack(const uint16_t *, unsigned char *) {}
+};
+
+// A reading of SensorCount values with AdcBits each, packed like [BIN T]. Byte offset, shift
+// and width of every sensor are constants of the instantiation, so packing and unpacking a
+// reading compile to fixed loads, shifts and masks without loops or branches.
+template<unsigned int SensorCount, unsigned int AdcBits>
+struct PackedReading
+{
+	static_assert(SensorCount > 0 && SensorCount <= MAX_SENSOR_COUNT &&
+			AdcBits > 0 && AdcBits <= 16,
+			"a reading holds 1 to MAX_SENSOR_COUNT values of at most 16 bits");
+
+	static const unsigned int SENSOR_COUNT = SensorCount;
+	static const unsigned int ADC_BITS = AdcBits;
+	static const unsigned int BYTES = (SensorCount * AdcBits + 7) / 8;
+	static const uint16_t MASK = uint16_t((1ul << AdcBits) - 1);
+
+	// Value of a single sensor.
+	template<unsigned int Sensor>
+	static constexpr uint16_t Unpack(const unsigned char * packed)
+	{
+		static_assert(Sensor < SensorCount, "sensor is not part of the reading");
+		return (DecodeBytes<(Sensor * AdcBits % 8 + AdcBits + 7) / 8>(
+					packed + Sensor * AdcBits / 8) >> (Sensor * AdcBits % 8)) & MASK;
+	}
+
+	// Adds the value of a single sensor to zeroed bits, bits above AdcBits are dropped.
+	template<unsigned int Sensor>
+	static void Pack(const uint16_t value, unsigned char * packed)
+	{
+		static_assert(Sensor < SensorCount, "sensor is not part of the reading");
+		EncodeOrBytes<(Sensor * AdcBits % 8 + AdcBits + 7) / 8>(
+				uint32_t(value & MASK) << (Sensor * AdcBits % 8),
+				packed + Sensor * AdcBits / 8);
+	}
+
+	// Writes all SensorCount values of packed to values.
+	static void UnpackAll(const unsigned char * packed, uint16_t * values)
+	{
+		PackedKernel<PackedReading>::Unpack(packed, values);
+	}
+
+	// Packs SensorCount values into BYTES bytes of packed.
+	static void PackAll(const uint16_t * values, unsigned char * packed)
+	{
+		for (unsigned int i = 0; i < BYTES; ++i)
+			packed[i] = 0;
+		PackedKernel<PackedReading>::Pack(values, packed);
+	}
+};
+
+static_assert(PackedReading<4, 10>::BYTES == TEMPERATURE_READING_WIRE_BYTES &&
+		PackedReading<4, 10>::Unpack<0>(
+			PackTemperatures(0x155, 0x2AA, 0x0F0, 0x30F).temperatures_packed) == 0x155 &&
+		PackedReading<4, 10>::Unpack<3>(
+			PackTemperatures(0x155, 0x2AA, 0x0F0, 0x30F).temperatures_packed) == 0x30F,
+		"PackedReading<4, 10> has to be the temperature_reading layout");
+static_assert(PackedReading<MAX_SENSOR_COUNT, MAX_ADC_BITS>::BYTES == MAX_READING_BYTES,
+		"MAX_READING_BYTES has to hold the largest supported reading");
+
+// energy_telemetry [BIN E]
+
+constexpr energy_telemetry DecodeEnergyTelemetry(const unsigned char * bytes)
+{
+	return energy_telemetry{DecodeUint32(bytes), DecodeUint32(bytes + 4),
+		DecodeUint32(bytes + 8), DecodeUint16(bytes + 12), DecodeUint16(bytes + 14)};
+}
+
+inline void EncodeEnergyTelemetry(const energy_telemetry & energy, unsigned char * bytes)
+{
+	EncodeUint32(energy.collect_awake_ms, bytes);
+	EncodeUint32(energy.transfer_awake_ms, bytes + 4);
+	EncodeUint32(energy.master_wait_seconds, bytes + 8);
+	EncodeUint16(energy.wake_ups, bytes + 12);
+	EncodeUint16(energy.supply_millivolts, bytes + 14);
+}
+
+// temperature_readings_header [BIN 1]
+
+constexpr temperature_readings_header DecodeHeader(const unsigned char * bytes)
+{
+	return temperature_readings_header{
+		DecodeTimestamp(bytes + HEADER_START_TIME_OFFSET),
+		DecodeUint32(bytes + HEADER_INTERVAL_LENGTH_OFFSET),
+		DecodeUint32(bytes + HEADER_NUMBER_OF_READINGS_OFFSET),
+		DecodeTimestamp(bytes + HEADER_NODE_TIME_OFFSET),
+		DecodeEnergyTelemetry(bytes + HEADER_ENERGY_OFFSET),
+		bytes[HEADER_SENSOR_COUNT_OFFSET],
+		bytes[HEADER_ADC_BITS_OFFSET],
+		DecodeUint16(bytes + HEADER_READING_BYTES_OFFSET)};
+}
+
+inline void EncodeHeader(const temperature_readings_header & header, unsigned char * bytes)
+{
+	EncodeTimestamp(header.start_time, bytes + HEADER_START_TIME_OFFSET);
+	EncodeUint32(header.interval_length_seconds, bytes + HEADER_INTERVAL_LENGTH_OFFSET);
+	EncodeUint32(header.number_of_readings, bytes + HEADER_NUMBER_OF_READINGS_OFFSET);
+	EncodeTimestamp(header.node_time, bytes + HEADER_NODE_TIME_OFFSET);
+	EncodeEnergyTelemetry(header.energy, bytes + HEADER_ENERGY_OFFSET);
+	bytes[HEADER_SENSOR_COUNT_OFFSET] = header.sensor_count;
+	bytes[HEADER_ADC_BITS_OFFSET] = header.adc_bits;
+	EncodeUint16(header.reading_bytes, bytes + HEADER_READING_BYTES_OFFSET);
+}
+
+// rendezvous_answer [BIN 2]
+
+constexpr rendezvous_answer DecodeRendezvousAnswer(const unsigned char * bytes)
+{
+	return rendezvous_answer{
+		DecodeTimestamp(bytes + ANSWER_COLLECTION_START_OFFSET),
+		DecodeTimestamp(bytes + ANSWER_NEXT_RENDEZVOUS_OFFSET),
+		DecodeUint32(bytes + ANSWER_INTERVAL_LENGTH_OFFSET),
+		DecodeTimestamp(bytes + ANSWER_TIME_SYNC_OFFSET)};
+}
+
+inline void EncodeRendezvousAnswer(const rendezvous_answer & answer, unsigned char * bytes)
+{
+	EncodeTimestamp(answer.collection_start_time, bytes + ANSWER_COLLECTION_START_OFFSET);
+	EncodeTimestamp(answer.next_rendezvous, bytes + ANSWER_NEXT_RENDEZVOUS_OFFSET);
+	EncodeUint32(answer.interval_length_seconds, bytes + ANSWER_INTERVAL_LENGTH_OFFSET);
+	EncodeTimestamp(answer.time_sync, bytes + ANSWER_TIME_SYNC_OFFSET);
+}
+
+// Reads a header in place, bytes has to hold HEADER_WIRE_BYTES.
+class HeaderView
+{
+public:
+	explicit constexpr HeaderView (const unsigned char * bytes) : bytes_(bytes) {}
+
+	// access functions
+	constexpr timestamp start_time() const
+	{
+		return DecodeTimestamp(bytes_ + HEADER_START_TIME_OFFSET);
+	}
+	constexpr uint32_t interval_length_seconds() const
+	{
+		return DecodeUint32(bytes_ + HEADER_INTERVAL_LENGTH_OFFSET);
+	}
+	constexpr uint32_t number_of_readings() const
+	{
+		return DecodeUint32(bytes_ + HEADER_NUMBER_OF_READINGS_OFFSET);
+	}
+	constexpr timestamp node_time() const
+	{
+		return DecodeTimestamp(bytes_ + HEADER_NODE_TIME_OFFSET);
+	}
+	constexpr energy_telemetry energy() const
+	{
+		return DecodeEnergyTelemetry(bytes_ + HEADER_ENERGY_OFFSET);
+	}
+	constexpr uint8_t sensor_count() const { return bytes_[HEADER_SENSOR_COUNT_OFFSET]; }
+	constexpr uint8_t adc_bits() const { return bytes_[HEADER_ADC_BITS_OFFSET]; }
+	constexpr uint16_t reading_bytes() const
+	{
+		return DecodeUint16(bytes_ + HEADER_READING_BYTES_OFFSET);
+	}
+	constexpr temperature_readings_header header() const { return DecodeHeader(bytes_); }
+
+private:
+	const unsigned char * bytes_;
+};
+
+// Reads a whole dump, header followed by its readings, in place from size bytes. A header of
+// header_bytes is longer than HEADER_WIRE_BYTES if a later protocol appended fields to it.
+class DumpView
+{
+public:
+	constexpr DumpView (const unsigned char * bytes, const size_t size,
+			const size_t header_bytes = HEADER_WIRE_BYTES) :
+		bytes_(bytes),
+		size_(size),
+		header_bytes_(header_bytes)
+	{}
+
+	// True if the header fits, announces at most MAX_NUMBER_OF_READINGS of at most
+	// MAX_READING_BYTES and all of them are in the buffer.
+	constexpr bool complete() const
+	{
+		return header_bytes_ >= HEADER_WIRE_BYTES && size_ >= header_bytes_ &&
+			header().number_of_readings() <= MAX_NUMBER_OF_READINGS &&
+			header().reading_bytes() <= MAX_READING_BYTES &&
+			size_ - header_bytes_ >= readings_size();
+	}
+
+	// access functions
+	constexpr HeaderView header() const { return HeaderView(bytes_); }
+	// readings are plain bytes in the format of the header, decode them with ReadingDecoder
+	constexpr const unsigned char * readings() const { return bytes_ + header_bytes_; }
+	constexpr size_t readings_size() const
+	{
+		return size_t(header().number_of_readings()) * header().reading_bytes();
+	}
+
+private:
+	const unsigned char * bytes_;
+	size_t size_;
+	size_t header_bytes_;
+};
+
+// Decodes the readings of a dump with the kernel of the format announced in its header. Nodes
+// negotiate their format by announcing it, the master decodes every format listed in Kernel()
+// with its own PackedReading instantiation.
+class ReadingDecoder
+{
+public:
+	typedef void (*UnpackFunction)(const unsigned char * packed, uint16_t * values);
+
+	explicit ReadingDecoder (const temperature_readings_header & header) :
+		unpack_(Kernel(header.sensor_count, header.adc_bits)),
+		sensor_count_(header.sensor_count),
+		adc_bits_(header.adc_bits),
+		reading_bytes_(header.reading_bytes)
+	{}
+
+	// False for unsupported formats and headers whose reading size does not match the format.
+	bool valid() const
+	{
+		return unpack_ && reading_bytes_ == ReadingBytes(sensor_count_, adc_bits_);
+	}
+
+	// Writes the sensor_count() values of reading index to values, only for valid decoders.
+	void Unpack(const unsigned char * readings, const unsigned int index,
+			uint16_t * values) const
+	{
+		unpack_(readings + index * reading_bytes_, values);
+	}
+
+	// access functions
+	unsigned int sensor_count() const { return sensor_count_; }
+	unsigned int adc_bits() const { return adc_bits_; }
+	unsigned int reading_bytes() const { return reading_bytes_; }
+
+	// Kernel of a supported format, nullptr otherwise.
+	static UnpackFunction Kernel(const unsigned int sensor_count, const unsigned int adc_bits)
+	{
+		if(sensor_count == 4 && adc_bits == 10)
+			return &PackedReading<4, 10>::UnpackAll;
+		if(sensor_count == 4 && adc_bits == 12)
+			return &PackedReading<4, 12>::UnpackAll;
+		if(sensor_count == 8 && adc_bits == 10)
+			return &PackedReading<8, 10>::UnpackAll;
+		if(sensor_count == 8 && adc_bits == 12)
+			return &PackedReading<8, 12>::UnpackAll;
+		return nullptr;
+	}
+
+private:
+	UnpackFunction unpack_;
+	unsigned int sensor_count_;
+	unsigned int adc_bits_;
+	unsigned int reading_bytes_;
+};
+
+
+#endif /* end of include guard: PROTOCOL_CODEC_H_Q8ZK3TVA */
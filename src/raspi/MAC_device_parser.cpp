@@ -20,41 +20,129 @@
 // TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include <cstdint>
 #include <fstream>
-#include <regex>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <iostream>
+#include <vector>
 
+#include "device_registry.h"
 #include "MAC_device_parser.h"
 
 
-int MACDeviceParser::ParseForDevices() 
+int MACDeviceParser::ReparseForDevices(std::vector<uint64_t> * changed_macs)
 {
+	std::lock_guard<std::mutex> lock(parse_mutex_);
+
+	std::ifstream file(filename_);
+	std::string content((std::istreambuf_iterator<char>(file)),
+			std::istreambuf_iterator<char>());
+	file.close();
+
+	// editors write the same content several times in a row
+	if(content == content_)
+		return device_count_;
+
 	int device_counter = 0;
+	std::shared_ptr<DeviceRegistry> registry = std::make_shared<DeviceRegistry>();
+	std::unordered_map<std::string, ParsedLine> parsed_lines;
 
-	// regular expression MAC identifier followed by device name separated by blanks
-	std::regex regex(
-			R"(([[:xdigit:]]{2}:[[:xdigit:]]{2}:[[:xdigit:]]{2}:[[:xdigit:]]{2}:[[:xdigit:]]{2}:[[:xdigit:]]{2})[[:blank:]]+([_/\w\\]+)[[:blank:]]+([/\w\\]+))");
-	std::smatch smatch;
-	std::string line;
+	// one pass over the file, line by line
+	const char * line_begin = content.data();
+	const char * const content_end = content.data() + content.size();
+	while(line_begin < content_end) {
+		const char * line_end = line_begin;
+		while(line_end < content_end && *line_end != '\n')
+			++line_end;
 
-	std::ifstream file(filename_);
+		std::string line(line_begin, line_end);
+		line_begin = line_end + 1;
 
-	while(std::getline(file, line)) {
-		if(std::regex_search(line, smatch, regex))
+		// unchanged lines are taken over from the last parse
+		ParsedLine parsed_line;
+		const auto repeated_line = parsed_lines.find(line);
+		const auto previous_line = parsed_lines_.find(line);
+		if(repeated_line != parsed_lines.end())
+			parsed_line = repeated_line->second;
+		else if(previous_line != parsed_lines_.end())
+			parsed_line = previous_line->second;
+		else
 		{
-			//std::cout << smatch[1] << " " << smatch[2] << " " << smatch[3] << std::endl;
-			devices_[smatch[1]] = std::move(smatch[2]);
-			file_paths_[smatch[1]] = std::move(smatch[3]);
+			parsed_line.is_device = ParseLine(line.data(), line.data() + line.size(),
+					&parsed_line.device);
+			if(parsed_line.is_device && changed_macs)
+				changed_macs->push_back(parsed_line.device.mac);
+		}
+
+		if(parsed_line.is_device)
+		{
+			device_table_.Intern(parsed_line.device.mac, parsed_line.device.device_id);
+			registry->Insert(parsed_line.device);
 			++device_counter;
 		}
+		parsed_lines.emplace(std::move(line), std::move(parsed_line));
 	}
 
-	file.close();
+	if(changed_macs)
+	{
+		for (const auto & previous_line : parsed_lines_) {
+			if(previous_line.second.is_device && !parsed_lines.count(previous_line.first))
+				changed_macs->push_back(previous_line.second.device.mac);
+		}
+	}
+
+	std::atomic_store(&registry_, std::shared_ptr<const DeviceRegistry>(std::move(registry)));
+	content_ = std::move(content);
+	parsed_lines_ = std::move(parsed_lines);
+	device_count_ = device_counter;
 
 	return device_counter;
 }
 
+bool MACDeviceParser::ParseLine(const char * begin, const char * end,
+		DeviceRegistry::Device * device)
+{
+	static const std::size_t MAC_ADDRESS_LENGTH = 17;
+
+	const auto is_blank = [](const char c) { return c == ' ' || c == '\t'; };
+	const auto is_word = [](const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+			c == '_' || c == '/' || c == '\\';
+	};
+
+	// the MAC address may be preceded by anything, e.g. a comment character
+	const char * mac_begin = begin;
+	while(static_cast<std::size_t>(end - mac_begin) >= MAC_ADDRESS_LENGTH &&
+			!ParseMACAddress(mac_begin, MAC_ADDRESS_LENGTH, &device->mac))
+		++mac_begin;
+	if(static_cast<std::size_t>(end - mac_begin) < MAC_ADDRESS_LENGTH)
+		return false;
 
+	const char * position = mac_begin + MAC_ADDRESS_LENGTH;
+	device->device_id.assign(mac_begin, position);
+
+	// label and path, each preceded by blanks
+	std::string * const fields[] = {&device->label, &device->file_path};
+	for (std::string * field : fields) {
+		const char * const field_separator = position;
+		while(position < end && is_blank(*position))
+			++position;
+		if(position == field_separator)
+			return false;
+
+		const char * const field_begin = position;
+		while(position < end && is_word(*position))
+			++position;
+		if(position == field_begin)
+			return false;
+		field->assign(field_begin, position);
+	}
+
+	return true;
+}
@@ -25,50 +25,100 @@
 #define MAC_DEVICE_PARSER_H_NA1TWB4Y
 
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+#include "device_registry.h"
+#include "device_table.h"
 
 // This class is used to parse a provided file to extract MAC addresses and associated device
-// name pairs, provided linewise in the form:
-// xx:xx:xx:xx:xx:xx	<dev_name>
+// name and rfcomm device path triples, provided linewise in the form:
+// xx:xx:xx:xx:xx:xx	<dev_name>	<dev_path>
 // The parsed MAC addresses can be later used to identify Bluetooth devices to which a
 // connection should be established to.
+// Every parse builds a new registry and swaps it in atomically, readers keep the snapshot
+// returned by registry() for as long as they use its devices and are never blocked.
+// Every parsed device is interned into device_table(), its handles outlive reparses.
 class MACDeviceParser
 {
 public:
-	MACDeviceParser () {}
+	MACDeviceParser () :
+		registry_(std::make_shared<const DeviceRegistry>()),
+		device_count_(0) {}
 
 	// Construction with filename of file that will be parsed.
 	MACDeviceParser (const std::string & filename) :
-		filename_(filename) {}
+		filename_(filename),
+		registry_(std::make_shared<const DeviceRegistry>()),
+		device_count_(0) {}
 	~MACDeviceParser (){}
 	
-	// Performs parsing of file filename_ for MAC addresses and associated device name pairs and
-	// returns the total number matched pairs. Each found MAC address is saved as key in
-	// map devices_ with its associated device name as value.
-	int ParseForDevices();
+	// Performs parsing of file filename_ for MAC addresses and associated device name and path
+	// triples and returns the total number matched lines. The found devices replace the
+	// current registry, keyed by their MAC address. May run while other threads read.
+	int ParseForDevices() { return ReparseForDevices(nullptr); }
+
+	// Like ParseForDevices, but only lines that are new since the last parse are parsed, the
+	// others keep their devices. The registry stays the same snapshot if the file did not
+	// change. MACs of devices on lines that were added or removed are appended to
+	// changed_macs if it is not nullptr.
+	int ReparseForDevices(std::vector<uint64_t> * changed_macs);
+
+	// Parses a single line, returns false if it does not describe a device.
+	static bool ParseLine(const char * begin, const char * end, DeviceRegistry::Device * device);
 
 	// access functions
 	const std::string & filename() const { return filename_; }
-	const std::unordered_map<std::string, std::string> & devices() const { return devices_; }
-
-	const std::unordered_map<std::string, std::string> & file_paths() const { return file_paths_; }
+	// Current snapshot of the known devices.
+	std::shared_ptr<const DeviceRegistry> registry() const { return std::atomic_load(&registry_); }
+	// Handles of all devices seen so far, interning does not change the parsed devices.
+	DeviceTable & device_table() const { return device_table_; }
+	// Handle of a device of the registry.
+	DeviceHandle handle(const DeviceRegistry::Device & device) const
+	{
+		return device_table_.Intern(device.mac, device.device_id);
+	}
 
 	// mutators
 	void set_filename(const std::string & filename) { filename_ = filename; }
 
-	// erase all entries of devices_ map
-	void clear_devices() { devices_.clear(); }
+	// erase all entries of the registry
+	void clear_devices()
+	{
+		std::lock_guard<std::mutex> lock(parse_mutex_);
+		content_.clear();
+		parsed_lines_.clear();
+		device_count_ = 0;
+		std::atomic_store(&registry_, std::make_shared<const DeviceRegistry>());
+	}
 
 
 private:
 	// filename of file that will be parsed
 	std::string filename_;
 
-	// Maps the parsed devices to the associated device names.
-	std::unordered_map<std::string, std::string> devices_;
-	std::unordered_map<std::string, std::string> file_paths_;
+	// Maps the parsed MAC addresses to the associated device names and paths, only accessed
+	// through std::atomic_load and std::atomic_store.
+	std::shared_ptr<const DeviceRegistry> registry_;
+
+	mutable DeviceTable device_table_;
+
+	// A line of the file as parsed last time.
+	struct ParsedLine
+	{
+		bool is_device;
+		DeviceRegistry::Device device;
+	};
 
+	// state of the last parse, parses run one at a time
+	std::mutex parse_mutex_;
+	std::string content_;
+	std::unordered_map<std::string, ParsedLine> parsed_lines_;
+	int device_count_;
 };
 
 
@@ -0,0 +1,211 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "anomaly_detector.h"
+#include "database_manager.h"
+#include "device_table.h"
+#include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+
+constexpr double AnomalyDetector::smoothing_factor;
+
+void AnomalyDetector::AddReading(const DeviceHandle device,
+		const std::chrono::system_clock::time_point time_point,
+		const uint16_t * raw_values,
+		const unsigned int sensor_count,
+		const unsigned int adc_bits,
+		std::vector<Alert> * alerts)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto known_device = devices_.find(device);
+	DeviceState & device_state = known_device != devices_.end() ? known_device->second :
+		devices_.emplace(device, DeviceState()).first->second;
+
+	// the rate of change needs a previous reading of this node
+	const double elapsed_minutes = known_device != devices_.end() ?
+		std::chrono::duration<double>(time_point - device_state.last_reading).count() / 60.0 :
+		0.0;
+	device_state.last_reading = time_point;
+
+	for (unsigned int sensor = 0; sensor < sensor_count && sensor < MAX_SENSOR_COUNT; ++sensor)
+		AddSensorValue(device, sensor, time_point, elapsed_minutes, raw_values[sensor],
+				adc_bits, &device_state.sensors[sensor], alerts);
+}
+
+void AnomalyDetector::AddSensorValue(const DeviceHandle device, const int sensor,
+		const std::chrono::system_clock::time_point time_point,
+		const double elapsed_minutes, const uint16_t raw_value,
+		const unsigned int adc_bits, SensorState * state, std::vector<Alert> * alerts)
+{
+	const auto raise = [device, sensor, time_point, alerts](const AlertType type,
+			const double value)
+	{
+		alerts->push_back(Alert{device, sensor, type, value, time_point});
+	};
+
+	// identical raw values in a row, an LM35 in a living hive never holds that still
+	state->repeats = state->number_of_readings && raw_value == state->last_raw ?
+		state->repeats + 1 : 1;
+	state->last_raw = raw_value;
+	const bool stuck = state->repeats >= limits_.stuck_readings;
+	if(stuck && !state->stuck)
+		raise(ALERT_STUCK, raw_value);
+	state->stuck = stuck;
+
+	// a saturated value is no temperature, it must not move the statistics
+	const bool saturated = raw_value == 0 || raw_value >= (1u << adc_bits) - 1;
+	if(saturated && !state->saturated)
+		raise(ALERT_SATURATED, raw_value);
+	state->saturated = saturated;
+	if(saturated)
+		return;
+
+	const double celsius = DatabaseManager::RawToCelsius(raw_value, adc_bits);
+	if(!state->number_of_readings)
+	{
+		state->mean_celsius = celsius;
+		state->variance = 0.0;
+		state->last_celsius = celsius;
+		state->number_of_readings = 1;
+		// only crossings are reported, not where a sensor happens to start
+		state->low = celsius < limits_.low_celsius;
+		state->high = celsius > limits_.high_celsius;
+		return;
+	}
+
+	// Welford style update of the exponentially weighted mean and variance
+	const double deviation = celsius - state->mean_celsius;
+	const double spread = std::sqrt(state->variance);
+	state->mean_celsius += smoothing_factor * deviation;
+	state->variance = (1.0 - smoothing_factor) *
+		(state->variance + smoothing_factor * deviation * deviation);
+
+	if(elapsed_minutes > 0.0)
+	{
+		const double celsius_per_minute = (celsius - state->last_celsius) / elapsed_minutes;
+		const bool rapid = state->number_of_readings >= minimum_readings &&
+			std::fabs(celsius_per_minute) > limits_.max_celsius_per_minute &&
+			std::fabs(deviation) > limits_.spread_sigmas * spread;
+		if(rapid && !state->rapid)
+			raise(ALERT_RAPID_CHANGE, celsius_per_minute);
+		state->rapid = rapid;
+	}
+	state->last_celsius = celsius;
+	++state->number_of_readings;
+
+	if(!state->low && state->mean_celsius < limits_.low_celsius)
+	{
+		state->low = true;
+		raise(ALERT_LOW_TEMPERATURE, state->mean_celsius);
+	}
+	else if(state->low &&
+			state->mean_celsius >= limits_.low_celsius + limits_.hysteresis_celsius)
+		state->low = false;
+
+	if(!state->high && state->mean_celsius > limits_.high_celsius)
+	{
+		state->high = true;
+		raise(ALERT_HIGH_TEMPERATURE, state->mean_celsius);
+	}
+	else if(state->high &&
+			state->mean_celsius <= limits_.high_celsius - limits_.hysteresis_celsius)
+		state->high = false;
+}
+
+void AnomalyDetector::DumpReceived(const DeviceHandle device,
+		const std::chrono::system_clock::time_point last_reading,
+		const uint32_t interval_length_seconds)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	DeviceState & device_state = devices_[device];
+	// a dump followed by DATA in the same session must not move the deadline back
+	if(last_reading > device_state.last_dump_reading)
+	{
+		device_state.last_dump_reading = last_reading;
+		device_state.dump_interval_seconds = interval_length_seconds;
+	}
+	// the node wakes with its last reading, a wake planned up to one interval after it is
+	// the one this dump fulfilled. The plan of the next dump may already be known.
+	if(device_state.planned_wake <= device_state.last_dump_reading +
+			std::chrono::seconds(device_state.dump_interval_seconds))
+		device_state.planned_wake = std::chrono::system_clock::time_point();
+	UpdateNextDumpDue(&device_state);
+	device_state.dump_missing = false;
+}
+
+void AnomalyDetector::WakePlanned(const DeviceHandle device,
+		const std::chrono::system_clock::time_point expected_wake)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	DeviceState & device_state = devices_[device];
+	device_state.planned_wake = expected_wake;
+	UpdateNextDumpDue(&device_state);
+}
+
+void AnomalyDetector::UpdateNextDumpDue(DeviceState * state) const
+{
+	const auto grace = std::chrono::seconds(limits_.missing_dump_grace_seconds);
+	if(state->planned_wake != std::chrono::system_clock::time_point())
+		state->next_dump_due = state->planned_wake + grace;
+	else if(state->last_dump_reading != std::chrono::system_clock::time_point())
+		state->next_dump_due = state->last_dump_reading + grace +
+			std::chrono::seconds(uint64_t(MAX_NUMBER_OF_READINGS) * state->dump_interval_seconds);
+}
+
+void AnomalyDetector::CheckMissingDumps(const std::chrono::system_clock::time_point now,
+		std::vector<Alert> * alerts)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto & device : devices_) {
+		DeviceState & device_state = device.second;
+		if(device_state.dump_missing ||
+				device_state.next_dump_due == std::chrono::system_clock::time_point() ||
+				now < device_state.next_dump_due)
+			continue;
+
+		device_state.dump_missing = true;
+		const auto last_seen = device_state.last_reading != std::chrono::system_clock::time_point() ?
+			device_state.last_reading : device_state.planned_wake;
+		alerts->push_back(Alert{device.first, -1, ALERT_MISSING_DUMP,
+				std::chrono::duration<double>(now - last_seen).count(), now});
+	}
+}
+
+const char * AnomalyDetector::TypeName(const AlertType type)
+{
+	switch (type) {
+		case ALERT_LOW_TEMPERATURE: return "low_temperature";
+		case ALERT_HIGH_TEMPERATURE: return "high_temperature";
+		case ALERT_RAPID_CHANGE: return "rapid_change";
+		case ALERT_SATURATED: return "saturated";
+		case ALERT_STUCK: return "stuck";
+		case ALERT_MISSING_DUMP: return "missing_dump";
+		default: return "unknown";
+	}
+}
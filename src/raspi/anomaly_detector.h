@@ -0,0 +1,184 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef ANOMALY_DETECTOR_H_K3VD8QWN
+#define ANOMALY_DETECTOR_H_K3VD8QWN
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "device_table.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+// Watches the readings of every sensor while dumps are decoded and raises alerts right away,
+// instead of leaving them to someone reading the exported temperatures.
+// Every sensor keeps an exponentially weighted mean and variance of its temperature and its
+// last value, so each reading costs the same constant work. Alerts are raised when a
+// condition starts, not while it lasts:
+// - the smoothed temperature crosses below low_celsius or above high_celsius, a sensor that
+//   starts outside these limits (e.g. outside the winter cluster) is not reported until it
+//   crossed back once; limits are left again only hysteresis_celsius inside them
+// - the temperature changes faster than max_celsius_per_minute and further than
+//   spread_sigmas standard deviations from its mean
+// - the ADC reads 0 or its maximum, the sensor is disconnected or shorted
+// - the ADC returns the same value for stuck_readings readings in a row
+// - a node did not deliver its next dump missing_dump_grace_seconds after the wake the
+//   scheduler planned for it, or after its buffer should have been full without a plan
+class AnomalyDetector
+{
+public:
+	enum AlertType {
+		ALERT_LOW_TEMPERATURE = 0,
+		ALERT_HIGH_TEMPERATURE,
+		ALERT_RAPID_CHANGE,
+		ALERT_SATURATED,
+		ALERT_STUCK,
+		ALERT_MISSING_DUMP,
+		NUMBER_OF_ALERT_TYPES
+	};
+
+	struct Alert
+	{
+		DeviceHandle device;
+		// index of the sensor, -1 for alerts about the whole node
+		int sensor;
+		AlertType type;
+		// smoothed temperature, change in degrees per minute, raw ADC value or seconds
+		// since the last reading of the node (its planned wake if none arrived yet),
+		// depending on type
+		double value;
+		// time of the reading, detection time for missing dumps
+		std::chrono::system_clock::time_point time;
+	};
+
+	struct Limits
+	{
+		double low_celsius;
+		double high_celsius;
+		double hysteresis_celsius;
+		double max_celsius_per_minute;
+		double spread_sigmas;
+		unsigned int stuck_readings;
+		uint32_t missing_dump_grace_seconds;
+	};
+
+	// Brood nest limits, honey bees keep their brood between 32 and 36 degrees.
+	static Limits DefaultLimits()
+	{
+		return Limits{30.0, 38.0, 0.5, 0.5, 4.0, 48, 2 * 3600};
+	}
+
+	explicit AnomalyDetector (const Limits & limits = DefaultLimits()) :
+		limits_(limits)
+	{}
+	~AnomalyDetector () {}
+
+	// Feeds one reading of device taken at time_point with the raw values of all its sensors.
+	// Readings of a device have to arrive in time order. Raised alerts are appended to alerts.
+	void AddReading(const DeviceHandle device,
+			const std::chrono::system_clock::time_point time_point,
+			const uint16_t * raw_values,
+			const unsigned int sensor_count,
+			const unsigned int adc_bits,
+			std::vector<Alert> * alerts);
+
+	// The dump of device ending with the reading at last_reading was decoded. The next one
+	// is due at the wake planned after it, without a plan once the node filled its buffer
+	// again at interval_length_seconds.
+	void DumpReceived(const DeviceHandle device,
+			const std::chrono::system_clock::time_point last_reading,
+			const uint32_t interval_length_seconds);
+
+	// The scheduler expects device to wake with a full buffer at expected_wake. May be called
+	// before or after the dump of the same session was decoded, and before any dump.
+	void WakePlanned(const DeviceHandle device,
+			const std::chrono::system_clock::time_point expected_wake);
+
+	// Appends an alert for every device whose next dump is overdue at now, once per gap.
+	void CheckMissingDumps(const std::chrono::system_clock::time_point now,
+			std::vector<Alert> * alerts);
+
+	// Name of type as stored in the type tag of alerts.
+	static const char * TypeName(const AlertType type);
+
+	// access functions
+	const Limits & limits() const { return limits_; }
+
+private:
+	struct SensorState
+	{
+		double mean_celsius;
+		double variance;
+		double last_celsius;
+		uint16_t last_raw;
+		// readings in a row with last_raw
+		unsigned int repeats;
+		unsigned int number_of_readings;
+		// conditions that are currently raised
+		bool low;
+		bool high;
+		bool rapid;
+		bool saturated;
+		bool stuck;
+	};
+
+	struct DeviceState
+	{
+		SensorState sensors[MAX_SENSOR_COUNT];
+		std::chrono::system_clock::time_point last_reading;
+		// last reading of the newest dump, zero until the first dump was decoded
+		std::chrono::system_clock::time_point last_dump_reading;
+		// zero until the first dump was decoded or a wake was planned
+		std::chrono::system_clock::time_point next_dump_due;
+		// wake of the next dump planned by the scheduler, zero if there is none
+		std::chrono::system_clock::time_point planned_wake;
+		// interval of the newest dump
+		uint32_t dump_interval_seconds;
+		bool dump_missing;
+	};
+
+	// Moves the deadline of the next dump of state to its planned wake, without a plan to a
+	// full buffer at the interval of its last dump.
+	void UpdateNextDumpDue(DeviceState * state) const;
+
+	void AddSensorValue(const DeviceHandle device, const int sensor,
+			const std::chrono::system_clock::time_point time_point,
+			const double elapsed_minutes, const uint16_t raw_value,
+			const unsigned int adc_bits, SensorState * state, std::vector<Alert> * alerts);
+
+	// weight of a new temperature in the smoothed mean and variance
+	static constexpr double smoothing_factor = 0.2;
+	// readings before the variance is trusted for rapid changes
+	static const unsigned int minimum_readings = 8;
+
+	const Limits limits_;
+	std::mutex mutex_;
+	std::unordered_map<DeviceHandle, DeviceState> devices_;
+};
+
+
+#endif /* end of include guard: ANOMALY_DETECTOR_H_K3VD8QWN */
@@ -0,0 +1,387 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QString>
+#include <QVariant>
+
+#include "backfill.h"
+#include "database_manager.h"
+#include "device_registry.h"
+#include "dump_archive.h"
+#include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+
+static const int first_retry_delay_ms = 500;
+static const int max_retry_delay_ms = 60000;
+static const int progress_interval_ms = 2000;
+
+// Device id of a MAC that is not in the device mapping anymore.
+static QString MACToDeviceId(const uint64_t mac)
+{
+	char device_id[18];
+	std::snprintf(device_id, sizeof(device_id), "%02X:%02X:%02X:%02X:%02X:%02X",
+			unsigned((mac >> 40) & 0xFF), unsigned((mac >> 32) & 0xFF),
+			unsigned((mac >> 24) & 0xFF), unsigned((mac >> 16) & 0xFF),
+			unsigned((mac >> 8) & 0xFF), unsigned(mac & 0xFF));
+	return QString(device_id);
+}
+
+
+Backfill::Backfill(const DumpArchiveReader & archive, const DeviceRegistry & registry,
+		const Options & options) :
+	archive_(archive),
+	registry_(registry),
+	options_(options),
+	write_prefix_(DatabaseManager::TemperatureWritePrefix(
+				QString::fromStdString(options.database_name), QJsonObject())),
+	next_batch_to_encode_(0),
+	written_prefix_(0),
+	stopping_(false),
+	next_batch_to_send_(0),
+	retry_delay_ms_(first_retry_delay_ms),
+	points_written_(0)
+{
+	send_timer_.setSingleShot(true);
+	connect(&send_timer_, SIGNAL(timeout()), this, SLOT(SendBatches()));
+}
+
+Backfill::~Backfill()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	window_changed_.notify_all();
+	for (auto & worker : workers_)
+		worker.join();
+}
+
+bool Backfill::Start()
+{
+	const int64_t checkpoint = ReadCheckpoint(options_.checkpoint_path);
+	const int64_t from_unix_ms = std::max(options_.from_unix_ms, checkpoint + 1);
+
+	for (const auto & record : archive_.records()) {
+		if(record.receive_unix_ms >= from_unix_ms && record.receive_unix_ms < options_.to_unix_ms)
+			records_.push_back(record);
+	}
+	std::stable_sort(records_.begin(), records_.end(),
+			[](const DumpArchiveReader::Record & a, const DumpArchiveReader::Record & b)
+			{
+				return a.receive_unix_ms < b.receive_unix_ms;
+			});
+	if(records_.empty())
+		return false;
+
+	if(checkpoint)
+		std::cout << "continuing after checkpoint " << checkpoint << std::endl;
+
+	Batch batch = {0, 0, 0};
+	for (std::size_t i = 0; i < records_.size(); ++i) {
+		const DumpArchiveReader::Record & record = records_[i];
+		if(batch.points >= options_.points_per_batch &&
+				record.receive_unix_ms != records_[i - 1].receive_unix_ms)
+		{
+			batch.end_record = i;
+			batches_.push_back(batch);
+			batch = Batch{i, i, 0};
+		}
+		batch.points += record.header.sensor_count * record.header.number_of_readings;
+
+		if(!point_prefixes_.count(record.device_mac))
+		{
+			QJsonObject device_tags;
+			const DeviceRegistry::Device * const device = registry_.Find(record.device_mac);
+			device_tags.insert(DatabaseManager::device_id_key, device ?
+					QString::fromStdString(device->device_id) : MACToDeviceId(record.device_mac));
+			if(device)
+				device_tags.insert(DatabaseManager::device_tag_key,
+						QString::fromStdString(device->label));
+
+			std::array<QByteArray, MAX_SENSOR_COUNT> & point_prefixes =
+				point_prefixes_[record.device_mac];
+			for (unsigned int sensor = 0; sensor < MAX_SENSOR_COUNT; ++sensor) {
+				QJsonObject sensor_tags = device_tags;
+				sensor_tags.insert(DatabaseManager::sensor_key,
+						DatabaseManager::SensorIdValue(sensor));
+				point_prefixes[sensor] = DatabaseManager::TemperaturePointPrefix(sensor_tags);
+			}
+		}
+	}
+	batch.end_record = records_.size();
+	batches_.push_back(batch);
+
+	encoded_batches_.resize(batches_.size());
+	batch_written_.assign(batches_.size(), false);
+
+	const unsigned int worker_threads = std::max(1u, options_.worker_threads);
+	std::cout << "backfilling " << records_.size() << " dumps in " << batches_.size() <<
+		" batches with " << worker_threads << " workers" << std::endl;
+
+	start_time_ = std::chrono::steady_clock::now();
+	last_progress_time_ = start_time_;
+	next_send_time_ = start_time_;
+	retry_time_ = start_time_;
+	for (unsigned int i = 0; i < worker_threads; ++i)
+		workers_.push_back(std::thread(&Backfill::EncodeBatches, this));
+	return true;
+}
+
+void Backfill::EncodeBatches()
+{
+	// encoded batches wait for their write, keep only a few of them around
+	const std::size_t window = 2 * std::max(1u, options_.worker_threads) + options_.max_in_flight;
+
+	while(true)
+	{
+		std::size_t index;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			window_changed_.wait(lock, [this, window]()
+					{
+						return stopping_ || next_batch_to_encode_ >= batches_.size() ||
+							next_batch_to_encode_ < written_prefix_ + window;
+					});
+			if(stopping_ || next_batch_to_encode_ >= batches_.size())
+				return;
+			index = next_batch_to_encode_++;
+		}
+
+		QByteArray encoded_batch = EncodeBatch(batches_[index]);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			encoded_batches_[index].swap(encoded_batch);
+		}
+		QMetaObject::invokeMethod(this, "SendBatches", Qt::QueuedConnection);
+	}
+}
+
+QByteArray Backfill::EncodeBatch(const Batch & batch) const
+{
+	QByteArray write(write_prefix_);
+	write.reserve(write_prefix_.size() + 2 + batch.points * 160);
+	for (std::size_t i = batch.first_record; i < batch.end_record; ++i) {
+		const DumpArchiveReader::Record & record = records_[i];
+		const ReadingDecoder decoder(record.header);
+		if(!decoder.valid())
+			continue;
+		// only shared, the prefixes are never modified once the workers run
+		const std::array<QByteArray, MAX_SENSOR_COUNT> & point_prefixes =
+			point_prefixes_.find(record.device_mac)->second;
+
+		std::chrono::system_clock::time_point start_time;
+		DatabaseManager::TimeConvertToHostTime(record.header.start_time, &start_time);
+
+		uint16_t raw_values[MAX_SENSOR_COUNT];
+		for (unsigned int reading = 0; reading < record.header.number_of_readings; ++reading) {
+			decoder.Unpack(record.readings, reading, raw_values);
+			const qint64 unix_seconds = DatabaseManager::SampleUnixSeconds(start_time,
+					record.header.interval_length_seconds, reading,
+					record.clock_offset_seconds, record.clock_drift);
+
+			for (unsigned int sensor = 0; sensor < decoder.sensor_count(); ++sensor)
+				DatabaseManager::AppendTemperaturePoint(&write, point_prefixes[sensor],
+						unix_seconds,
+						DatabaseManager::RawToCelsius(raw_values[sensor], decoder.adc_bits()));
+		}
+	}
+	DatabaseManager::EndTemperatureWrite(&write);
+	return write;
+}
+
+void Backfill::SendBatches()
+{
+	while(static_cast<int>(writes_in_flight_.size()) < options_.max_in_flight)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const bool retry = !retry_queue_.empty();
+		if(retry && now < retry_time_)
+		{
+			// the database failed recently, nothing is sent until the retry is due
+			send_timer_.start(std::chrono::duration_cast<std::chrono::milliseconds>(
+						retry_time_ - now).count() + 1);
+			return;
+		}
+		if(!retry && next_batch_to_send_ >= batches_.size())
+			return;
+
+		const std::size_t index = retry ? retry_queue_.front() : next_batch_to_send_;
+		QByteArray body;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			body = encoded_batches_[index];
+		}
+		// a worker queues another call once the batch is encoded
+		if(body.isEmpty())
+			return;
+
+		if(options_.points_per_second > 0)
+		{
+			if(now < next_send_time_)
+			{
+				send_timer_.start(std::chrono::duration_cast<std::chrono::milliseconds>(
+							next_send_time_ - now).count() + 1);
+				return;
+			}
+			next_send_time_ = std::max(now, next_send_time_) +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+						std::chrono::duration<double>(
+							batches_[index].points / options_.points_per_second));
+		}
+
+		if(retry)
+			retry_queue_.pop_front();
+		else
+			++next_batch_to_send_;
+
+		QNetworkRequest request(options_.write_url);
+		request.setHeader(QNetworkRequest::ContentTypeHeader, QVariant("application/json"));
+		QNetworkReply * const reply = nam_.post(request, body);
+		writes_in_flight_[reply] = index;
+		connect(reply, SIGNAL(finished()), this, SLOT(WriteFinished()));
+	}
+}
+
+void Backfill::WriteFinished()
+{
+	QNetworkReply * const reply = qobject_cast<QNetworkReply *>(sender());
+	const auto write = writes_in_flight_.find(reply);
+	if(!reply || write == writes_in_flight_.end())
+		return;
+
+	const std::size_t index = write->second;
+	writes_in_flight_.erase(write);
+	reply->deleteLater();
+
+	const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	if(reply->error() != QNetworkReply::NoError || status / 100 != 2)
+	{
+		std::cout << "write of batch " << index << " failed (" <<
+			reply->errorString().toStdString() << "), retry in " << retry_delay_ms_ <<
+			"ms" << std::endl;
+		retry_queue_.push_back(index);
+		retry_time_ = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(retry_delay_ms_);
+		retry_delay_ms_ = std::min(2 * retry_delay_ms_, max_retry_delay_ms);
+	}
+	else
+	{
+		retry_delay_ms_ = first_retry_delay_ms;
+		BatchWritten(index);
+		if(written_prefix_ == batches_.size())
+		{
+			PrintProgress();
+			emit Finished();
+			return;
+		}
+	}
+
+	SendBatches();
+}
+
+void Backfill::BatchWritten(const std::size_t index)
+{
+	batch_written_[index] = true;
+	points_written_ += batches_[index].points;
+
+	std::size_t written_prefix = written_prefix_;
+	while(written_prefix < batches_.size() && batch_written_[written_prefix])
+		++written_prefix;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		QByteArray().swap(encoded_batches_[index]);
+		if(written_prefix == written_prefix_)
+			return;
+		written_prefix_ = written_prefix;
+	}
+	window_changed_.notify_all();
+
+	WriteCheckpoint(records_[batches_[written_prefix - 1].end_record - 1].receive_unix_ms);
+
+	const auto now = std::chrono::steady_clock::now();
+	if(now - last_progress_time_ >= std::chrono::milliseconds(progress_interval_ms))
+	{
+		last_progress_time_ = now;
+		PrintProgress();
+	}
+}
+
+int64_t Backfill::ReadCheckpoint(const std::string & checkpoint_path)
+{
+	int64_t receive_unix_ms = 0;
+	if(checkpoint_path.empty())
+		return receive_unix_ms;
+
+	std::ifstream checkpoint_file(checkpoint_path);
+	if(!(checkpoint_file >> receive_unix_ms))
+		return 0;
+	return receive_unix_ms;
+}
+
+void Backfill::WriteCheckpoint(const int64_t receive_unix_ms) const
+{
+	if(options_.checkpoint_path.empty())
+		return;
+
+	// replaced in one step, a crash leaves either the old or the new checkpoint
+	const std::string temporary_path = options_.checkpoint_path + ".tmp";
+	{
+		std::ofstream checkpoint_file(temporary_path, std::ios::trunc);
+		checkpoint_file << receive_unix_ms << std::endl;
+		if(!checkpoint_file)
+		{
+			std::cout << "could not write checkpoint " << temporary_path << std::endl;
+			return;
+		}
+	}
+	std::rename(temporary_path.c_str(), options_.checkpoint_path.c_str());
+}
+
+void Backfill::PrintProgress() const
+{
+	const double elapsed_s = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start_time_).count();
+	const std::size_t written_dumps = written_prefix_ ?
+		batches_[written_prefix_ - 1].end_record : 0;
+	std::cout << "written " << written_dumps << "/" << records_.size() << " dumps, " <<
+		points_written_ << " points, " <<
+		std::lround(elapsed_s > 0 ? points_written_ / elapsed_s : 0.0) << " points/s" <<
+		std::endl;
+}
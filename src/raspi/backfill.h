@@ -0,0 +1,154 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef BACKFILL_H_M2JX7CUD
+#define BACKFILL_H_M2JX7CUD
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QObject>
+#include <QTimer>
+#include <QUrl>
+
+#include "device_registry.h"
+#include "dump_archive.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+// Re-ingests the dumps of a dump archive into the temperature series of the database.
+// Dumps are replayed in the order they were received. They are cut into batches of about
+// points_per_batch points which a pool of worker threads decodes and encodes as JSON, while
+// the thread of the backfill keeps up to max_in_flight writes outstanding. Workers run at
+// most a few batches ahead of the writes, a failed write is retried with growing delay.
+// After every write the checkpoint file is updated with the receive time up to which all
+// dumps are written, a backfill that is started again continues after it.
+class Backfill : public QObject
+{
+	Q_OBJECT
+public:
+	struct Options
+	{
+		QUrl write_url;
+		std::string database_name;
+		std::size_t points_per_batch;
+		// 0 writes as fast as the database accepts
+		double points_per_second;
+		unsigned int worker_threads;
+		int max_in_flight;
+		// empty if progress is not kept
+		std::string checkpoint_path;
+		// only dumps received within [from_unix_ms, to_unix_ms) are written
+		int64_t from_unix_ms;
+		int64_t to_unix_ms;
+	};
+
+	Backfill (const DumpArchiveReader & archive, const DeviceRegistry & registry,
+			const Options & options);
+	~Backfill ();
+
+	// Plans the batches and starts the workers. Returns false if there is nothing to write,
+	// otherwise Finished is emitted once every batch was written.
+	bool Start();
+
+	// Receive time of the last dump written by an earlier run, 0 if there is none.
+	static int64_t ReadCheckpoint(const std::string & checkpoint_path);
+
+	// access functions
+	uint64_t points_written() const { return points_written_; }
+
+signals:
+	void Finished();
+
+private slots:
+	void SendBatches();
+	void WriteFinished();
+
+private:
+	// Consecutive dumps written with one request, a batch never splits dumps received
+	// within the same millisecond so the checkpoint stays exact.
+	struct Batch
+	{
+		std::size_t first_record;
+		std::size_t end_record;
+		std::size_t points;
+	};
+
+	// Worker thread, encodes batches until all are done or the backfill is destroyed.
+	void EncodeBatches();
+	QByteArray EncodeBatch(const Batch & batch) const;
+	// Called in the thread of the backfill after batch index was written.
+	void BatchWritten(const std::size_t index);
+	void WriteCheckpoint(const int64_t receive_unix_ms) const;
+	void PrintProgress() const;
+
+	const DumpArchiveReader & archive_;
+	const DeviceRegistry & registry_;
+	const Options options_;
+
+	// dumps to write sorted by receive time
+	std::vector<DumpArchiveReader::Record> records_;
+	std::vector<Batch> batches_;
+	// a write of the batches up to its first point, the points carry the device tags
+	const QByteArray write_prefix_;
+	// points of the sensors of every MAC to write rendered up to their time, tagged with
+	// device_id, device_tag and sensor_id
+	std::unordered_map<uint64_t, std::array<QByteArray, MAX_SENSOR_COUNT>> point_prefixes_;
+
+	// shared with the workers
+	std::mutex mutex_;
+	std::condition_variable window_changed_;
+	std::vector<QByteArray> encoded_batches_;
+	std::size_t next_batch_to_encode_;
+	std::size_t written_prefix_;
+	bool stopping_;
+	std::vector<std::thread> workers_;
+
+	// only used in the thread of the backfill
+	QNetworkAccessManager nam_;
+	QTimer send_timer_;
+	std::unordered_map<QNetworkReply *, std::size_t> writes_in_flight_;
+	std::vector<bool> batch_written_;
+	std::deque<std::size_t> retry_queue_;
+	std::size_t next_batch_to_send_;
+	std::chrono::steady_clock::time_point next_send_time_;
+	std::chrono::steady_clock::time_point retry_time_;
+	int retry_delay_ms_;
+	uint64_t points_written_;
+	std::chrono::steady_clock::time_point start_time_;
+	std::chrono::steady_clock::time_point last_progress_time_;
+};
+
+
+#endif /* end of include guard: BACKFILL_H_M2JX7CUD */
@@ -0,0 +1,149 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Re-ingests the dump archive of the reader into InfluxDB, e.g. after an outage of the
+// database or after the conversion of the readings changed. Dumps are written as fast as the
+// database accepts them unless a rate is given.
+//
+// Example usage:
+// 	beehive_backfill --archive dump_archive --checkpoint backfill.checkpoint --rate 50000
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QUrl>
+
+#include "backfill.h"
+#include "dump_archive.h"
+#include "MAC_device_parser.h"
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser options;
+	options.setApplicationDescription("Writes the dumps of a dump archive to the database.");
+	options.addHelpOption();
+	const QCommandLineOption archive_option("archive", "Dump archive directory.", "directory");
+	const QCommandLineOption mapping_option("mapping", "Device mapping used for the tags.",
+			"file", "devices_mapping.txt");
+	const QCommandLineOption host_option("host", "Database host.", "host", "localhost");
+	const QCommandLineOption port_option("port", "Database port.", "port", "8086");
+	const QCommandLineOption database_option("database", "Database name.", "name", "mydb");
+	const QCommandLineOption batch_option("batch", "Points per write request.", "n", "5000");
+	const QCommandLineOption rate_option("rate", "Maximum points per second, 0 is unlimited.",
+			"n", "0");
+	const QCommandLineOption threads_option("threads", "Worker threads encoding the batches.",
+			"n", QString::number(QThread::idealThreadCount()));
+	const QCommandLineOption in_flight_option("in-flight", "Write requests sent concurrently.",
+			"n", "4");
+	const QCommandLineOption checkpoint_option("checkpoint",
+			"Keep the progress in this file and continue after it.", "file");
+	const QCommandLineOption from_option("from",
+			"Only dumps received at or after this unix time.", "seconds");
+	const QCommandLineOption to_option("to", "Only dumps received before this unix time.",
+			"seconds");
+	options.addOption(archive_option);
+	options.addOption(mapping_option);
+	options.addOption(host_option);
+	options.addOption(port_option);
+	options.addOption(database_option);
+	options.addOption(batch_option);
+	options.addOption(rate_option);
+	options.addOption(threads_option);
+	options.addOption(in_flight_option);
+	options.addOption(checkpoint_option);
+	options.addOption(from_option);
+	options.addOption(to_option);
+	options.process(app);
+
+	if(!options.isSet(archive_option))
+	{
+		std::cout << "no dump archive given - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bool valid_options = true;
+	bool valid_value = false;
+	Backfill::Options backfill_options;
+	backfill_options.write_url.setScheme("http");
+	backfill_options.write_url.setHost(options.value(host_option));
+	backfill_options.write_url.setPort(options.value(port_option).toUShort(&valid_value));
+	backfill_options.write_url.setPath("/write");
+	valid_options = valid_options && valid_value;
+	backfill_options.database_name = options.value(database_option).toStdString();
+	backfill_options.points_per_batch = options.value(batch_option).toUInt(&valid_value);
+	valid_options = valid_options && valid_value && backfill_options.points_per_batch;
+	backfill_options.points_per_second = options.value(rate_option).toDouble(&valid_value);
+	valid_options = valid_options && valid_value && backfill_options.points_per_second >= 0;
+	backfill_options.worker_threads = options.value(threads_option).toUInt(&valid_value);
+	valid_options = valid_options && valid_value;
+	backfill_options.max_in_flight = options.value(in_flight_option).toInt(&valid_value);
+	valid_options = valid_options && valid_value && backfill_options.max_in_flight > 0;
+	backfill_options.checkpoint_path = options.value(checkpoint_option).toStdString();
+	backfill_options.from_unix_ms = 0;
+	backfill_options.to_unix_ms = std::numeric_limits<int64_t>::max();
+	if(options.isSet(from_option))
+	{
+		backfill_options.from_unix_ms = options.value(from_option).toLongLong(&valid_value) * 1000;
+		valid_options = valid_options && valid_value;
+	}
+	if(options.isSet(to_option))
+	{
+		backfill_options.to_unix_ms = options.value(to_option).toLongLong(&valid_value) * 1000;
+		valid_options = valid_options && valid_value;
+	}
+	if(!valid_options)
+	{
+		std::cout << "invalid options - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	DumpArchiveReader archive;
+	if(!archive.Open(options.value(archive_option).toStdString()))
+		return EXIT_FAILURE;
+
+	MACDeviceParser parser(options.value(mapping_option).toStdString());
+	parser.ParseForDevices();
+	const auto registry = parser.registry();
+
+	Backfill backfill(archive, *registry, backfill_options);
+	if(!backfill.Start())
+	{
+		std::cout << "no dumps to write - quit" << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	QObject::connect(&backfill, SIGNAL(Finished()), &app, SLOT(quit()));
+	QMetaObject::invokeMethod(&backfill, "SendBatches", Qt::QueuedConnection);
+	return app.exec() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -21,8 +21,10 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 
+#include <chrono>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <queue>
 
@@ -36,66 +38,172 @@
 #include <QObject>
 #include <QSerialPort>
 #include <QString>
+#include <QStringList>
 
 #include "bluetooth_manager.h"
+#include "device_registry.h"
+#include "device_table.h"
 #include "MAC_device_parser.h"
+#include "rendezvous_planner.h"
+#include "scheduler.h"
+#include "session_statistics.h"
 
 
-void BluetoothManager::Init(QCoreApplication *qapp, const int argc, char *argv[])
+void BluetoothManager::Init(QCoreApplication *qapp, const QStringList & devices)
 {
 	// Parse known devices asynchronously.
 	auto known_devices_future = std::async(std::launch::async, &MACDeviceParser::ParseForDevices, device_file_parser_ptr_ );
 
 	// Start local Bluetooth Device.
-	local_bt_device_.powerOn();
+	if(!rfcomm_only_)
+		LocalBluetoothDevice().powerOn();
 
 	connect(this, SIGNAL(quitapp()), qapp, SLOT(quit()));
-	connect(this, SIGNAL(StartMACAddressProcess(const int)),
-				this, SLOT(ProcessNextMACAddress(const int)));
+	connect(this, SIGNAL(StartMACAddressProcess()),
+				this, SLOT(ProcessNextMACAddress()));
 
-	argv_.reserve(argc - 1);
-	for (int i = 1; i < argc; ++i) {
-		argv_.emplace_back(argv[i]);
+	known_devices_future.get();
+
+	const auto registry = device_file_parser_ptr_->registry();
+	for (const QString & device_id : devices) {
+		const DeviceRegistry::Device * const device =
+			registry->Find(device_id.utf16(), device_id.size());
+		if(device)
+			pending_devices_.push_back(device_file_parser_ptr_->handle(*device));
+		else
+			std::cout << "unknown device " << device_id.toStdString() << std::endl;
 	}
 
+	emit StartMACAddressProcess();
+
+}
+
+void BluetoothManager::InitDaemon(const int probe_interval_seconds)
+{
+	// Parse known devices asynchronously.
+	auto known_devices_future = std::async(std::launch::async, &MACDeviceParser::ParseForDevices, device_file_parser_ptr_ );
+
+	// Start local Bluetooth Device once for the lifetime of the daemon.
+	if(!rfcomm_only_)
+		LocalBluetoothDevice().powerOn();
+
+	daemon_mode_ = true;
+
+	// queued, so database replies are handled between two sessions
+	connect(this, SIGNAL(StartMACAddressProcess()),
+				this, SLOT(ProcessNextMACAddress()), Qt::QueuedConnection);
+	rendezvous_timer_.setSingleShot(true);
+	connect(&rendezvous_timer_, SIGNAL(timeout()), this, SLOT(StartCollectionCycle()));
+
 	known_devices_future.get();
 
-	emit StartMACAddressProcess(argc - 2);
+	RendezvousPlanner & planner = scheduler_ptr_->planner();
+	planner.set_probe_interval(std::chrono::seconds(probe_interval_seconds));
+	const auto registry = device_file_parser_ptr_->registry();
+	for (const auto & device : registry->devices())
+		planner.AddDevice(device_file_parser_ptr_->handle(device));
+	scheduler_ptr_->SeedRendezvousPlans();
+
+	StartCollectionCycle();
+}
+
+void BluetoothManager::StartCollectionCycle()
+{
+	if(cycle_running_)
+		return;
+
+	const auto due_devices = scheduler_ptr_->planner().TakeDue(std::chrono::system_clock::now());
+	pending_devices_.assign(due_devices.begin(), due_devices.end());
+
+	if(pending_devices_.empty())
+	{
+		ArmRendezvousTimer();
+		return;
+	}
+
+	std::cout << "start collection cycle with " << pending_devices_.size() << " devices" << std::endl;
+	cycle_running_ = true;
+	emit StartMACAddressProcess();
+}
+
+void BluetoothManager::UpdateKnownDevices(const QStringList & added_devices,
+		const QStringList & removed_devices)
+{
+	RendezvousPlanner & planner = scheduler_ptr_->planner();
+	DeviceTable & device_table = device_file_parser_ptr_->device_table();
+	for (const QString & device_id : removed_devices)
+		planner.RemoveDevice(device_table.Intern(device_id.utf16(), device_id.size()));
+	for (const QString & device_id : added_devices)
+		planner.AddDevice(device_table.Intern(device_id.utf16(), device_id.size()));
+
+	if(daemon_mode_)
+		StartCollectionCycle();
+}
+
+void BluetoothManager::ArmRendezvousTimer()
+{
+	const auto now = std::chrono::system_clock::now();
+	const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+			scheduler_ptr_->planner().NextDue(now) - now);
 
+	rendezvous_timer_.start(wait.count() > 0 ? wait.count() : 0);
 }
 
-void BluetoothManager::ProcessNextMACAddress(const int argc)
+void BluetoothManager::ProcessNextMACAddress()
 {	
-	if(argc >= 0)
+	pending_sessions_ = pending_devices_.size();
+	if(!pending_devices_.empty())
 	{
+		const DeviceHandle device_handle = pending_devices_.front();
+		pending_devices_.pop_front();
+
 		std::cout << "processing bluetooth device" << std::endl;
-		// valid bluetooth device?
-		if( device_file_parser_ptr_->devices().count(QString(argv_[argc]).toLower().toStdString()) || 
-			device_file_parser_ptr_->devices().count(QString(argv_[argc]).toUpper().toStdString()))
+		// still a known device? the snapshot stays valid for the whole session
+		const auto registry = device_file_parser_ptr_->registry();
+		const DeviceRegistry::Device * const device = registry->Find(
+				device_file_parser_ptr_->device_table().entry(device_handle).mac);
+		if(device)
 		{
 			std::cout << "accept connection for bluetooth device" << std::endl;
 
 			QSerialPort serial_port;
 			//serial_port.setPortName("/dev/rfcomm1");
-			serial_port.setPortName((device_file_parser_ptr_->file_paths().at(argv_[argc]).c_str()));
+			serial_port.setPortName(QString::fromStdString(device->file_path));
 			serial_port.setBaudRate(QSerialPort::Baud9600);
 			serial_port.setStopBits(QSerialPort::OneStop);
 			serial_port.setDataBits(QSerialPort::Data8);
 			serial_port.setParity(QSerialPort::NoParity);
 
+			NodeSessionStatistics * const node_statistics =
+				statistics_ptr_->Node(device_handle);
+			bool session_no_error = false;
+			const auto port_open_start = std::chrono::steady_clock::now();
 			if(!serial_port.open(QIODevice::ReadWrite))
 			{
+				++node_statistics->port_open_failures;
 				std::cout << serial_port.errorString().toStdString() << std::endl;
-				return;
 			}
 			else
+			{
+				node_statistics->Record(PHASE_PORT_OPEN, port_open_start);
 				std::cout << "port opened" << std::endl;
 
-			//serial_communicator_.PerformCommunication(&serial_port, "20:15:04:10:26:60");
-			serial_communicator_.PerformCommunication(&serial_port, argv_[argc]);
-			serial_port.close();
+				//serial_communicator_.PerformCommunication(&serial_port, "20:15:04:10:26:60");
+				session_no_error = serial_communicator_.PerformCommunication(&serial_port, device_handle);
+				serial_port.close();
+			}
+			scheduler_ptr_->planner().SessionFinished(device_handle, session_no_error,
+					std::chrono::system_clock::now());
 		}
-		emit StartMACAddressProcess(argc - 1);
+		emit StartMACAddressProcess();
+	}
+	else if(daemon_mode_)
+	{
+		std::cout << "collection cycle finished" << std::endl;
+		cycle_running_ = false;
+		emit CycleFinished();
+		// devices may have become due during the cycle
+		StartCollectionCycle();
 	}
 	else
 	{
@@ -104,25 +212,41 @@ void BluetoothManager::ProcessNextMACAddress(const int argc)
 	}
 }
 
-
 void BluetoothManager::DiscoverServices(const QList<QBluetoothUuid> &uuid_filter_list)
 {
 	// Agent, search for SerialPort services only!
-	bt_service_agent_.clear();
-	bt_service_agent_.setUuidFilter(uuid_filter_list);
+	QBluetoothServiceDiscoveryAgent & bt_service_agent = ServiceDiscoveryAgent();
+	bt_service_agent.clear();
+	bt_service_agent.setUuidFilter(uuid_filter_list);
 
 	std::cout << "start discovery" << std::endl;
 	// Start bluetooth service discovery agent (non-blocking).
-	bt_service_agent_.start(QBluetoothServiceDiscoveryAgent::FullDiscovery);
-	//bt_service_agent_.start();
+	bt_service_agent.start(QBluetoothServiceDiscoveryAgent::FullDiscovery);
+	//bt_service_agent.start();
 }
 
-bool BluetoothManager::CheckLocalBluetoothDevice() const
+bool BluetoothManager::CheckLocalBluetoothDevice()
 {
+	QBluetoothLocalDevice & local_bt_device = LocalBluetoothDevice();
 	std::cout << "local Bluetooth address: " << 
-		local_bt_device_.address().toString().toStdString() << std::endl;
+		local_bt_device.address().toString().toStdString() << std::endl;
+
+	return local_bt_device.isValid();
+}
 
-	return local_bt_device_.isValid();
+QBluetoothLocalDevice & BluetoothManager::LocalBluetoothDevice()
+{
+	if(!local_bt_device_)
+		local_bt_device_ = std::unique_ptr<QBluetoothLocalDevice>(new QBluetoothLocalDevice);
+	return *local_bt_device_;
+}
+
+QBluetoothServiceDiscoveryAgent & BluetoothManager::ServiceDiscoveryAgent()
+{
+	if(!bt_service_agent_)
+		bt_service_agent_ = std::unique_ptr<QBluetoothServiceDiscoveryAgent>(
+				new QBluetoothServiceDiscoveryAgent);
+	return *bt_service_agent_;
 }
 
 // slots:
@@ -135,11 +259,11 @@ void BluetoothManager::ServiceDiscoveredHandler(const QBluetoothServiceInfo & se
 	//std::cout << "service provider:\t " << service.serviceProvider().toStdString() << std::endl;
 	std::cout << std::endl;
 
-	if( device_file_parser_ptr_->devices().count(service.device().address().toString().toLower().toStdString()) || 
-			device_file_parser_ptr_->devices().count(service.device().address().toString().toUpper().toStdString()))
+	if(device_file_parser_ptr_->registry()->Find(service.device().address().toUInt64()))
 	{
 		std::cout << "Service will be processed." << std::endl;
 		service_queue_.push_back(service);
+		pending_sessions_ = service_queue_.size();
 	}
 	else
 	{
@@ -152,25 +276,32 @@ void BluetoothManager::ServiceDiscoveryFinished()
 	std::cout << "Service discovery has finished." << std::endl;
 
 	// handle requests
+	const auto registry = device_file_parser_ptr_->registry();
 	for (const auto & request : service_queue_) {
+		const DeviceRegistry::Device * const device =
+			registry->Find(request.device().address().toUInt64());
+		if(!device)
+			continue;
+
 		QBluetoothSocket bt_socket;
 		bt_socket.connectToService(request);
-		serial_communicator_.PerformCommunication(&bt_socket, bt_socket.peerAddress().toString());
+		serial_communicator_.PerformCommunication(&bt_socket,
+				device_file_parser_ptr_->handle(*device));
 		bt_socket.close();
 	}
 
 	service_queue_.clear();
-	bt_service_agent_.clear();
-	const QString hc_06_serviceUuid = "00001101-0000-1000-8000-00805F9B34FB";
-	QBluetoothUuid hc_bt_uuid(hc_06_serviceUuid);
-	DiscoverServices({hc_bt_uuid, QBluetoothUuid::SerialPort, QBluetoothUuid::Rfcomm});
+	pending_sessions_ = 0;
+	if(bt_service_agent_)
+		bt_service_agent_->clear();
+	// no new discovery here, nodes are connected at their planned rendezvous
 }
 
 void BluetoothManager::RestartDiscovery()
 {
 	std::cout << "restart discovery" << std::endl;
 	service_queue_.clear();
-	bt_service_agent_.clear();
+	pending_sessions_ = 0;
 	const QString hc_06_serviceUuid = "00001101-0000-1000-8000-00805F9B34FB";
 	QBluetoothUuid hc_bt_uuid(hc_06_serviceUuid);
 	DiscoverServices({hc_bt_uuid, QBluetoothUuid::SerialPort, QBluetoothUuid::Rfcomm});
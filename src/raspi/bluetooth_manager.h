@@ -24,6 +24,9 @@
 #ifndef BLUETOOTH_MANAGER_H_REVZMP9V
 #define BLUETOOTH_MANAGER_H_REVZMP9V
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <deque>
 
@@ -35,17 +38,23 @@
 #include <QCoreApplication>
 #include <QList>
 #include <QObject>
+#include <QStringList>
+#include <QTimer>
 
 #include "database_manager.h"
+#include "device_table.h"
 #include "MAC_device_parser.h"
 #include "scheduler.h"
 #include "serial_communication.h"
+#include "session_statistics.h"
 
 
 // Starts the local Bluetooth device and handles search and discovery of remote Bluetooth services.
+// The Qt Bluetooth objects are only created when they are first needed, sessions themselves
+// go through the bound /dev/rfcommN ports.
 // Example usage:
-// 	BluetoothManager bt_manager;
-// 	bt_manager.Init();
+// 	BluetoothManager bt_manager(&parser, &scheduler, &db_manager, &statistics);
+// 	bt_manager.Init(&app, devices);
 class BluetoothManager : public QObject
 {
 	Q_OBJECT
@@ -53,48 +62,92 @@ public:
 	// Creates BluetoothManager that checks the known devices provided by the parser.
 	BluetoothManager (MACDeviceParser * device_file_parser_ptr,
 			Scheduler<5> * scheduler_ptr, 
-			DatabaseManager * database_manager_ptr) :
+			DatabaseManager * database_manager_ptr,
+			SessionStatistics * statistics_ptr) :
 		device_file_parser_ptr_(device_file_parser_ptr),
-		serial_communicator_(database_manager_ptr, scheduler_ptr)
+		scheduler_ptr_(scheduler_ptr),
+		statistics_ptr_(statistics_ptr),
+		serial_communicator_(database_manager_ptr, scheduler_ptr, statistics_ptr),
+		daemon_mode_(false),
+		rfcomm_only_(false),
+		cycle_running_(false),
+		pending_sessions_(0)
 	{}
 
 	~BluetoothManager () {}
 
 	// Reads known devices from file, powers up local Bluetooth device and
-	// starts initial Bluetooth service discovery.
-	void Init(QCoreApplication *qapp, const int argc, char *argv[]);
+	// starts a session with each of the given devices. qapp quits afterwards.
+	void Init(QCoreApplication *qapp, const QStringList & devices);
+
+	// Reads known devices from file and powers up local Bluetooth device once, then opens the
+	// port of every node right before its planned rendezvous for as long as the event loop
+	// runs. Known devices without a plan are probed every probe_interval_seconds.
+	void InitDaemon(const int probe_interval_seconds);
 
 	// Launches the Bluetooth Service Discovery looking only for services given in filter_list.
 	void DiscoverServices(const QList<QBluetoothUuid> &uuid_filter_list = {QBluetoothUuid::SerialPort});
 
 	// Returns true if the local Bluetooth device is available.
-	bool CheckLocalBluetoothDevice() const;
+	bool CheckLocalBluetoothDevice();
 
 	const MACDeviceParser & DeviceFileParser()
 	{
 		return *device_file_parser_ptr_;
 	}
 
+	// Number of devices and services waiting for their session, readable from any thread.
+	const std::atomic<int64_t> & pending_sessions() const { return pending_sessions_; }
+
+	// mutators
+	// Talks to the nodes through their rfcomm ports only, the local Bluetooth device is neither
+	// created nor powered on. Set it before Init or InitDaemon.
+	void set_rfcomm_only(const bool rfcomm_only) { rfcomm_only_ = rfcomm_only; }
+
+	// Archives every received dump in archive_ptr, see SerialCommunicator::SetDumpArchive.
+	void SetDumpArchive(DumpArchive * archive_ptr)
+	{
+		serial_communicator_.SetDumpArchive(archive_ptr);
+	}
+
 public slots:
 	// This is function is called whenever a new Bluetooth service is discovered.
 	void ServiceDiscoveredHandler(const QBluetoothServiceInfo & service);
 	void ServiceDiscoveryFinished();
 	void RestartDiscovery();
-	void ProcessNextMACAddress(const int argc);
+	void ProcessNextMACAddress();
+	void StartCollectionCycle();
+	// Called after the device mapping changed, new devices are probed right away.
+	void UpdateKnownDevices(const QStringList & added_devices, const QStringList & removed_devices);
 
 signals:
-	void StartMACAddressProcess(const int argc);
+	void StartMACAddressProcess();
+	void CycleFinished();
 	void quitapp();
 
 private:
+	// Wakes up the manager when the next device is due.
+	void ArmRendezvousTimer();
+
+	// Create the Qt Bluetooth objects on first use.
+	QBluetoothLocalDevice & LocalBluetoothDevice();
+	QBluetoothServiceDiscoveryAgent & ServiceDiscoveryAgent();
+
 	MACDeviceParser *device_file_parser_ptr_;
+	Scheduler<5> *scheduler_ptr_;
+	SessionStatistics *statistics_ptr_;
 	SerialCommunicator serial_communicator_;
-	QBluetoothLocalDevice local_bt_device_;
-	QBluetoothServiceDiscoveryAgent bt_service_agent_;
+	// nullptr until first used
+	std::unique_ptr<QBluetoothLocalDevice> local_bt_device_;
+	std::unique_ptr<QBluetoothServiceDiscoveryAgent> bt_service_agent_;
 	//QBluetoothDeviceDiscoveryAgent bt_device_agent_;
-	QBluetoothSocket bt_socket_;
 	std::deque<QBluetoothServiceInfo> service_queue_;
-	std::vector<const char *> argv_;
+	std::deque<DeviceHandle> pending_devices_;
+	bool daemon_mode_;
+	bool rfcomm_only_;
+	bool cycle_running_;
+	QTimer rendezvous_timer_;
+	std::atomic<int64_t> pending_sessions_;
 };
 
 
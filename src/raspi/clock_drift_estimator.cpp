@@ -0,0 +1,97 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+#include "clock_drift_estimator.h"
+#include "device_table.h"
+
+
+constexpr double ClockDriftEstimator::default_max_offset_seconds;
+constexpr double ClockDriftEstimator::minimum_fit_span_seconds;
+
+void ClockDriftEstimator::AddSample(const DeviceHandle device,
+		const std::chrono::system_clock::time_point node_time,
+		const std::chrono::system_clock::time_point master_time)
+{
+	const double master_seconds = ToSeconds(master_time);
+	const Sample sample = {master_seconds, ToSeconds(node_time) - master_seconds};
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	Samples & samples = devices_[device];
+	samples.push_back(sample);
+	if(samples.size() > max_samples)
+		samples.pop_front();
+}
+
+void ClockDriftEstimator::Synchronized(const DeviceHandle device)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	devices_[device].clear();
+}
+
+ClockDriftEstimator::Estimate ClockDriftEstimator::EstimateAt(const DeviceHandle device,
+		const std::chrono::system_clock::time_point time_point) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto known_device = devices_.find(device);
+	if(known_device == devices_.end() || known_device->second.empty())
+		return Estimate{0.0, 0.0};
+	return Fit(known_device->second, ToSeconds(time_point));
+}
+
+bool ClockDriftEstimator::NeedsSync(const DeviceHandle device,
+		const std::chrono::system_clock::time_point time_point) const
+{
+	return std::fabs(EstimateAt(device, time_point).offset_seconds) > max_offset_seconds_;
+}
+
+ClockDriftEstimator::Estimate ClockDriftEstimator::Fit(const Samples & samples,
+		const double master_seconds)
+{
+	const Sample & newest = samples.back();
+	if(samples.size() < 2 ||
+			newest.master_seconds - samples.front().master_seconds < minimum_fit_span_seconds)
+		return Estimate{newest.offset_seconds, 0.0};
+
+	// least squares line through the samples, times relative to the newest one
+	double sum_t = 0.0, sum_offset = 0.0, sum_tt = 0.0, sum_t_offset = 0.0;
+	for (const Sample & sample : samples) {
+		const double t = sample.master_seconds - newest.master_seconds;
+		sum_t += t;
+		sum_offset += sample.offset_seconds;
+		sum_tt += t * t;
+		sum_t_offset += t * sample.offset_seconds;
+	}
+	const double n = samples.size();
+	const double drift = (n * sum_t_offset - sum_t * sum_offset) / (n * sum_tt - sum_t * sum_t);
+	const double offset_at_newest = (sum_offset - drift * sum_t) / n;
+
+	return Estimate{offset_at_newest + drift * (master_seconds - newest.master_seconds), drift};
+}
+
+double ClockDriftEstimator::ToSeconds(const std::chrono::system_clock::time_point time_point)
+{
+	return std::chrono::duration<double>(time_point.time_since_epoch()).count();
+}
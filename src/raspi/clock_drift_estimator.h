@@ -0,0 +1,102 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef CLOCK_DRIFT_ESTIMATOR_H_F5BN0KWE
+#define CLOCK_DRIFT_ESTIMATOR_H_F5BN0KWE
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "device_table.h"
+
+// Estimates offset and drift of the RTC of every node against the clock of the master from
+// the node time each dump carries, so nodes no longer ask for the time before every dump.
+// Offsets measured since the last time the RTC of a node was set are fitted by least squares
+// as a linear function of master time. Offsets are node time minus master time in seconds,
+// the RTC resolves whole seconds only, so nodes are synchronized well above that.
+class ClockDriftEstimator
+{
+public:
+	// Offset and drift of a node clock, drift is in seconds per second.
+	struct Estimate
+	{
+		double offset_seconds;
+		double drift;
+	};
+
+	// Nodes are synchronized again before their predicted offset exceeds max_offset_seconds.
+	explicit ClockDriftEstimator (const double max_offset_seconds = default_max_offset_seconds) :
+		max_offset_seconds_(max_offset_seconds)
+	{}
+	~ClockDriftEstimator () {}
+
+	// Adds a measurement, node_time was read from the RTC of device when the master received
+	// it at master_time.
+	void AddSample(const DeviceHandle device,
+			const std::chrono::system_clock::time_point node_time,
+			const std::chrono::system_clock::time_point master_time);
+
+	// The RTC of device was set, earlier measurements are obsolete. The next dump measures
+	// the offset the setting left.
+	void Synchronized(const DeviceHandle device);
+
+	// Estimated offset of device at master time time_point and its drift. Unknown nodes
+	// have neither offset nor drift.
+	Estimate EstimateAt(const DeviceHandle device,
+			const std::chrono::system_clock::time_point time_point) const;
+
+	// Returns true if the RTC of device should be set because its predicted offset at
+	// time_point exceeds the maximum offset.
+	bool NeedsSync(const DeviceHandle device,
+			const std::chrono::system_clock::time_point time_point) const;
+
+	static constexpr double default_max_offset_seconds = 5.0;
+
+private:
+	struct Sample
+	{
+		double master_seconds;
+		double offset_seconds;
+	};
+
+	// newest samples since the last synchronization, oldest first
+	typedef std::deque<Sample> Samples;
+
+	static Estimate Fit(const Samples & samples, const double master_seconds);
+	static double ToSeconds(const std::chrono::system_clock::time_point time_point);
+
+	// samples kept per node, drift changes slowly with temperature
+	static const std::size_t max_samples = 16;
+	// drift is only fitted over samples spanning at least this time
+	static constexpr double minimum_fit_span_seconds = 3600.0;
+
+	const double max_offset_seconds_;
+	mutable std::mutex mutex_;
+	std::unordered_map<DeviceHandle, Samples> devices_;
+};
+
+
+#endif /* end of include guard: CLOCK_DRIFT_ESTIMATOR_H_F5BN0KWE */
@@ -22,10 +22,14 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <ctime>
 #include <iostream>
 #include <memory>
 #include <ratio>
+#include <string>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -35,15 +39,23 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QMetaObject>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QProcess>
 #include <QString>
+#include <QStringList>
+#include <QThread>
 #include <QUrl>
 #include <QUrlQuery>
 
+#include "anomaly_detector.h"
 #include "database_manager.h" 
+#include "device_registry.h"
+#include "session_statistics.h"
 #include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
 
 // character string definitions
 const char *DatabaseManager::database_key = "database";
@@ -62,10 +74,6 @@ const char *DatabaseManager::time_key = "time";
 const char *DatabaseManager::precision_key = "precision";
 const char *DatabaseManager::precision_value = "s";
 const char *DatabaseManager::sensor_key = "sensor_id";
-const char *DatabaseManager::sensor_id_1_value = "sensor_1";
-const char *DatabaseManager::sensor_id_2_value = "sensor_2";
-const char *DatabaseManager::sensor_id_3_value = "sensor_3";
-const char *DatabaseManager::sensor_id_4_value = "sensor_4";
 const char *DatabaseManager::type_key = "type";
 const char *DatabaseManager::type_collection_start = "start";
 const char *DatabaseManager::collection_events = "collection_events";
@@ -75,119 +83,276 @@ const char *DatabaseManager::events = "events";
 const char *DatabaseManager::type_event_init = "init";
 const char *DatabaseManager::type_event_rendezvous = "rendezvous";
 const char *DatabaseManager::type_event_time = "time";
+const char *DatabaseManager::energy_series = "node_energy";
+const char *DatabaseManager::collect_awake_ms_key = "collect_awake_ms";
+const char *DatabaseManager::transfer_awake_ms_key = "transfer_awake_ms";
+const char *DatabaseManager::master_wait_seconds_key = "master_wait_seconds";
+const char *DatabaseManager::wake_ups_key = "wake_ups";
+const char *DatabaseManager::supply_volts_key = "supply_volts";
+const char *DatabaseManager::alert_events = "alert_events";
 
 
 void DatabaseManager::Init(const QCoreApplication * qapp)
 {
-	connect(this, SIGNAL(AllFinished()), qapp, SLOT(quit()));
+	if(qapp)
+		connect(this, SIGNAL(AllFinished()), qapp, SLOT(quit()));
+
+	if(InManagerThread())
+		CreateNetworkAccessManager();
+	else
+		QMetaObject::invokeMethod(this, "CreateNetworkAccessManager",
+				Qt::BlockingQueuedConnection);
+}
+
+void DatabaseManager::Shutdown()
+{
+	if(InManagerThread())
+		DeleteNetworkAccessManager();
+	else
+		QMetaObject::invokeMethod(this, "DeleteNetworkAccessManager",
+				Qt::BlockingQueuedConnection);
+}
+
+void DatabaseManager::WaitForQueuedRequests()
+{
+	// queued calls are processed in order
+	if(!InManagerThread())
+		QMetaObject::invokeMethod(this, "QueuedRequestsBarrier",
+				Qt::BlockingQueuedConnection);
+}
+
+void DatabaseManager::CreateNetworkAccessManager()
+{
 	nam_ = std::unique_ptr<QNetworkAccessManager>(new QNetworkAccessManager); 
+	// alerts for missing dumps need the network access manager to be written
+	missing_dump_timer_.start(missing_dump_check_interval_ms);
 }
 
-void DatabaseManager::PushValuesToDatabase(const QString device_id, 
-		std::shared_ptr<temperature_readings_header> temperatures_header_ptr,
-		std::shared_ptr<std::vector<temperature_reading>> collected_data)
+void DatabaseManager::DeleteNetworkAccessManager()
 {
-	
-	// get additional tag for database entry
-	const std::unordered_map<std::string, std::string>::const_iterator device_id_tag = 
-		parser_.devices().find(device_id.toLower().toStdString());
+	missing_dump_timer_.stop();
+	nam_.reset();
+}
 
-	// data collection begin timestamp 
-	std::chrono::system_clock::time_point sample_time;
-	TimeConvertToHostTime(temperatures_header_ptr->start_time, &sample_time);
+DumpSlot * DatabaseManager::AcquireDumpSlot(const int timeout_ms)
+{
+	DumpSlot * dump_slot = dump_ring_.BeginWrite();
+	if(dump_slot)
+		return dump_slot;
 
-	// sampling interval setup
-	const std::chrono::duration<unsigned int, std::ratio<1,1> > 
-		interval_seconds(temperatures_header_ptr->interval_length_seconds);
+	++dump_ring_full_waits_;
+	// nobody else would drain the ring while the caller waits
+	if(InManagerThread())
+	{
+		EncodeQueuedDumps();
+		return dump_ring_.BeginWrite();
+	}
 
-	const QString database_value(db_name_.c_str());
+	const auto deadline = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(timeout_ms);
+	while(!(dump_slot = dump_ring_.BeginWrite()) && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return dump_slot;
+}
 
-	// iterate over all datapoints, create JSON objects and send them to the database
-	for (const auto & temperature_data : *collected_data) {
+void DatabaseManager::CommitDumpSlot()
+{
+	// the encoder drains the ring completely, it only has to be woken up once it ran empty
+	if(dump_ring_.CommitWrite())
+		emit DumpsQueued();
+}
 
-		QJsonObject json_write_object;
-		QJsonObject json_common_tag_object;
-		QJsonArray json_points_array;
+void DatabaseManager::EncodeQueuedDumps()
+{
+	while(const DumpSlot * const dump_slot = dump_ring_.BeginRead())
+	{
+		PushValuesToDatabase(*dump_slot);
+		dump_ring_.CommitRead();
+	}
+}
 
-		// create highest level
-		json_write_object.insert(database_key, database_value);
-		json_write_object.insert(retention_policy_key, retention_policy_value);
-		json_common_tag_object.insert(device_id_key, device_id);
+void DatabaseManager::PushValuesToDatabase(const DumpSlot & dump)
+{
+	const DeviceHandle device = dump.device;
+	const ReadingDecoder decoder(dump.header);
+	if(!decoder.valid())
+		return;
 
-		if ( device_id_tag != parser_.devices().end() )
-			json_common_tag_object.insert(
-					device_tag_key, device_id_tag->second.c_str());
+	// data collection begin timestamp 
+	std::chrono::system_clock::time_point sample_time;
+	TimeConvertToHostTime(dump.header.start_time, &sample_time);
 
-		json_write_object.insert(tags_key, json_common_tag_object);
-		json_write_object.insert(time_key, qint64(
-					std::chrono::duration_cast<std::chrono::seconds>
-					(sample_time.time_since_epoch()).count())
-				);
+	// sampling interval setup
+	const uint32_t interval_length_seconds = dump.header.interval_length_seconds;
 
-		json_write_object.insert(precision_key, precision_value);
+	NodeSessionStatistics * const node_statistics = statistics_ptr_->Node(device);
+	const uint64_t device_mac = parser_.device_table().entry(device).mac;
 
+	// one point per sensor and reading, only time and value differ between the readings
+	if(point_prefixes_[0].isEmpty())
+	{
+		for (unsigned int sensor = 0; sensor < MAX_SENSOR_COUNT; ++sensor) {
+			QJsonObject json_tags_object;
+			json_tags_object.insert(sensor_key, SensorIdValue(sensor));
+			point_prefixes_[sensor] = TemperaturePointPrefix(json_tags_object);
+		}
+	}
 
-		QJsonObject json_point_1, json_point_2, 
-			    json_point_3, json_point_4, 
-			    json_field_1, json_field_2, 
-			    json_field_3, json_field_4;
+	// all readings of the dump go into a single write
+	const QByteArray & write_prefix = TagsOf(device).write_prefix;
+	write_body_.resize(0);
+	write_body_.reserve(write_prefix.size() + 2 + dump.header.number_of_readings *
+			decoder.sensor_count() * (point_prefixes_[0].size() + 60));
+	write_body_.append(write_prefix);
+
+	uint16_t raw_values[MAX_SENSOR_COUNT];
+	double celsius_values[MAX_SENSOR_COUNT];
+	std::chrono::system_clock::time_point reading_time;
+	alerts_.clear();
+
+	// iterate over all datapoints and render them into the write
+	for (unsigned int i = 0; i < dump.header.number_of_readings; ++i) {
+		// the node clock runs off by the estimated offset plus its drift since the start
+		const qint64 unix_seconds = SampleUnixSeconds(sample_time, interval_length_seconds, i,
+				dump.clock_offset_seconds, dump.clock_drift);
+		reading_time = std::chrono::system_clock::time_point(std::chrono::seconds(unix_seconds));
+
+		decoder.Unpack(dump.readings, i, raw_values);
+		anomaly_detector_.AddReading(device, reading_time, raw_values, decoder.sensor_count(),
+				decoder.adc_bits(), &alerts_);
+		for (unsigned int sensor = 0; sensor < decoder.sensor_count(); ++sensor) {
+			celsius_values[sensor] = RawToCelsius(raw_values[sensor], decoder.adc_bits());
+
+			AppendTemperaturePoint(&write_body_, point_prefixes_[sensor], unix_seconds,
+					celsius_values[sensor]);
+		}
 
-		QJsonObject json_tags_object_1, json_tags_object_2,
-			    json_tags_object_3, json_tags_object_4;
+		if(hot_window_ptr_)
+			hot_window_ptr_->Add(device, uint32_t(unix_seconds), celsius_values,
+					decoder.sensor_count());
+		if(live_feed_ptr_)
+			live_feed_ptr_->Publish(device_mac, uint32_t(unix_seconds), celsius_values,
+					decoder.sensor_count());
+	}
 
-		QJsonObject json_sensor_tag_1, json_sensor_tag_2, 
-			    json_sensor_tag_3, json_sensor_tag_4;
+	EndTemperatureWrite(&write_body_);
+	if(dump.header.number_of_readings && decoder.sensor_count())
+		BodyToDatabase(write_body_, node_statistics);
 
-		std::tuple<double, double, double, double> converted_temperature_values;
-		TemperatureReadingToValues(temperature_data, &converted_temperature_values);
+	if(dump.header.number_of_readings)
+	{
+		anomaly_detector_.DumpReceived(device, reading_time,
+				dump.header.interval_length_seconds);
+		PushAlerts(alerts_);
+	}
 
-		json_point_1.insert(name_key, name_value);
-		json_tags_object_1.insert(sensor_key, sensor_id_1_value);
-		json_point_1.insert(tags_key, json_tags_object_1);
-		json_field_1.insert(value_key, 
-				std::move(std::get<0>(converted_temperature_values)));
+	// a dump followed by DATA in the same session leaves the telemetry to the DATA
+	const energy_telemetry & energy = dump.header.energy;
+	if(!energy.collect_awake_ms && !energy.transfer_awake_ms && !energy.master_wait_seconds &&
+			!energy.wake_ups && !energy.supply_millivolts)
+		return;
+
+	// the energy telemetry belongs to the moment the node sent the header
+	const double clock_offset_seconds = dump.clock_offset_seconds + dump.clock_drift *
+		interval_length_seconds * dump.header.number_of_readings;
+	if(dump.header.node_time.date)
+		TimeConvertToHostTime(dump.header.node_time, &sample_time);
+	else
+		sample_time += std::chrono::seconds(interval_length_seconds) *
+			dump.header.number_of_readings;
+	PushEnergyToDatabase(dump, sample_time -
+			std::chrono::duration_cast<std::chrono::system_clock::duration>(
+				std::chrono::duration<double>(clock_offset_seconds)));
+}
 
-		json_point_1.insert(fields_key, json_field_1);
-		json_points_array.append(json_point_1);
+void DatabaseManager::PushEnergyToDatabase(const DumpSlot & dump,
+		const std::chrono::system_clock::time_point & time_point)
+{
+	const energy_telemetry & energy = dump.header.energy;
 
-		json_point_2.insert(name_key, name_value);
-		json_tags_object_2.insert(sensor_key, sensor_id_2_value);
-		json_point_2.insert(tags_key, json_tags_object_2);
-		json_field_2.insert(value_key, 
-				std::move(std::get<1>(converted_temperature_values)));
+	QJsonObject json_object;
+	json_object.insert(database_key, QString(db_name_.c_str()));
+	json_object.insert(retention_policy_key, retention_policy_value);
+	json_object.insert(tags_key, TagsOf(dump.device).tags);
+	json_object.insert(precision_key, precision_value);
+	json_object.insert(time_key, qint64(
+				std::chrono::duration_cast<std::chrono::seconds>
+				(time_point.time_since_epoch()).count()));
 
-		json_point_2.insert(fields_key, json_field_2);
-		json_points_array.append(json_point_2);
+	QJsonObject json_fields_object;
+	json_fields_object.insert(collect_awake_ms_key, qint64(energy.collect_awake_ms));
+	json_fields_object.insert(transfer_awake_ms_key, qint64(energy.transfer_awake_ms));
+	json_fields_object.insert(master_wait_seconds_key, qint64(energy.master_wait_seconds));
+	json_fields_object.insert(wake_ups_key, int(energy.wake_ups));
+	json_fields_object.insert(supply_volts_key, energy.supply_millivolts / 1000.0);
 
-		json_point_3.insert(name_key, name_value);
-		json_tags_object_3.insert(sensor_key, sensor_id_3_value);
-		json_point_3.insert(tags_key, json_tags_object_3);
-		json_field_3.insert(value_key, 
-				std::move(std::get<2>(converted_temperature_values)));
+	QJsonObject json_point;
+	json_point.insert(name_key, energy_series);
+	json_point.insert(fields_key, json_fields_object);
 
-		json_point_3.insert(fields_key, json_field_3);
-		json_points_array.append(json_point_3);
+	QJsonArray json_points_array;
+	json_points_array.append(json_point);
+	json_object.insert(points_key, json_points_array);
 
-		json_point_4.insert(name_key, name_value);
-		json_tags_object_4.insert(sensor_key, sensor_id_4_value);
-		json_point_4.insert(tags_key, json_tags_object_4);
-		json_field_4.insert(value_key, 
-				std::move(std::get<3>(converted_temperature_values)));
+	JsonToDatabase(QJsonDocument(json_object), statistics_ptr_->Node(dump.device));
+}
 
-		json_point_4.insert(fields_key, json_field_4);
-		json_points_array.append(json_point_4);
+void DatabaseManager::PushAlerts(const std::vector<AnomalyDetector::Alert> & alerts)
+{
+	for (const AnomalyDetector::Alert & alert : alerts) {
+		++alerts_raised_[alert.type];
+
+		const DeviceTags & device_tags = TagsOf(alert.device);
+		const QString type_name = AnomalyDetector::TypeName(alert.type);
+		const QString sensor_id = alert.sensor >= 0 ? SensorIdValue(alert.sensor) : QString();
+		const qint64 unix_seconds = std::chrono::duration_cast<std::chrono::seconds>(
+				alert.time.time_since_epoch()).count();
+
+		std::cout << "alert " << type_name.toStdString() << " of " <<
+			device_tags.device_id.toStdString() << " " << sensor_id.toStdString() <<
+			": " << alert.value << std::endl;
+
+		QJsonObject json_tags_object(device_tags.tags);
+		json_tags_object.insert(type_key, type_name);
+		if(alert.sensor >= 0)
+			json_tags_object.insert(sensor_key, sensor_id);
+
+		QJsonObject json_object;
+		json_object.insert(database_key, QString(db_name_.c_str()));
+		json_object.insert(retention_policy_key, retention_policy_value);
+		json_object.insert(tags_key, json_tags_object);
+		json_object.insert(precision_key, precision_value);
+		json_object.insert(time_key, unix_seconds);
+
+		QJsonObject json_fields_object;
+		json_fields_object.insert(value_key, alert.value);
+
+		QJsonObject json_point;
+		json_point.insert(name_key, alert_events);
+		json_point.insert(fields_key, json_fields_object);
 
-		json_write_object.insert(points_key, json_points_array);
-		QJsonDocument json_document(json_write_object);
-		//cout << json_document.toJson().toStdString() << std::endl;
+		QJsonArray json_points_array;
+		json_points_array.append(json_point);
+		json_object.insert(points_key, json_points_array);
 
-		sample_time += interval_seconds;
+		JsonToDatabase(QJsonDocument(json_object), statistics_ptr_->Node(alert.device));
 
-		JsonToDatabase(json_document);
+		// the alert leaves the master right away, not with the next export
+		if(!alert_command_.isEmpty())
+			QProcess::startDetached(alert_command_, QStringList() << device_tags.device_id <<
+					type_name << sensor_id << QString::number(alert.value) <<
+					QString::number(unix_seconds));
 	}
 }
 
-void DatabaseManager::HandleTestData(const QString device_id,
+void DatabaseManager::CheckMissingDumps()
+{
+	alerts_.clear();
+	anomaly_detector_.CheckMissingDumps(std::chrono::system_clock::now(), &alerts_);
+	PushAlerts(alerts_);
+}
+
+void DatabaseManager::HandleTestData(const DeviceHandle device,
 		std::shared_ptr<timestamp> device_time, 
 		std::shared_ptr<temperature_reading> temperatures)
 {
@@ -197,11 +362,10 @@ void DatabaseManager::HandleTestData(const QString device_id,
 	std::tuple<double, double, double, double> temperature_values;
 	TemperatureReadingToValues(*temperatures, &temperature_values);
 
-	const std::unordered_map<std::string, std::string>::const_iterator device_id_tag = 
-		parser_.devices().find(device_id.toLower().toStdString());
+	const DeviceTags & device_tags = TagsOf(device);
 
-	std::cout << "device id: " << device_id.toStdString() <<  std::endl <<
-		"device tag: " << device_id_tag->second << std::endl <<
+	std::cout << "device id: " << device_tags.device_id.toStdString() <<  std::endl <<
+		"device tag: " << device_tags.tags.value(device_tag_key).toString().toStdString() << std::endl <<
 		"temperature 1: " << std::get<0>(temperature_values) << std::endl << 
 		"temperature 2: " << std::get<1>(temperature_values) << std::endl << 
 		"temperature 3: " << std::get<2>(temperature_values) << std::endl <<
@@ -210,9 +374,24 @@ void DatabaseManager::HandleTestData(const QString device_id,
 
 }
 
-const std::vector< std::pair<std::string, std::chrono::system_clock::time_point> >
+std::vector<ScheduledCollection>
 		DatabaseManager::FetchCollectionStartTimes
 		(const std::chrono::system_clock::time_point time_point)
+{
+	std::vector<ScheduledCollection> result;
+	if(InManagerThread())
+		QueryCollectionStartTimes(time_point, &result);
+	else
+		QMetaObject::invokeMethod(this, "QueryCollectionStartTimes",
+				Qt::BlockingQueuedConnection,
+				Q_ARG(std::chrono::system_clock::time_point, time_point),
+				Q_ARG(std::vector<ScheduledCollection> *, &result));
+	return result;
+}
+
+void DatabaseManager::QueryCollectionStartTimes(
+		const std::chrono::system_clock::time_point time_point,
+		std::vector<ScheduledCollection> * result)
 {
 	QUrl query_url;
 	query_url.setScheme("http");
@@ -223,18 +402,18 @@ const std::vector< std::pair<std::string, std::chrono::system_clock::time_point>
 	QUrlQuery url_query_part;
 	url_query_part.addQueryItem("db", db_name_.c_str());
 
+	// a node may still be collecting for a start time lookback_hours in the past
 	url_query_part.addQueryItem("q", "SELECT "+QUrl::toPercentEncoding("*")+
 			" FROM collection_events WHERE time > now"+
 			QUrl::toPercentEncoding("()")+
-			"and time < now"+QUrl::toPercentEncoding("()")+
-			" " +QUrl::toPercentEncoding("+") + " 12h");
+			" " +QUrl::toPercentEncoding("-") + " " +
+			QString::number(collection_lookback_hours) + "h" +
+			" GROUP BY " + device_id_key);
 
 	query_url.setQuery(url_query_part);
 	//std::cout << query_url.toEncoded(QUrl::FullyEncoded).toStdString() << std::endl;
 
-	QNetworkAccessManager local_NAM;
-
-	QNetworkReply *reply = local_NAM.get(QNetworkRequest(query_url));
+	QNetworkReply *reply = nam_->get(QNetworkRequest(query_url));
 	QEventLoop event_loop;
 
 	connect(reply, SIGNAL(finished()), &event_loop, SLOT(quit()) );
@@ -245,65 +424,81 @@ const std::vector< std::pair<std::string, std::chrono::system_clock::time_point>
 	// loop until reply finished signal arrives
 	event_loop.exec();
 
+	result->clear();
+
+	// without the schedule of the last run the scheduler starts from scratch
+	if(reply->error() != QNetworkReply::NoError)
+	{
+		std::cout << "collection start times not available: " <<
+			reply->errorString().toStdString() << std::endl;
+		delete(reply);
+		return;
+	}
+
 	QJsonDocument response_document = QJsonDocument::fromJson(reply->readAll());
+	delete(reply);
 
 	std::cout << "response:\n" << 
 		response_document.toJson().toStdString() << std::endl;
-	
-	//const auto response =  response_document.object().constFind("error");
-
-	std::vector< std::pair<std::string, 
-		std::chrono::system_clock::time_point> > result;
 
-	// error message?
-	//if(!response->isNull())
-	//{
-	//	std::cout << "got error response" << std::endl;
-	//	return result;
-	//}
-
-	const QJsonArray results_json_array = response_document.object().constFind("results")->toArray();
-	const QJsonArray series_json_array = results_json_array.first().toObject().constFind("series")->toArray();
+	const QJsonObject response_object = response_document.object();
+	const auto results_value = response_object.constFind("results");
+	if(results_value == response_object.constEnd() || results_value->toArray().isEmpty())
+		return;
+	const QJsonObject first_result = results_value->toArray().first().toObject();
+	// no series if no device was scheduled within the lookback
+	const auto series_value = first_result.constFind("series");
+	if(series_value == first_result.constEnd())
+		return;
+	const QJsonArray series_json_array = series_value->toArray();
 
 	for (const auto & json_value : series_json_array) {
-		const QString device_id_parsed(
-				json_value.toObject().constFind(tags_key)->toObject().constFind(device_id_key)->toString());
-
-		if(json_value.toObject().constFind(values_key) != json_value.toObject().constEnd())
-		{
-			const QString timestamp_parsed(
-					json_value.toObject().constFind(values_key)->toArray().last().toArray().first().toString());
+		const QJsonObject series = json_value.toObject();
+		const QJsonObject series_tags = series.value(tags_key).toObject();
+		const QString device_id_parsed(series_tags.value(device_id_key).toString());
+		const DeviceHandle device = parser_.device_table().Intern(
+				device_id_parsed.utf16(), device_id_parsed.size());
+
+		const QJsonArray rows = series.value(values_key).toArray();
+		if(device == INVALID_DEVICE_HANDLE || rows.isEmpty())
+			continue;
+
+		// rows are sorted by time, the last one is the current schedule of the device
+		const QJsonArray last_row = rows.last().toArray();
+		if(last_row.isEmpty())
+			continue;
+		const QString timestamp_parsed(last_row.first().toString());
+
+		int value_column = last_row.size() - 1;
+		const QJsonArray columns = series.value("columns").toArray();
+		for (int i = 0; i < columns.size(); ++i) {
+			if(columns.at(i).toString() == value_key)
+				value_column = i;
+		}
 
-			const auto date_time = QDateTime::fromString(timestamp_parsed, Qt::DateFormat::ISODate);
-			const std::time_t date_time_unix = date_time.toTime_t();
-			const std::chrono::system_clock::time_point parsed_time_point = std::chrono::system_clock::from_time_t(date_time_unix);
+		const auto date_time = QDateTime::fromString(timestamp_parsed, Qt::DateFormat::ISODate);
+		// a row that does not match its columns is not a schedule
+		if(value_column >= last_row.size() || !date_time.isValid())
+			continue;
+		const std::time_t date_time_unix = date_time.toTime_t();
+		const std::chrono::system_clock::time_point parsed_time_point = std::chrono::system_clock::from_time_t(date_time_unix);
 
-			result.emplace_back(device_id_parsed.toStdString(), parsed_time_point);
+		result->push_back(ScheduledCollection{device, parsed_time_point,
+				static_cast<uint32_t>(last_row.at(value_column).toDouble())});
 
-			std::cout << "device_id: " << device_id_parsed.toStdString() << " "
-				"timestamp: " << timestamp_parsed.toStdString() << std::endl;
-			const auto time_seconds = std::chrono::duration_cast<std::chrono::seconds>(parsed_time_point.time_since_epoch()).count();
-			std::cout << "timestamp converted to duration: " <<  time_seconds << "s" << std::endl;
-		}
+		std::cout << "device_id: " << device_id_parsed.toStdString() << " "
+			"timestamp: " << timestamp_parsed.toStdString() << 
+			" interval: " << result->back().interval_length_seconds << "s" << std::endl;
 	}
 
 	// sort result entries according to timestamps
-	std::sort(result.begin(), result.end(), [](const std::pair<std::string, std::chrono::system_clock::time_point> & pair_a, 
-				const std::pair<std::string, std::chrono::system_clock::time_point> &pair_b)
-			{return pair_a.second < pair_b.second;});
-
-	for (const auto & result_pair : result) {
-		const auto time_seconds = std::chrono::duration_cast<std::chrono::seconds>(result_pair.second.time_since_epoch()).count();
-		std::cout << "device_id: " << result_pair.first << " time point: " << time_seconds << std::endl;
-	}
-
-	delete(reply);
-
-	return result;
+	std::sort(result->begin(), result->end(), [](const ScheduledCollection & collection_a,
+				const ScheduledCollection & collection_b)
+			{return collection_a.start_time < collection_b.start_time;});
 }
 
 QJsonDocument DatabaseManager::CreateDatabaseEventJson(
-		const QString & device_id, 
+		const DeviceHandle device, 
 		const QString & series_name,
 		const QString & event_type,
 		const int value,
@@ -317,7 +512,7 @@ QJsonDocument DatabaseManager::CreateDatabaseEventJson(
 	json_object.insert(precision_key, precision_value);
 
 	QJsonObject json_tag_object;
-	json_tag_object.insert(device_id_key, device_id);
+	json_tag_object.insert(device_id_key, TagsOf(device).device_id);
 	json_tag_object.insert(type_key, event_type);
 	json_object.insert(tags_key, json_tag_object);
 
@@ -341,34 +536,14 @@ QJsonDocument DatabaseManager::CreateDatabaseEventJson(
 
 }
 
-void DatabaseManager::JsonToDatabaseNAM(const QJsonDocument & json_doc)
+void DatabaseManager::JsonToDatabase(const QJsonDocument & json_doc,
+		NodeSessionStatistics * node_statistics)
 {
-	QUrl write_db_URL;
-	write_db_URL.setScheme("http");
-	write_db_URL.setHost(db_url_host_.c_str());
-	write_db_URL.setPort(db_port_);
-	write_db_URL.setPath(db_write_path_.c_str());
-
-	QNetworkRequest database_request(write_db_URL);
-	database_request.setHeader(QNetworkRequest::ContentTypeHeader, 
-			QVariant("application/json"));
-
-	QNetworkAccessManager local_NAM;
-	QNetworkReply* reply = local_NAM.post(
-			database_request, json_doc.toJson());
-	QEventLoop event_loop;
-	connect(reply, SIGNAL(finished()), &event_loop, SLOT(quit()) );
-	connect(reply, SIGNAL(error(QNetworkReply::NetworkError)),
-			this, 
-			SLOT(ErrorReplySlot(QNetworkReply::NetworkError)));
-
-	// loop until reply finished signal arrives
-	event_loop.exec();
-
-	delete(reply);
+	BodyToDatabase(json_doc.toJson(), node_statistics);
 }
 
-void DatabaseManager::JsonToDatabase(const QJsonDocument & json_doc)
+void DatabaseManager::BodyToDatabase(const QByteArray & body,
+		NodeSessionStatistics * node_statistics)
 {
 	QUrl write_db_URL;
 	write_db_URL.setScheme("http");
@@ -381,8 +556,10 @@ void DatabaseManager::JsonToDatabase(const QJsonDocument & json_doc)
 			QVariant("application/json"));
 
 	++open_network_replies_;
+	++writes_in_flight_;
 	QNetworkReply* reply = nam_->post(
-			database_request, json_doc.toJson());
+			database_request, body);
+	pending_writes_[reply] = PendingWrite{std::chrono::steady_clock::now(), node_statistics};
 	connect(reply, SIGNAL(finished()), this, SLOT(ReplyFinishedSlot()));
 	connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
 	connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), 
@@ -390,69 +567,79 @@ void DatabaseManager::JsonToDatabase(const QJsonDocument & json_doc)
 			SLOT(ErrorReplySlot(QNetworkReply::NetworkError)));
 }
 
-void DatabaseManager::ScheduledTimeToDatabase(const QString device_id, 
-		const std::chrono::system_clock::time_point time_point)
+void DatabaseManager::ScheduledTimeToDatabase(const DeviceHandle device, 
+		const std::chrono::system_clock::time_point time_point,
+		const uint32_t interval_length_seconds)
 {
+	// the scheduler runs in threads of its own
+	if(!InManagerThread())
+	{
+		QMetaObject::invokeMethod(this, "ScheduledTimeToDatabase", Qt::QueuedConnection,
+				Q_ARG(DeviceHandle, device),
+				Q_ARG(std::chrono::system_clock::time_point, time_point),
+				Q_ARG(uint32_t, interval_length_seconds));
+		return;
+	}
 
 	const QJsonDocument json_doc =
-		CreateDatabaseEventJson(device_id, collection_events,
+		CreateDatabaseEventJson(device, collection_events,
 				type_collection_start,
-				1,
+				interval_length_seconds,
 				time_point);
 
-	JsonToDatabaseNAM(json_doc);
+	JsonToDatabase(json_doc, statistics_ptr_->Node(device));
 
 }
 
-void DatabaseManager::PushErrorEvent(const QString device_id,
+void DatabaseManager::PushErrorEvent(const DeviceHandle device,
 		const std::chrono::system_clock::time_point time_point,
 		const int error_value)
 {
 	const QJsonDocument json_doc =
-		CreateDatabaseEventJson(device_id, error_events,
+		CreateDatabaseEventJson(device, error_events,
 				type_error_event,
 				error_value,
 				time_point);
 
-	JsonToDatabase(json_doc);
+	JsonToDatabase(json_doc, statistics_ptr_->Node(device));
 }
 
-void DatabaseManager::PushInitEvent(const QString device_id, 
+void DatabaseManager::PushInitEvent(const DeviceHandle device, 
 			const std::chrono::system_clock::time_point time_point)
 {
 	const QJsonDocument json_doc =
-		CreateDatabaseEventJson(device_id, events,
+		CreateDatabaseEventJson(device, events,
 				type_event_init,
 				1,
 				time_point);
 
-	JsonToDatabase(json_doc);
+	JsonToDatabase(json_doc, statistics_ptr_->Node(device));
 
 }
 
-void DatabaseManager::PushRendezvousEvent(const QString device_id,
+void DatabaseManager::PushRendezvousEvent(const DeviceHandle device,
 		const std::chrono::system_clock::time_point time_point)
 {
 	const QJsonDocument json_doc =
-		CreateDatabaseEventJson(device_id, events,
+		CreateDatabaseEventJson(device, events,
 				type_event_rendezvous,
 				1,
 				time_point);
 
-	JsonToDatabase(json_doc);
+	JsonToDatabase(json_doc, statistics_ptr_->Node(device));
 
 }
 
-void DatabaseManager::PushTimeRequestEvent(const QString device_id, 
+void DatabaseManager::PushTimeRequestEvent(const DeviceHandle device, 
 		const std::chrono::system_clock::time_point time_point)
 {
 	const QJsonDocument json_doc =
-		CreateDatabaseEventJson(device_id, events,
+		CreateDatabaseEventJson(device, events,
 				type_event_time,
 				1,
 				time_point);
 
-	JsonToDatabase(json_doc);
+	JsonToDatabase(json_doc, statistics_ptr_->Node(device));
 
 }
 
@@ -491,6 +678,15 @@ void DatabaseManager::TimeConvertToDeviceTime(
 
 }
 
+qint64 DatabaseManager::SampleUnixSeconds(const std::chrono::system_clock::time_point & start_time,
+		const uint32_t interval_length_seconds, const unsigned int reading,
+		const double clock_offset_seconds, const double clock_drift)
+{
+	const double elapsed_seconds = double(interval_length_seconds) * reading;
+	return std::llround(std::chrono::duration<double>(start_time.time_since_epoch()).count() +
+			elapsed_seconds - clock_offset_seconds - clock_drift * elapsed_seconds);
+}
+
 void DatabaseManager::TimeConvertToHostTime(const timestamp &timestamp_struct, 
 		std::chrono::system_clock::time_point * system_time)
 {
@@ -567,36 +763,67 @@ void DatabaseManager::TimeConvertToHostTime(const timestamp &timestamp_struct,
 void DatabaseManager::TemperatureReadingToValues(const temperature_reading & temperatures,
 		std::tuple<double, double, double, double> *converted_values)
 {
-	static const unsigned int MEASUREMENT_10_BIT_MASK = 0x3FF;
+	std::get<3>(*converted_values) =
+		RawToCelsius(UnpackTemperature(temperatures, 3), TEMPERATURE_BITS);
+	std::get<2>(*converted_values) =
+		RawToCelsius(UnpackTemperature(temperatures, 2), TEMPERATURE_BITS);
+	std::get<1>(*converted_values) =
+		RawToCelsius(UnpackTemperature(temperatures, 1), TEMPERATURE_BITS);
+	std::get<0>(*converted_values) =
+		RawToCelsius(UnpackTemperature(temperatures, 0), TEMPERATURE_BITS);
+}
 
+double DatabaseManager::RawToCelsius(const unsigned int raw_value, const unsigned int adc_bits)
+{
 	// correct conversion from raw ADC values to temperature!
-	static const double scale_factor = (110.0 / 1024.0);
-
-
-	const unsigned int temperature_1 = 
-		(((unsigned int)temperatures.temperatures_packed[0]) |
-		( (unsigned int)temperatures.temperatures_packed[1] << 8) ) &
-		MEASUREMENT_10_BIT_MASK;
+	return raw_value * (110.0 / (1u << adc_bits));
+}
 
-	const unsigned int temperature_2 = 
-		(((unsigned int)temperatures.temperatures_packed[1] >> 2) |
-		( (unsigned int)temperatures.temperatures_packed[2] << 6) ) &
-		MEASUREMENT_10_BIT_MASK;
+QString DatabaseManager::SensorIdValue(const unsigned int sensor)
+{
+	return QString("sensor_%1").arg(sensor + 1);
+}
 
-	const unsigned int temperature_3 = 
-		(((unsigned int)temperatures.temperatures_packed[2] >> 4) |
-		( (unsigned int)temperatures.temperatures_packed[3] << 4) ) &
-		MEASUREMENT_10_BIT_MASK;
+QByteArray DatabaseManager::TemperatureWritePrefix(const QString & database,
+		const QJsonObject & tags)
+{
+	QJsonObject json_write_object;
+	json_write_object.insert(database_key, database);
+	json_write_object.insert(retention_policy_key, retention_policy_value);
+	if(!tags.isEmpty())
+		json_write_object.insert(tags_key, tags);
+	json_write_object.insert(precision_key, precision_value);
+	QByteArray write_prefix = QJsonDocument(json_write_object).toJson(QJsonDocument::Compact);
+	write_prefix.chop(1);
+	write_prefix.append(",\"").append(points_key).append("\":[");
+	return write_prefix;
+}
 
-	const unsigned int temperature_4 = 
-		(((unsigned int)temperatures.temperatures_packed[3] >> 6)|
-		( (unsigned int)temperatures.temperatures_packed[4] << 2) ) &
-		MEASUREMENT_10_BIT_MASK;
+QByteArray DatabaseManager::TemperaturePointPrefix(const QJsonObject & tags)
+{
+	QJsonObject json_point;
+	json_point.insert(name_key, name_value);
+	json_point.insert(tags_key, tags);
+	QByteArray point_prefix = QJsonDocument(json_point).toJson(QJsonDocument::Compact);
+	point_prefix.chop(1);
+	point_prefix.append(",\"").append(time_key).append("\":");
+	return point_prefix;
+}
 
-	std::get<3>(*converted_values) = (temperature_4 * scale_factor);
-	std::get<2>(*converted_values) = (temperature_3 * scale_factor);
-	std::get<1>(*converted_values) = (temperature_2 * scale_factor);
-	std::get<0>(*converted_values) = (temperature_1 * scale_factor);
+void DatabaseManager::AppendTemperaturePoint(QByteArray * write,
+		const QByteArray & point_prefix, const qint64 unix_seconds, const double celsius)
+{
+	static const QByteArray value_prefix = QByteArray(",\"") + fields_key + "\":{\"" +
+		value_key + "\":";
+
+	// the write prefix ends with the opening bracket of the points
+	if(!write->endsWith('['))
+		write->append(',');
+	write->append(point_prefix);
+	write->append(QByteArray::number(unix_seconds));
+	write->append(value_prefix);
+	write->append(QByteArray::number(celsius, 'g', 17));
+	write->append("}}");
 }
 
 void DatabaseManager::PostReplyFinishedSlot(QNetworkReply * reply)
@@ -606,7 +833,16 @@ void DatabaseManager::PostReplyFinishedSlot(QNetworkReply * reply)
 
 void DatabaseManager::ReplyFinishedSlot()
 {
+	const auto pending_write = pending_writes_.find(static_cast<QNetworkReply *>(sender()));
+	if(pending_write != pending_writes_.end())
+	{
+		pending_write->second.node_statistics->Record(PHASE_DB_WRITE,
+				pending_write->second.start);
+		pending_writes_.erase(pending_write);
+	}
+
 	--open_network_replies_;
+	--writes_in_flight_;
 	if(!open_network_replies_)
 	{
 		emit AllFinished();
@@ -618,3 +854,34 @@ void DatabaseManager::ErrorReplySlot(QNetworkReply::NetworkError err)
 	std::cout << "Networking Error: " << err << std::endl;
 }
 
+bool DatabaseManager::InManagerThread() const
+{
+	return QThread::currentThread() == thread();
+}
+
+const DatabaseManager::DeviceTags & DatabaseManager::TagsOf(const DeviceHandle device)
+{
+	const auto registry = parser_.registry();
+
+	if(device >= device_tags_.size())
+		device_tags_.resize(device + 1);
+
+	DeviceTags & device_tags = device_tags_[device];
+	if(device_tags.registry != registry)
+	{
+		const DeviceTable::Entry & entry = parser_.device_table().entry(device);
+		device_tags.registry = registry;
+		device_tags.device_id = QString::fromStdString(entry.device_id);
+		device_tags.tags = QJsonObject();
+		device_tags.tags.insert(device_id_key, device_tags.device_id);
+
+		const DeviceRegistry::Device * const registry_device = registry->Find(entry.mac);
+		if(registry_device)
+			device_tags.tags.insert(device_tag_key,
+					QString::fromStdString(registry_device->label));
+
+		device_tags.write_prefix = TemperatureWritePrefix(QString(db_name_.c_str()),
+				device_tags.tags);
+	}
+	return device_tags;
+}
@@ -24,25 +24,80 @@
 #ifndef DATABASE_MANAGER_H_I0NKFFHI
 #define DATABASE_MANAGER_H_I0NKFFHI
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+#include <QByteArray>
 #include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMetaType>
 #include <QObject>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QString>
+#include <QTimer>
 
+#include "anomaly_detector.h"
+#include "device_registry.h"
+#include "device_table.h"
+#include "hot_window.h"
+#include "live_feed.h"
 #include "MAC_device_parser.h"
+#include "session_statistics.h"
+#include "spsc_ring.h"
 #include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
 
 
+// Collection start of a device as stored in the collection_events series.
+struct ScheduledCollection
+{
+	DeviceHandle device;
+	std::chrono::system_clock::time_point start_time;
+	// 1 for entries written before the interval was stored
+	uint32_t interval_length_seconds;
+};
+
+// Dump of a node on its way from SerialCommunicator to the encoder of DatabaseManager.
+struct DumpSlot
+{
+	DeviceHandle device;
+	temperature_readings_header header;
+	// estimated offset of the node clock at the start of the dump and its drift, sample
+	// times are corrected by them
+	double clock_offset_seconds;
+	double clock_drift;
+	// header.number_of_readings readings of header.reading_bytes each in the format announced
+	// by the header, SerialCommunicator only queues formats ReadingDecoder supports
+	unsigned char readings[MAX_NUMBER_OF_READINGS * MAX_READING_BYTES];
+};
+
+Q_DECLARE_METATYPE(std::chrono::system_clock::time_point);
+Q_DECLARE_METATYPE(std::vector<ScheduledCollection> *);
+
+// Encodes readings and events as InfluxDB JSON and writes them to the database.
+// The manager may be moved to a worker thread of its own. Its slots are then reached through
+// queued connections and every network access happens in that thread, only
+// FetchCollectionStartTimes, ScheduledTimeToDatabase and RendezvousPlanned may also be called
+// directly from any other thread.
 class DatabaseManager : public QObject
 {
 	Q_OBJECT
 public:
+	// Longest time a node may collect before its rendezvous (MAX_NUMBER_OF_READINGS at the
+	// longest sampling interval) plus margin.
+	static const int collection_lookback_hours = 52;
+	// Dumps that may wait for the encoder before the receiving side has to wait, their
+	// slots of about 1.9 KB each are allocated on the heap by the ring.
+	static const std::size_t dump_ring_capacity = 16;
+
 	DatabaseManager (
 			const std::string & database_name,
 			const std::string & db_user,
@@ -51,7 +106,8 @@ public:
 			const std::string & db_query_path,
 			const std::string & db_write_path,
 			const int db_port,
-			const MACDeviceParser & parser) : 
+			const MACDeviceParser & parser,
+			SessionStatistics * statistics_ptr) : 
 		db_name_(database_name),
 		db_user_(db_user),
 		db_password_(db_password),
@@ -60,75 +116,195 @@ public:
 		db_write_path_(db_write_path),
 		db_port_(db_port),
 		parser_(parser),
-		open_network_replies_(0)
+		statistics_ptr_(statistics_ptr),
+		open_network_replies_(0),
+		writes_in_flight_(0),
+		dump_ring_full_waits_(0),
+		hot_window_ptr_(nullptr),
+		live_feed_ptr_(nullptr),
+		missing_dump_timer_(this)
 	{
+		for (auto & counter : alerts_raised_)
+			counter.store(0);
+
+		qRegisterMetaType<std::chrono::system_clock::time_point>();
+		qRegisterMetaType<std::vector<ScheduledCollection> *>();
+		qRegisterMetaType<DeviceHandle>("DeviceHandle");
+		qRegisterMetaType<uint32_t>("uint32_t");
+		connect(this, SIGNAL(DumpsQueued()), this, SLOT(EncodeQueuedDumps()),
+				Qt::QueuedConnection);
+		connect(&missing_dump_timer_, SIGNAL(timeout()), this, SLOT(CheckMissingDumps()));
 	}
 
-public slots:
+	// Creates the network access manager in the thread of the manager, call after moving
+	// the manager. If qapp is given it quits once all pending replies have finished, pass
+	// nullptr for long running processes.
 	void Init(const QCoreApplication * qapp);
 
-	void PushValuesToDatabase(const QString device_id, 
-			std::shared_ptr<temperature_readings_header> temperature_readings_header,
-			std::shared_ptr<std::vector<temperature_reading>> collected_data);
+	// Deletes the network access manager in the thread of the manager, call before that
+	// thread is stopped.
+	void Shutdown();
+
+	// Returns once every request queued to the manager before the call was handed to the
+	// network, afterwards open_network_replies() covers them.
+	void WaitForQueuedRequests();
 
+	// Fetch the latest collection start time and sampling interval of every device that
+	// was scheduled within the last collection_lookback_hours, sorted by start time.
+	// Device ids that are no MAC address are skipped. Blocks until the reply arrived, the
+	// query runs in the thread of the manager.
+	std::vector<ScheduledCollection>
+		FetchCollectionStartTimes(const std::chrono::system_clock::time_point time_point);
+
+	// Producer side of the dump ring, only a single thread may receive dumps.
+	// Returns a free slot to receive a dump into. If the ring is full it waits up to
+	// timeout_ms for the encoder and returns nullptr if no slot became free. Calls return
+	// the same slot until it is committed.
+	DumpSlot * AcquireDumpSlot(const int timeout_ms);
+
+	// Hands the filled slot returned by AcquireDumpSlot to the encoder.
+	void CommitDumpSlot();
+
+public slots:
 	// Handle test output of timestamp and temperatures
-	void HandleTestData(const QString device_id,
+	void HandleTestData(const DeviceHandle device,
 			std::shared_ptr<timestamp> device_time, 
 			std::shared_ptr<temperature_reading> temperatures);
 
-	// Fetch all collection start times after given query_timestamp
-	const std::vector< std::pair<std::string, std::chrono::system_clock::time_point> >
-		FetchCollectionStartTimes(const std::chrono::system_clock::time_point time_point);
-
-	void ScheduledTimeToDatabase(const QString device_id, 
-			const std::chrono::system_clock::time_point time_point);
+	// Stores a scheduled collection start, the sampling interval is kept as its value.
+	// Called from another thread the write is queued to the thread of the manager.
+	void ScheduledTimeToDatabase(const DeviceHandle device, 
+			const std::chrono::system_clock::time_point time_point,
+			const uint32_t interval_length_seconds);
 
 	// Pushes an error event to database.
-	void PushErrorEvent(const QString device_id, 
+	void PushErrorEvent(const DeviceHandle device, 
 			const std::chrono::system_clock::time_point time_point,
 			const int error_value);
 
 	// Pushes event to database in case a node requested to be initialized.
-	void PushInitEvent(const QString device_id, 
+	void PushInitEvent(const DeviceHandle device, 
 			const std::chrono::system_clock::time_point time_point);
 
 	// Pushes event to database in case a node dumped data.
-	void PushRendezvousEvent(const QString device_id,
+	void PushRendezvousEvent(const DeviceHandle device,
 			const std::chrono::system_clock::time_point time_point);
 
 	// Pushes event to database in case a node requested to be initialized.
-	void PushTimeRequestEvent(const QString device_id, 
+	void PushTimeRequestEvent(const DeviceHandle device, 
 			const std::chrono::system_clock::time_point time_point);
 
 	void PostReplyFinishedSlot(QNetworkReply * reply);
 	void ReplyFinishedSlot();
 	void ErrorReplySlot(QNetworkReply::NetworkError error_code);
+
+private slots:
+	void CreateNetworkAccessManager();
+	void DeleteNetworkAccessManager();
+	// Processed after all requests queued before, see WaitForQueuedRequests.
+	void QueuedRequestsBarrier() {}
+	void QueryCollectionStartTimes(const std::chrono::system_clock::time_point time_point,
+			std::vector<ScheduledCollection> * result);
+	// Encodes and writes every dump waiting in the ring.
+	void EncodeQueuedDumps();
+	// Raises alerts for nodes whose next dump is overdue.
+	void CheckMissingDumps();
+
 signals:
 	void AllFinished();
+	// Emitted when a dump was committed to an empty ring.
+	void DumpsQueued();
 
 public:
+	// Replies the manager still waits for, readable from any thread.
 	int open_network_replies() {return open_network_replies_;};
+	// Number of database writes waiting for their reply, readable from any thread.
+	const std::atomic<int64_t> & writes_in_flight() const {return writes_in_flight_;}
+	// Number of dumps waiting for the encoder, readable from any thread.
+	const std::atomic<int64_t> & queued_dumps() const {return dump_ring_.occupancy();}
+	// Number of dumps that found the ring full and had to wait, readable from any thread.
+	const std::atomic<uint64_t> & dump_ring_full_waits() const {return dump_ring_full_waits_;}
+	// Number of alerts of type raised so far, readable from any thread.
+	const std::atomic<uint64_t> & alerts_raised(const AnomalyDetector::AlertType type) const
+	{
+		return alerts_raised_[type];
+	}
+
+	// mutators
+	// Program started with device id, alert type, sensor id, value and unix time of every
+	// alert, e.g. a script sending a mail. Set it before the manager is moved.
+	void set_alert_command(const QString & alert_command) {alert_command_ = alert_command;}
+
+	// Keeps every encoded reading in hot_window_ptr as well. Set it before the manager is moved.
+	void SetHotWindow(HotWindow * hot_window_ptr) {hot_window_ptr_ = hot_window_ptr;}
+
+	// Publishes every encoded reading to live_feed_ptr. Set it before the manager is moved.
+	void SetLiveFeed(LiveFeed * live_feed_ptr) {live_feed_ptr_ = live_feed_ptr;}
+
+	// The scheduler planned the next wake of device, its next dump is missing if it did not
+	// arrive by then. May be called from any thread.
+	void RendezvousPlanned(const DeviceHandle device,
+			const std::chrono::system_clock::time_point expected_wake)
+	{anomaly_detector_.WakePlanned(device, expected_wake);}
+
 	// Definitions for time conversion from BCD of DS3231 RTC style into RFC3339 style
 	static void TimeConvertToDeviceTime(const std::chrono::system_clock::time_point &time_point,
 			timestamp *timestamp_struct);
 	static void TimeConvertToHostTime(const timestamp &timestamp_struct, 
 			std::chrono::system_clock::time_point * system_time);
+	// Unix time of reading number reading of a dump started at start_time by the node clock,
+	// which ran off by clock_offset_seconds at the start and drifted by clock_drift seconds per
+	// second since. Live ingest and replays of the archive share it to agree on every point.
+	static qint64 SampleUnixSeconds(const std::chrono::system_clock::time_point & start_time,
+			const uint32_t interval_length_seconds, const unsigned int reading,
+			const double clock_offset_seconds, const double clock_drift);
 	static void TemperatureReadingToValues(const temperature_reading & temperatures,
 			std::tuple<double, double, double, double> *converted_values);
+	// Converts a raw LM35 value of an ADC with adc_bits against the 1.1V reference.
+	static double RawToCelsius(const unsigned int raw_value, const unsigned int adc_bits);
+	// Value of the sensor_key tag of sensor 0, 1, ... of a reading.
+	static QString SensorIdValue(const unsigned int sensor);
+
+	// Temperature writes are rendered directly instead of through a QJsonDocument, the manager
+	// and tools writing the same series share it. A write is its TemperatureWritePrefix, the
+	// points appended by AppendTemperaturePoint and EndTemperatureWrite.
+	// Write into database up to its first point, tags are added to every point if not empty.
+	static QByteArray TemperatureWritePrefix(const QString & database, const QJsonObject & tags);
+	// Point with tags rendered up to its time, rendered once per sensor and reused.
+	static QByteArray TemperaturePointPrefix(const QJsonObject & tags);
+	static void AppendTemperaturePoint(QByteArray * write, const QByteArray & point_prefix,
+			const qint64 unix_seconds, const double celsius);
+	static void EndTemperatureWrite(QByteArray * write) { write->append("]}"); }
 
 protected:
+	// Writes every reading of dump as one point per sensor.
+	void PushValuesToDatabase(const DumpSlot & dump);
+
+	// Writes the energy telemetry of dump as one point of energy_series at time.
+	void PushEnergyToDatabase(const DumpSlot & dump,
+			const std::chrono::system_clock::time_point & time_point);
+
+	// Counts, logs and writes every alert to alert_events and hands it to the alert command.
+	void PushAlerts(const std::vector<AnomalyDetector::Alert> & alerts);
+
 	QJsonDocument CreateDatabaseEventJson(
-			const QString & device_id, 
+			const DeviceHandle device, 
 			const QString & series_name,
 			const QString & event_type,
 			const int value,
 			const std::chrono::system_clock::time_point & time_point);
 
-	void JsonToDatabase(const QJsonDocument & json_doc);
+	// Posts json_doc asynchronously, the duration until the reply arrives is recorded
+	// in node_statistics.
+	void JsonToDatabase(const QJsonDocument & json_doc,
+			NodeSessionStatistics * node_statistics);
+	// Posts an already rendered JSON write like JsonToDatabase.
+	void BodyToDatabase(const QByteArray & body, NodeSessionStatistics * node_statistics);
 
-	void JsonToDatabaseNAM(const QJsonDocument & json_doc);
-protected:
-	// JSON static definitions
+	// Returns true if the caller runs in the thread of the manager.
+	bool InManagerThread() const;
+public:
+	// JSON static definitions, shared with tools writing the same series
 	static const char *database_key;
 	static const char *retention_policy_key;
 	static const char *retention_policy_value;
@@ -145,10 +321,6 @@ protected:
 	static const char *precision_key;
 	static const char *precision_value;
 	static const char *sensor_key;
-	static const char *sensor_id_1_value;
-	static const char *sensor_id_2_value;
-	static const char *sensor_id_3_value;
-	static const char *sensor_id_4_value;
 	static const char *type_key;
 	static const char *type_collection_start;
 	static const char *collection_events;
@@ -158,7 +330,15 @@ protected:
 	static const char *type_event_init; 
 	static const char *type_event_rendezvous; 
 	static const char *type_event_time; 
+	static const char *energy_series;
+	static const char *collect_awake_ms_key;
+	static const char *transfer_awake_ms_key;
+	static const char *master_wait_seconds_key;
+	static const char *wake_ups_key;
+	static const char *supply_volts_key;
+	static const char *alert_events;
 
+protected:
 	// Time conversion definitions
 	// seconds
 	static const unsigned char MASK_DECIMAL_1_SEC = 0x0f;
@@ -197,8 +377,54 @@ private:
 	const std::string db_write_path_;
 	const int db_port_;
 	const MACDeviceParser & parser_;
-	int open_network_replies_;
+	SessionStatistics * statistics_ptr_;
+	std::atomic<int> open_network_replies_;
+	std::atomic<int64_t> writes_in_flight_;
+	std::atomic<uint64_t> dump_ring_full_waits_;
 	std::unique_ptr<QNetworkAccessManager> nam_;
+	SpscRing<DumpSlot, dump_ring_capacity> dump_ring_;
+
+	// Database writes waiting for their reply.
+	struct PendingWrite {
+		std::chrono::steady_clock::time_point start;
+		NodeSessionStatistics * node_statistics;
+	};
+	std::unordered_map<QNetworkReply *, PendingWrite> pending_writes_;
+
+	// Tags of a device built once from the registry snapshot they belong to.
+	struct DeviceTags {
+		std::shared_ptr<const DeviceRegistry> registry;
+		QString device_id;
+		// device_id and device_tag of the temperature points
+		QJsonObject tags;
+		// a temperature write of the device rendered up to its first point
+		QByteArray write_prefix;
+	};
+
+	// Returns the tags of device, they are rebuilt only after the device mapping changed.
+	// The reference stays valid for the lifetime of the manager.
+	const DeviceTags & TagsOf(const DeviceHandle device);
+
+	// indexed by DeviceHandle, only used in the thread of the manager. Growing a deque at its
+	// end keeps the entries in place, references of earlier TagsOf calls survive new devices.
+	std::deque<DeviceTags> device_tags_;
+	// the temperature write of a dump, reused by every dump
+	QByteArray write_body_;
+	// a temperature point of each sensor rendered up to its time
+	QByteArray point_prefixes_[MAX_SENSOR_COUNT];
+
+	// nullptr if readings are not kept in memory
+	HotWindow * hot_window_ptr_;
+	// nullptr if readings are not published to local readers
+	LiveFeed * live_feed_ptr_;
+
+	// every decoded reading passes the detector, only used in the thread of the manager
+	AnomalyDetector anomaly_detector_;
+	std::vector<AnomalyDetector::Alert> alerts_;
+	std::atomic<uint64_t> alerts_raised_[AnomalyDetector::NUMBER_OF_ALERT_TYPES];
+	QString alert_command_;
+	QTimer missing_dump_timer_;
+	static const int missing_dump_check_interval_ms = 60 * 1000;
 };
 
 
@@ -0,0 +1,99 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "device_registry.h"
+
+
+void DeviceRegistry::Insert(Device device)
+{
+	if(2 * (number_of_slots_used_ + 1) > slots_.size())
+		Grow();
+
+	const std::size_t mask = slots_.size() - 1;
+	for (std::size_t slot = Hash(device.mac) & mask; ; slot = (slot + 1) & mask) {
+		if(!slots_[slot])
+		{
+			devices_.push_back(std::move(device));
+			slots_[slot] = static_cast<uint32_t>(devices_.size());
+			++number_of_slots_used_;
+			return;
+		}
+		if(devices_[slots_[slot] - 1].mac == device.mac)
+		{
+			devices_[slots_[slot] - 1] = std::move(device);
+			return;
+		}
+	}
+}
+
+const DeviceRegistry::Device * DeviceRegistry::Find(const uint64_t mac) const
+{
+	if(slots_.empty())
+		return nullptr;
+
+	const std::size_t mask = slots_.size() - 1;
+	for (std::size_t slot = Hash(mac) & mask; slots_[slot]; slot = (slot + 1) & mask) {
+		const Device & device = devices_[slots_[slot] - 1];
+		if(device.mac == mac)
+			return &device;
+	}
+	return nullptr;
+}
+
+void DeviceRegistry::Clear()
+{
+	devices_.clear();
+	slots_.clear();
+	number_of_slots_used_ = 0;
+}
+
+uint64_t DeviceRegistry::Hash(const uint64_t mac)
+{
+	// finalizer of MurmurHash3, vendor prefixes of a fleet are mostly equal
+	uint64_t hash = mac;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+void DeviceRegistry::Grow()
+{
+	static const std::size_t MINIMUM_SLOTS = 16;
+	const std::size_t number_of_slots = slots_.empty() ? MINIMUM_SLOTS : 2 * slots_.size();
+
+	slots_.assign(number_of_slots, 0);
+	const std::size_t mask = number_of_slots - 1;
+	for (std::size_t i = 0; i < devices_.size(); ++i) {
+		std::size_t slot = Hash(devices_[i].mac) & mask;
+		while(slots_[slot])
+			slot = (slot + 1) & mask;
+		slots_[slot] = static_cast<uint32_t>(i + 1);
+	}
+}
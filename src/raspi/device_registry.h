@@ -0,0 +1,117 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef DEVICE_REGISTRY_H_Q6XJ1EWB
+#define DEVICE_REGISTRY_H_Q6XJ1EWB
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Parses a MAC address of the form xx:xx:xx:xx:xx:xx (either case) into the lower 48 bits of
+// mac. Works on char as well as on UTF-16 data (QString::utf16()) without allocating. Returns
+// false if text of the given length is no MAC address.
+template<typename Char>
+bool ParseMACAddress(const Char * text, const std::size_t length, uint64_t * mac)
+{
+	static const std::size_t MAC_ADDRESS_LENGTH = 17;
+	if(length != MAC_ADDRESS_LENGTH)
+		return false;
+
+	uint64_t result = 0;
+	for (std::size_t i = 0; i < MAC_ADDRESS_LENGTH; ++i) {
+		const unsigned int character = static_cast<unsigned int>(text[i]);
+		if(i % 3 == 2)
+		{
+			if(character != ':')
+				return false;
+			continue;
+		}
+
+		unsigned int nibble;
+		if(character >= '0' && character <= '9')
+			nibble = character - '0';
+		else if(character >= 'a' && character <= 'f')
+			nibble = character - 'a' + 10;
+		else if(character >= 'A' && character <= 'F')
+			nibble = character - 'A' + 10;
+		else
+			return false;
+		result = (result << 4) | nibble;
+	}
+
+	*mac = result;
+	return true;
+}
+
+// Known nodes keyed by their 48 bit MAC address.
+// The devices are kept densely in insertion order, an open addressing table with linear
+// probing maps the MAC to their position. Lookups hash the integer key only and never
+// allocate, the table is kept at most half full.
+class DeviceRegistry
+{
+public:
+	struct Device
+	{
+		uint64_t mac;
+		// MAC address as written in the mapping file
+		std::string device_id;
+		std::string label;
+		std::string file_path;
+	};
+
+	DeviceRegistry () : number_of_slots_used_(0) {}
+	~DeviceRegistry () {}
+
+	// Adds device, an existing entry with the same MAC is replaced.
+	void Insert(Device device);
+
+	// Returns the device with the given MAC or nullptr if it is unknown.
+	const Device * Find(const uint64_t mac) const;
+
+	template<typename Char>
+	const Device * Find(const Char * text, const std::size_t length) const
+	{
+		uint64_t mac;
+		return ParseMACAddress(text, length, &mac) ? Find(mac) : nullptr;
+	}
+
+	void Clear();
+
+	// access functions
+	const std::vector<Device> & devices() const { return devices_; }
+	std::size_t size() const { return devices_.size(); }
+
+private:
+	static uint64_t Hash(const uint64_t mac);
+	void Grow();
+
+	std::vector<Device> devices_;
+	// index into devices_ plus one, 0 marks an empty slot
+	std::vector<uint32_t> slots_;
+	std::size_t number_of_slots_used_;
+};
+
+
+#endif /* end of include guard: DEVICE_REGISTRY_H_Q6XJ1EWB */
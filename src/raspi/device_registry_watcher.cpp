@@ -0,0 +1,101 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <QFileInfo>
+#include <QString>
+#include <QStringList>
+
+#include "device_registry.h"
+#include "device_registry_watcher.h"
+#include "MAC_device_parser.h"
+
+
+DeviceRegistryWatcher::DeviceRegistryWatcher(MACDeviceParser * parser_ptr, QObject * parent) :
+	QObject(parent),
+	parser_ptr_(parser_ptr)
+{
+	reload_timer_.setSingleShot(true);
+	reload_timer_.setInterval(reload_delay_ms_);
+
+	connect(&file_watcher_, SIGNAL(fileChanged(QString)), this, SLOT(PathChanged()));
+	connect(&file_watcher_, SIGNAL(directoryChanged(QString)), this, SLOT(PathChanged()));
+	connect(&reload_timer_, SIGNAL(timeout()), this, SLOT(Reload()));
+}
+
+void DeviceRegistryWatcher::Start()
+{
+	const QFileInfo file_info(QString::fromStdString(parser_ptr_->filename()));
+
+	// the directory tells about files that are replaced instead of written
+	file_watcher_.addPath(file_info.absolutePath());
+	if(file_info.exists())
+		file_watcher_.addPath(file_info.absoluteFilePath());
+}
+
+void DeviceRegistryWatcher::PathChanged()
+{
+	reload_timer_.start();
+}
+
+void DeviceRegistryWatcher::Reload()
+{
+	// a replaced file is no longer watched
+	const QFileInfo file_info(QString::fromStdString(parser_ptr_->filename()));
+	if(file_info.exists() && !file_watcher_.files().contains(file_info.absoluteFilePath()))
+		file_watcher_.addPath(file_info.absoluteFilePath());
+
+	// only the lines that changed are parsed, and only their devices compared
+	std::vector<uint64_t> changed_macs;
+	const std::shared_ptr<const DeviceRegistry> old_registry = parser_ptr_->registry();
+	parser_ptr_->ReparseForDevices(&changed_macs);
+	const std::shared_ptr<const DeviceRegistry> new_registry = parser_ptr_->registry();
+	if(new_registry == old_registry)
+		return;
+
+	std::sort(changed_macs.begin(), changed_macs.end());
+	changed_macs.erase(std::unique(changed_macs.begin(), changed_macs.end()), changed_macs.end());
+
+	QStringList added_devices;
+	QStringList removed_devices;
+	for (const uint64_t mac : changed_macs) {
+		const DeviceRegistry::Device * const old_device = old_registry->Find(mac);
+		const DeviceRegistry::Device * const device = new_registry->Find(mac);
+		if(device && (!old_device || old_device->label != device->label ||
+					old_device->file_path != device->file_path))
+			added_devices.append(QString::fromStdString(device->device_id));
+		else if(!device && old_device)
+			removed_devices.append(QString::fromStdString(old_device->device_id));
+	}
+
+	if(added_devices.isEmpty() && removed_devices.isEmpty())
+		return;
+
+	std::cout << "device mapping reloaded: " << added_devices.size() << " new or changed, " <<
+		removed_devices.size() << " removed devices" << std::endl;
+	emit DevicesChanged(added_devices, removed_devices);
+}
@@ -0,0 +1,69 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef DEVICE_REGISTRY_WATCHER_H_B3ZK8TOU
+#define DEVICE_REGISTRY_WATCHER_H_B3ZK8TOU
+
+#include <QFileSystemWatcher>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+#include "MAC_device_parser.h"
+
+// Watches the device mapping file of a MACDeviceParser (inotify on Linux) and reparses the
+// lines that changed whenever it does. The new registry is swapped in by the parser, so
+// sessions holding the previous snapshot continue undisturbed.
+// Example usage:
+// 	DeviceRegistryWatcher watcher(&parser);
+// 	connect(&watcher, SIGNAL(DevicesChanged(QStringList, QStringList)), ...);
+// 	watcher.Start();
+class DeviceRegistryWatcher : public QObject
+{
+	Q_OBJECT
+public:
+	explicit DeviceRegistryWatcher (MACDeviceParser * parser_ptr, QObject * parent = nullptr);
+	~DeviceRegistryWatcher () {}
+
+	// Starts watching the file of the parser and its directory.
+	void Start();
+
+signals:
+	// Devices that are new or got another label or path, and devices that are gone.
+	void DevicesChanged(const QStringList & added_devices, const QStringList & removed_devices);
+
+private slots:
+	void PathChanged();
+	void Reload();
+
+private:
+	// editors write several times in a row or replace the file
+	static const int reload_delay_ms_ = 500;
+
+	MACDeviceParser *parser_ptr_;
+	QFileSystemWatcher file_watcher_;
+	QTimer reload_timer_;
+};
+
+
+#endif /* end of include guard: DEVICE_REGISTRY_WATCHER_H_B3ZK8TOU */
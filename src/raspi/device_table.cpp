@@ -0,0 +1,66 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "device_table.h"
+
+
+DeviceHandle DeviceTable::Intern(const uint64_t mac, const std::string & device_id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto known = handles_.find(mac);
+	if(known != handles_.end())
+		return known->second;
+
+	std::string key(device_id);
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	const DeviceHandle handle = static_cast<DeviceHandle>(entries_.size());
+	entries_.push_back(Entry{mac, device_id, std::move(key)});
+	handles_.emplace(mac, handle);
+	return handle;
+}
+
+DeviceHandle DeviceTable::Find(const uint64_t mac) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto known = handles_.find(mac);
+	return known != handles_.end() ? known->second : INVALID_DEVICE_HANDLE;
+}
+
+const DeviceTable::Entry & DeviceTable::entry(const DeviceHandle handle) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return entries_[handle];
+}
+
+std::size_t DeviceTable::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return entries_.size();
+}
@@ -0,0 +1,103 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef DEVICE_TABLE_H_C3XN8RVB
+#define DEVICE_TABLE_H_C3XN8RVB
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "device_registry.h"
+
+// Compact id of an interned device, the index of its entry in the DeviceTable.
+typedef uint32_t DeviceHandle;
+static const DeviceHandle INVALID_DEVICE_HANDLE = UINT32_MAX;
+
+// Interns every node once by its MAC address into a DeviceHandle. The pipeline passes the
+// handle instead of the device id string and keeps per device state (statistics, slots,
+// rendezvous plans, database tags) indexed by it.
+// Entries are only appended and never change, a handle and a reference to its entry stay
+// valid for the lifetime of the table and may be used from any thread.
+class DeviceTable
+{
+public:
+	struct Entry
+	{
+		uint64_t mac;
+		// device id as given when the device was interned first
+		std::string device_id;
+		// lower case device id, used as metrics label
+		std::string key;
+	};
+
+	DeviceTable () {}
+	~DeviceTable () {}
+
+	DeviceTable (const DeviceTable &) = delete;
+	DeviceTable & operator=(const DeviceTable &) = delete;
+
+	// Returns the handle of mac, device_id is only used if mac is seen for the first time.
+	DeviceHandle Intern(const uint64_t mac, const std::string & device_id);
+
+	// Interns a MAC address given as char or UTF-16 data (QString::utf16()). Returns
+	// INVALID_DEVICE_HANDLE if text is no MAC address. Known devices are found without
+	// allocating.
+	template<typename Char>
+	DeviceHandle Intern(const Char * text, const std::size_t length)
+	{
+		uint64_t mac;
+		if(!ParseMACAddress(text, length, &mac))
+			return INVALID_DEVICE_HANDLE;
+
+		const DeviceHandle handle = Find(mac);
+		if(handle != INVALID_DEVICE_HANDLE)
+			return handle;
+
+		std::string device_id;
+		device_id.reserve(length);
+		for (std::size_t i = 0; i < length; ++i)
+			device_id.push_back(static_cast<char>(text[i]));
+		return Intern(mac, device_id);
+	}
+
+	// Returns the handle of mac or INVALID_DEVICE_HANDLE if it was never interned.
+	DeviceHandle Find(const uint64_t mac) const;
+
+	// access functions
+	// Entry of a valid handle.
+	const Entry & entry(const DeviceHandle handle) const;
+	std::size_t size() const;
+
+private:
+	mutable std::mutex mutex_;
+	// a deque keeps references to its elements valid while appending
+	std::deque<Entry> entries_;
+	std::unordered_map<uint64_t, DeviceHandle> handles_;
+};
+
+
+#endif /* end of include guard: DEVICE_TABLE_H_C3XN8RVB */
@@ -0,0 +1,342 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "device_table.h"
+#include "dump_archive.h"
+#include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+
+static const char segment_prefix[] = "segment-";
+static const char segment_extension[] = ".dump";
+static const char index_extension[] = ".idx";
+
+static uint32_t Align(const uint32_t bytes)
+{
+	return (bytes + DUMP_ARCHIVE_ALIGNMENT - 1) / DUMP_ARCHIVE_ALIGNMENT * DUMP_ARCHIVE_ALIGNMENT;
+}
+
+// Decodes the record starting at offset of a segment with size bytes into record and returns
+// its size. Returns 0 if no complete record starts there.
+static uint32_t DecodeRecord(const char * data, const uint64_t size, const uint64_t offset,
+		DumpArchiveReader::Record * record)
+{
+	if(offset % DUMP_ARCHIVE_ALIGNMENT || offset + sizeof(dump_archive_record) > size)
+		return 0;
+
+	const dump_archive_record * const archived =
+		reinterpret_cast<const dump_archive_record *>(data + offset);
+	if(archived->magic != DUMP_ARCHIVE_MAGIC ||
+			archived->record_bytes % DUMP_ARCHIVE_ALIGNMENT ||
+			archived->record_bytes > size - offset ||
+			archived->record_bytes < sizeof(dump_archive_record))
+		return 0;
+
+	// the dump as received follows the record, a longer header is of a later protocol that
+	// only appended fields
+	const DumpView dump(reinterpret_cast<const unsigned char *>(archived + 1),
+			archived->record_bytes - sizeof(dump_archive_record), archived->wire_header_bytes);
+	if(!dump.complete())
+		return 0;
+
+	record->device_mac = archived->device_mac;
+	record->receive_unix_ms = archived->receive_unix_ms;
+	record->header = dump.header().header();
+	record->readings = dump.readings();
+	record->clock_offset_seconds = archived->clock_offset_seconds;
+	record->clock_drift = archived->clock_drift;
+	return archived->record_bytes;
+}
+
+DumpArchive::~DumpArchive()
+{
+	Close();
+}
+
+bool DumpArchive::Open()
+{
+	if(mkdir(directory_.c_str(), 0755) && errno != EEXIST)
+	{
+		std::cout << "could not create dump archive " << directory_ << ": " <<
+			std::strerror(errno) << std::endl;
+		return false;
+	}
+
+	// never append to a segment of an earlier run, it may end with a cut off record
+	const std::vector<uint32_t> numbers = SegmentNumbers(directory_);
+	return OpenSegment(numbers.empty() ? 1 : numbers.back() + 1);
+}
+
+bool DumpArchive::Append(const DeviceHandle device,
+		const std::chrono::system_clock::time_point receive_time,
+		const unsigned char * header_bytes,
+		const unsigned char * readings,
+		const double clock_offset_seconds,
+		const double clock_drift)
+{
+	const HeaderView header(header_bytes);
+	if(header.number_of_readings() > MAX_NUMBER_OF_READINGS ||
+			header.reading_bytes() > MAX_READING_BYTES ||
+			(segment_fd_ < 0 && !OpenSegment(segment_number_ + 1)))
+	{
+		++append_failures_;
+		return false;
+	}
+
+	const uint32_t payload_bytes = header.number_of_readings() * header.reading_bytes();
+	const uint32_t unpadded_bytes = sizeof(dump_archive_record) + HEADER_WIRE_BYTES +
+		payload_bytes;
+	const uint32_t record_bytes = Align(unpadded_bytes);
+
+	if(segment_size_ && segment_size_ + record_bytes > segment_bytes_ &&
+			!OpenSegment(segment_number_ + 1))
+	{
+		++append_failures_;
+		return false;
+	}
+
+	dump_archive_record record;
+	std::memset(&record, 0, sizeof(record));
+	record.magic = DUMP_ARCHIVE_MAGIC;
+	record.record_bytes = record_bytes;
+	record.device_mac = device_table_ptr_->entry(device).mac;
+	record.receive_unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			receive_time.time_since_epoch()).count();
+	record.clock_offset_seconds = clock_offset_seconds;
+	record.clock_drift = clock_drift;
+	record.wire_header_bytes = HEADER_WIRE_BYTES;
+
+	static const char padding[DUMP_ARCHIVE_ALIGNMENT] = {0};
+	struct iovec parts[4];
+	parts[0].iov_base = &record;
+	parts[0].iov_len = sizeof(record);
+	parts[1].iov_base = const_cast<unsigned char *>(header_bytes);
+	parts[1].iov_len = HEADER_WIRE_BYTES;
+	parts[2].iov_base = const_cast<unsigned char *>(readings);
+	parts[2].iov_len = payload_bytes;
+	parts[3].iov_base = const_cast<char *>(padding);
+	parts[3].iov_len = record_bytes - unpadded_bytes;
+
+	dump_archive_index_entry index_entry;
+	index_entry.device_mac = record.device_mac;
+	index_entry.receive_unix_ms = record.receive_unix_ms;
+	index_entry.offset = segment_size_;
+	index_entry.record_bytes = record_bytes;
+	index_entry.number_of_readings = header.number_of_readings();
+
+	if(writev(segment_fd_, parts, 4) != static_cast<ssize_t>(record_bytes) ||
+			write(index_fd_, &index_entry, sizeof(index_entry)) !=
+			static_cast<ssize_t>(sizeof(index_entry)))
+	{
+		std::cout << "could not append to dump archive: " << std::strerror(errno) << std::endl;
+		// a partially written record ends its segment, the reader stops there
+		++append_failures_;
+		OpenSegment(segment_number_ + 1);
+		return false;
+	}
+
+	segment_size_ += record_bytes;
+	++records_appended_;
+	return true;
+}
+
+void DumpArchive::Close()
+{
+	if(segment_fd_ >= 0)
+	{
+		fdatasync(segment_fd_);
+		close(segment_fd_);
+		segment_fd_ = -1;
+	}
+	if(index_fd_ >= 0)
+	{
+		fdatasync(index_fd_);
+		close(index_fd_);
+		index_fd_ = -1;
+	}
+}
+
+bool DumpArchive::OpenSegment(const uint32_t number)
+{
+	Close();
+	// a failed segment is skipped by the next attempt
+	segment_number_ = number;
+	segment_size_ = 0;
+
+	const std::string segment_path = SegmentPath(directory_, number, segment_extension);
+	const std::string index_path = SegmentPath(directory_, number, index_extension);
+	segment_fd_ = open(segment_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+			0644);
+	if(segment_fd_ >= 0)
+		index_fd_ = open(index_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+				0644);
+	if(index_fd_ < 0)
+	{
+		std::cout << "could not create dump archive segment " << segment_path << ": " <<
+			std::strerror(errno) << std::endl;
+		Close();
+		return false;
+	}
+
+	std::cout << "dump archive segment " << segment_path << std::endl;
+	return true;
+}
+
+std::string DumpArchive::SegmentPath(const std::string & directory, const uint32_t number,
+		const char * extension)
+{
+	char file_name[32];
+	std::snprintf(file_name, sizeof(file_name), "%s%06u%s", segment_prefix, number, extension);
+	return directory + "/" + file_name;
+}
+
+std::vector<uint32_t> DumpArchive::SegmentNumbers(const std::string & directory)
+{
+	std::vector<uint32_t> numbers;
+	DIR * const dir = opendir(directory.c_str());
+	if(!dir)
+		return numbers;
+
+	const std::size_t prefix_length = sizeof(segment_prefix) - 1;
+	const std::size_t extension_length = sizeof(segment_extension) - 1;
+	while(const struct dirent * const entry = readdir(dir))
+	{
+		const std::string name(entry->d_name);
+		if(name.size() <= prefix_length + extension_length ||
+				name.compare(0, prefix_length, segment_prefix) ||
+				name.compare(name.size() - extension_length, extension_length, segment_extension))
+			continue;
+
+		const std::string digits = name.substr(prefix_length,
+				name.size() - prefix_length - extension_length);
+		if(digits.find_first_not_of("0123456789") == std::string::npos)
+			numbers.push_back(std::stoul(digits));
+	}
+	closedir(dir);
+
+	std::sort(numbers.begin(), numbers.end());
+	return numbers;
+}
+
+
+DumpArchiveReader::~DumpArchiveReader()
+{
+	for (const auto & mapping : mappings_)
+		munmap(mapping.first, mapping.second);
+}
+
+bool DumpArchiveReader::Open(const std::string & directory)
+{
+	DIR * const dir = opendir(directory.c_str());
+	if(!dir)
+	{
+		std::cout << "could not open dump archive " << directory << ": " <<
+			std::strerror(errno) << std::endl;
+		return false;
+	}
+	closedir(dir);
+
+	for (const uint32_t number : DumpArchive::SegmentNumbers(directory)) {
+		const std::string segment_path =
+			DumpArchive::SegmentPath(directory, number, segment_extension);
+		const int segment_fd = open(segment_path.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat segment_stat;
+		if(segment_fd < 0 || fstat(segment_fd, &segment_stat) || !segment_stat.st_size)
+		{
+			if(segment_fd >= 0)
+				close(segment_fd);
+			continue;
+		}
+
+		void * const data = mmap(nullptr, segment_stat.st_size, PROT_READ, MAP_SHARED,
+				segment_fd, 0);
+		close(segment_fd);
+		if(data == MAP_FAILED)
+		{
+			std::cout << "could not map " << segment_path << ": " << std::strerror(errno) <<
+				std::endl;
+			continue;
+		}
+		mappings_.push_back(std::make_pair(data, static_cast<std::size_t>(segment_stat.st_size)));
+
+		std::vector<dump_archive_index_entry> index_entries;
+		const std::string index_path =
+			DumpArchive::SegmentPath(directory, number, index_extension);
+		FILE * const index_file = std::fopen(index_path.c_str(), "rb");
+		if(index_file)
+		{
+			dump_archive_index_entry index_entry;
+			while(std::fread(&index_entry, sizeof(index_entry), 1, index_file) == 1)
+				index_entries.push_back(index_entry);
+			std::fclose(index_file);
+		}
+
+		AddSegment(static_cast<const char *>(data), segment_stat.st_size, index_entries);
+	}
+
+	std::sort(records_.begin(), records_.end(), [](const Record & a, const Record & b)
+			{
+				return a.device_mac != b.device_mac ? a.device_mac < b.device_mac :
+					a.receive_unix_ms < b.receive_unix_ms;
+			});
+	return true;
+}
+
+void DumpArchiveReader::AddSegment(const char * data, const uint64_t size,
+		const std::vector<dump_archive_index_entry> & index_entries)
+{
+	Record record;
+	uint64_t indexed_end = 0;
+	for (const auto & index_entry : index_entries) {
+		const uint32_t record_bytes = DecodeRecord(data, size, index_entry.offset, &record);
+		if(!record_bytes)
+			break;
+		records_.push_back(record);
+		indexed_end = index_entry.offset + record_bytes;
+	}
+
+	// records whose index entry was not written before the process ended
+	uint64_t offset = indexed_end;
+	while(const uint32_t record_bytes = DecodeRecord(data, size, offset, &record))
+	{
+		records_.push_back(record);
+		offset += record_bytes;
+	}
+}
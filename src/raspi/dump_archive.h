@@ -0,0 +1,191 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef DUMP_ARCHIVE_H_T6QW2MZD
+#define DUMP_ARCHIVE_H_T6QW2MZD
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "device_table.h"
+#include "../protocol_definitions/communication_structs.h"
+
+// On disk layout of the dump archive.
+//
+// The archive is a directory of segments, segment-NNNNNN.dump holds the records and
+// segment-NNNNNN.idx one dump_archive_index_entry per record. Both are only appended to, a new
+// segment is started when the current one reached its size limit and every time the archive
+// is opened. A record is the dump exactly as received from the node, prefixed by the device,
+// the receive time and the clock estimate and padded to DUMP_ARCHIVE_ALIGNMENT bytes:
+//
+// dump_archive_record | wire_header_bytes of header | readings | padding
+//
+// The header is kept in the wire format and decoded with the protocol codec. Integers
+// outside the wire header are stored in host byte order.
+
+static const uint32_t DUMP_ARCHIVE_MAGIC = 0x57445742; // "BWDW"
+static const uint32_t DUMP_ARCHIVE_ALIGNMENT = 8;
+
+struct dump_archive_record {
+	uint32_t magic;
+	// size of the whole record including readings and padding
+	uint32_t record_bytes;
+	uint64_t device_mac;
+	int64_t receive_unix_ms;
+	// offset and drift of the node clock applied to the readings when they were received
+	double clock_offset_seconds;
+	double clock_drift;
+	// size of the header as received
+	uint32_t wire_header_bytes;
+	uint32_t reserved;
+	// followed by the header and its readings in the format of the header
+};
+static_assert(sizeof(dump_archive_record) % DUMP_ARCHIVE_ALIGNMENT == 0,
+		"records have to keep the alignment of the next record");
+
+struct dump_archive_index_entry {
+	uint64_t device_mac;
+	int64_t receive_unix_ms;
+	// position of the record in its segment
+	uint64_t offset;
+	uint32_t record_bytes;
+	uint32_t number_of_readings;
+};
+
+// Appends every received dump to the archive. The archive is written by a single thread, the
+// one receiving the dumps. Appending is two write calls into the page cache, segments are
+// synced to disk when they are closed.
+class DumpArchive
+{
+public:
+	static const uint64_t DEFAULT_SEGMENT_BYTES = 64 * 1024 * 1024;
+
+	DumpArchive (const std::string & directory, const DeviceTable * device_table_ptr,
+			const uint64_t segment_bytes = DEFAULT_SEGMENT_BYTES) :
+		directory_(directory),
+		device_table_ptr_(device_table_ptr),
+		segment_bytes_(segment_bytes),
+		segment_number_(0),
+		segment_size_(0),
+		segment_fd_(-1),
+		index_fd_(-1),
+		records_appended_(0),
+		append_failures_(0)
+	{}
+	~DumpArchive ();
+
+	DumpArchive (const DumpArchive &) = delete;
+	DumpArchive & operator=(const DumpArchive &) = delete;
+
+	// Creates the directory if needed and starts a new segment after the existing ones.
+	// Returns false if the archive cannot be written.
+	bool Open();
+
+	// Appends a completely received dump of device, header_bytes are the HEADER_WIRE_BYTES of
+	// its header as received. The clock estimate is the one its readings were stored with.
+	// Returns false if it could not be written, a segment that failed is replaced by a new one
+	// with the next dump.
+	bool Append(const DeviceHandle device,
+			const std::chrono::system_clock::time_point receive_time,
+			const unsigned char * header_bytes,
+			const unsigned char * readings,
+			const double clock_offset_seconds,
+			const double clock_drift);
+
+	// Syncs and closes the current segment.
+	void Close();
+
+	// access functions
+	const std::string & directory() const { return directory_; }
+	uint64_t records_appended() const { return records_appended_; }
+	const std::atomic<uint64_t> & append_failures() const { return append_failures_; }
+
+	// Path of segment number in directory, extension is ".dump" or ".idx".
+	static std::string SegmentPath(const std::string & directory, const uint32_t number,
+			const char * extension);
+	// Numbers of all segments in directory in ascending order.
+	static std::vector<uint32_t> SegmentNumbers(const std::string & directory);
+
+private:
+	bool OpenSegment(const uint32_t number);
+
+	const std::string directory_;
+	const DeviceTable * device_table_ptr_;
+	const uint64_t segment_bytes_;
+	uint32_t segment_number_;
+	uint64_t segment_size_;
+	int segment_fd_;
+	int index_fd_;
+	uint64_t records_appended_;
+	std::atomic<uint64_t> append_failures_;
+};
+
+// Memory maps all segments of an archive for reprocessing. Records are sorted by device and
+// receive time and point directly into the mapped segments, they stay valid until the reader
+// is destroyed. A record that was cut off by a crash is skipped, records missing in the index
+// of a segment are recovered by scanning it.
+class DumpArchiveReader
+{
+public:
+	struct Record
+	{
+		uint64_t device_mac;
+		int64_t receive_unix_ms;
+		// decoded from the record
+		temperature_readings_header header;
+		// header.number_of_readings readings of header.reading_bytes each
+		const unsigned char * readings;
+		// clock estimate the readings were stored with when they were received
+		double clock_offset_seconds;
+		double clock_drift;
+	};
+
+	DumpArchiveReader () {}
+	~DumpArchiveReader ();
+
+	DumpArchiveReader (const DumpArchiveReader &) = delete;
+	DumpArchiveReader & operator=(const DumpArchiveReader &) = delete;
+
+	// Maps every segment of directory. Returns false if the directory cannot be read.
+	bool Open(const std::string & directory);
+
+	// access functions
+	// All records sorted by device and receive time.
+	const std::vector<Record> & records() const { return records_; }
+
+private:
+	// Adds the records of a mapped segment, index_entries may cover only a part of it.
+	void AddSegment(const char * data, const uint64_t size,
+			const std::vector<dump_archive_index_entry> & index_entries);
+
+	std::vector<std::pair<void *, std::size_t>> mappings_;
+	std::vector<Record> records_;
+};
+
+
+#endif /* end of include guard: DUMP_ARCHIVE_H_T6QW2MZD */
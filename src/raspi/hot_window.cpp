@@ -0,0 +1,204 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "device_table.h"
+#include "hot_window.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+
+void HotWindow::Add(const DeviceHandle device, const uint32_t unix_seconds,
+		const double * celsius, const unsigned int sensor_count)
+{
+	if(!max_readings_ || !sensor_count || sensor_count > MAX_SENSOR_COUNT)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(device >= windows_.size())
+		windows_.resize(device + 1);
+
+	std::unique_ptr<Window> & window = windows_[device];
+	if(!window || window->sensor_count != sensor_count)
+	{
+		window = std::unique_ptr<Window>(new Window{sensor_count, 0, 0,
+				std::vector<uint32_t>(max_readings_),
+				std::vector<int16_t>(max_readings_ * sensor_count)});
+	}
+
+	// a dump received twice is not added again
+	if(window->size && unix_seconds <= window->unix_seconds[Position(*window, window->size - 1)])
+		return;
+
+	// make room and drop readings that left the window
+	while(window->size && (window->size == max_readings_ ||
+				window->unix_seconds[window->oldest] + window_seconds_ < unix_seconds))
+	{
+		window->oldest = (window->oldest + 1) % max_readings_;
+		--window->size;
+	}
+
+	const std::size_t position = Position(*window, window->size);
+	window->unix_seconds[position] = unix_seconds;
+	for (unsigned int sensor = 0; sensor < sensor_count; ++sensor) {
+		const double centi_celsius = std::round(celsius[sensor] * 100.0);
+		window->centi_celsius[position * sensor_count + sensor] = static_cast<int16_t>(
+				std::max(double(INT16_MIN), std::min(double(INT16_MAX), centi_celsius)));
+	}
+	++window->size;
+}
+
+bool HotWindow::Latest(const DeviceHandle device, Readings * latest) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const Window * const window = Find(device);
+	if(!window)
+		return false;
+
+	const std::size_t position = Position(*window, window->size - 1);
+	latest->sensor_count = window->sensor_count;
+	latest->unix_seconds.assign(1, window->unix_seconds[position]);
+	latest->celsius.resize(window->sensor_count);
+	for (unsigned int sensor = 0; sensor < window->sensor_count; ++sensor)
+		latest->celsius[sensor] =
+			window->centi_celsius[position * window->sensor_count + sensor] / 100.0f;
+	return true;
+}
+
+bool HotWindow::Range(const DeviceHandle device, const uint32_t from, const uint32_t to,
+		Readings * readings) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const Window * const window = Find(device);
+	if(!window)
+		return false;
+
+	readings->sensor_count = window->sensor_count;
+	readings->unix_seconds.clear();
+	readings->celsius.clear();
+	for (std::size_t index = FirstAtOrAfter(*window, from); index < window->size; ++index) {
+		const std::size_t position = Position(*window, index);
+		if(window->unix_seconds[position] > to)
+			break;
+
+		readings->unix_seconds.push_back(window->unix_seconds[position]);
+		for (unsigned int sensor = 0; sensor < window->sensor_count; ++sensor)
+			readings->celsius.push_back(
+					window->centi_celsius[position * window->sensor_count + sensor] / 100.0f);
+	}
+	return true;
+}
+
+bool HotWindow::Downsample(const DeviceHandle device, const uint32_t from, const uint32_t to,
+		const uint32_t step, Buckets * buckets) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const Window * const window = Find(device);
+	if(!window || !step)
+		return false;
+
+	const unsigned int sensor_count = window->sensor_count;
+	buckets->sensor_count = sensor_count;
+	buckets->unix_seconds.clear();
+	buckets->counts.clear();
+	buckets->min_celsius.clear();
+	buckets->max_celsius.clear();
+	buckets->mean_celsius.clear();
+
+	// sums of the current bucket in hundredths of a degree
+	int64_t sums[MAX_SENSOR_COUNT];
+	for (std::size_t index = FirstAtOrAfter(*window, from); index < window->size; ++index) {
+		const std::size_t position = Position(*window, index);
+		const uint32_t unix_seconds = window->unix_seconds[position];
+		if(unix_seconds > to)
+			break;
+
+		const int16_t * const values = &window->centi_celsius[position * sensor_count];
+		const uint32_t bucket_start = unix_seconds - unix_seconds % step;
+		if(buckets->unix_seconds.empty() || buckets->unix_seconds.back() != bucket_start)
+		{
+			buckets->unix_seconds.push_back(bucket_start);
+			buckets->counts.push_back(0);
+			for (unsigned int sensor = 0; sensor < sensor_count; ++sensor) {
+				buckets->min_celsius.push_back(values[sensor] / 100.0f);
+				buckets->max_celsius.push_back(values[sensor] / 100.0f);
+				buckets->mean_celsius.push_back(0.0f);
+				sums[sensor] = 0;
+			}
+		}
+
+		// the values of the current bucket are the last sensor_count ones
+		const uint32_t count = ++buckets->counts.back();
+		const std::size_t first_value = buckets->mean_celsius.size() - sensor_count;
+		float * const min_celsius = &buckets->min_celsius[first_value];
+		float * const max_celsius = &buckets->max_celsius[first_value];
+		float * const mean_celsius = &buckets->mean_celsius[first_value];
+		for (unsigned int sensor = 0; sensor < sensor_count; ++sensor) {
+			const float celsius = values[sensor] / 100.0f;
+			min_celsius[sensor] = std::min(min_celsius[sensor], celsius);
+			max_celsius[sensor] = std::max(max_celsius[sensor], celsius);
+			sums[sensor] += values[sensor];
+			mean_celsius[sensor] = sums[sensor] / (100.0f * count);
+		}
+	}
+	return true;
+}
+
+std::vector<DeviceHandle> HotWindow::Devices() const
+{
+	std::vector<DeviceHandle> devices;
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (DeviceHandle device = 0; device < windows_.size(); ++device) {
+		if(windows_[device] && windows_[device]->size)
+			devices.push_back(device);
+	}
+	return devices;
+}
+
+std::size_t HotWindow::FirstAtOrAfter(const Window & window, const uint32_t unix_seconds) const
+{
+	// readings are sorted by time, search over their age order
+	std::size_t first = 0;
+	std::size_t last = window.size;
+	while(first < last)
+	{
+		const std::size_t middle = first + (last - first) / 2;
+		if(window.unix_seconds[Position(window, middle)] < unix_seconds)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+const HotWindow::Window * HotWindow::Find(const DeviceHandle device) const
+{
+	if(device >= windows_.size() || !windows_[device] || !windows_[device]->size)
+		return nullptr;
+	return windows_[device].get();
+}
@@ -0,0 +1,132 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef HOT_WINDOW_H_R5TN2GXA
+#define HOT_WINDOW_H_R5TN2GXA
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "device_table.h"
+
+// Keeps the most recent readings of every node in memory so current temperatures can be
+// served without asking the database.
+// Each device has a ring of at most max_readings readings that are not older than
+// window_seconds before its newest reading. A reading takes 4 bytes for its time and 2 bytes
+// per sensor (hundredths of a degree), the rings are allocated when a device delivers its
+// first reading. Readings are added while dumps are encoded and may be queried from any
+// other thread, every call holds the lock only for copying.
+class HotWindow
+{
+public:
+	// Readings copied out of the window, oldest first. celsius holds sensor_count values
+	// per entry of unix_seconds.
+	struct Readings
+	{
+		unsigned int sensor_count;
+		std::vector<uint32_t> unix_seconds;
+		std::vector<float> celsius;
+	};
+
+	// Minimum, maximum and mean of every sensor in every bucket of step seconds that holds
+	// readings. Buckets start at multiples of step, the per sensor vectors hold sensor_count
+	// values per bucket.
+	struct Buckets
+	{
+		unsigned int sensor_count;
+		std::vector<uint32_t> unix_seconds;
+		std::vector<uint32_t> counts;
+		std::vector<float> min_celsius;
+		std::vector<float> max_celsius;
+		std::vector<float> mean_celsius;
+	};
+
+	HotWindow (const uint32_t window_seconds, const std::size_t max_readings) :
+		window_seconds_(window_seconds),
+		max_readings_(max_readings)
+	{}
+	~HotWindow () {}
+
+	HotWindow (const HotWindow &) = delete;
+	HotWindow & operator=(const HotWindow &) = delete;
+
+	// Adds a reading of device. Readings of a device have to be added in time order, one that
+	// is not newer than the newest reading is dropped. A device that changes its number of
+	// sensors starts over.
+	void Add(const DeviceHandle device, const uint32_t unix_seconds, const double * celsius,
+			const unsigned int sensor_count);
+
+	// Copies the newest reading of device. Returns false if there is none.
+	bool Latest(const DeviceHandle device, Readings * latest) const;
+
+	// Copies the readings of device within [from, to]. Returns false for devices without
+	// readings.
+	bool Range(const DeviceHandle device, const uint32_t from, const uint32_t to,
+			Readings * readings) const;
+
+	// Aggregates the readings of device within [from, to] into buckets of step seconds.
+	// Returns false for devices without readings.
+	bool Downsample(const DeviceHandle device, const uint32_t from, const uint32_t to,
+			const uint32_t step, Buckets * buckets) const;
+
+	// Devices with readings in the window.
+	std::vector<DeviceHandle> Devices() const;
+
+	// access functions
+	uint32_t window_seconds() const { return window_seconds_; }
+
+private:
+	struct Window
+	{
+		unsigned int sensor_count;
+		// ring position of the oldest reading and number of readings
+		std::size_t oldest;
+		std::size_t size;
+		std::vector<uint32_t> unix_seconds;
+		std::vector<int16_t> centi_celsius;
+	};
+
+	// Ring position of the index-th oldest reading.
+	std::size_t Position(const Window & window, const std::size_t index) const
+	{
+		return (window.oldest + index) % max_readings_;
+	}
+
+	// Index of the oldest reading not older than unix_seconds, window.size if there is none.
+	std::size_t FirstAtOrAfter(const Window & window, const uint32_t unix_seconds) const;
+
+	// Window of device or nullptr, call with mutex_ held.
+	const Window * Find(const DeviceHandle device) const;
+
+	const uint32_t window_seconds_;
+	const std::size_t max_readings_;
+	mutable std::mutex mutex_;
+	// indexed by DeviceHandle, nullptr for devices without readings
+	std::vector<std::unique_ptr<Window>> windows_;
+};
+
+
+#endif /* end of include guard: HOT_WINDOW_H_R5TN2GXA */
@@ -0,0 +1,253 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstdint>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+
+#include "database_manager.h"
+#include "device_registry.h"
+#include "device_table.h"
+#include "hot_window.h"
+#include "hot_window_api.h"
+#include "local_http_server.h"
+
+
+void HotWindowApi::AddHandlers(LocalHttpServer * server)
+{
+	server->AddHandler("/api/latest", [this](const LocalHttpServer::Request & request,
+				LocalHttpServer::Response * response) { Latest(request, response); });
+	server->AddHandler("/api/range", [this](const LocalHttpServer::Request & request,
+				LocalHttpServer::Response * response) { Range(request, response); });
+	server->AddHandler("/api/downsample", [this](const LocalHttpServer::Request & request,
+				LocalHttpServer::Response * response) { Downsample(request, response); });
+}
+
+void HotWindowApi::Latest(const LocalHttpServer::Request & request,
+		LocalHttpServer::Response * response) const
+{
+	response->content_type = "application/json";
+
+	if(request.query.hasQueryItem("device"))
+	{
+		Selection selection;
+		if(!Select(request, 0, &selection, response))
+			return;
+
+		response->body.append('{');
+		AppendLatest(selection.device, &response->body);
+		response->body.append('}');
+		return;
+	}
+
+	response->body.append("{\"devices\":[");
+	const std::vector<DeviceHandle> devices = window_ptr_->Devices();
+	for (std::size_t i = 0; i < devices.size(); ++i) {
+		response->body.append(i ? ",{" : "{");
+		AppendLatest(devices[i], &response->body);
+		response->body.append('}');
+	}
+	response->body.append("]}");
+}
+
+void HotWindowApi::Range(const LocalHttpServer::Request & request,
+		LocalHttpServer::Response * response) const
+{
+	Selection selection;
+	HotWindow::Readings readings;
+	if(!Select(request, default_range_seconds, &selection, response) ||
+			!window_ptr_->Range(selection.device, selection.from, selection.to, &readings))
+		return;
+
+	QByteArray & body = response->body;
+	response->content_type = "application/json";
+	body.append("{\"device_id\":\"");
+	body.append(device_table_ptr_->entry(selection.device).device_id.c_str());
+	body.append("\",\"times\":");
+	AppendTimes(readings.unix_seconds, &body);
+	body.append(",\"sensors\":{");
+	for (unsigned int sensor = 0; sensor < readings.sensor_count; ++sensor) {
+		if(selection.sensor >= 0 && int(sensor) != selection.sensor)
+			continue;
+		if(body.endsWith(']'))
+			body.append(',');
+		body.append('"');
+		body.append(DatabaseManager::SensorIdValue(sensor).toUtf8());
+		body.append("\":");
+		AppendColumn(readings.celsius, readings.sensor_count, sensor, &body);
+	}
+	body.append("}}");
+}
+
+void HotWindowApi::Downsample(const LocalHttpServer::Request & request,
+		LocalHttpServer::Response * response) const
+{
+	bool valid_step = false;
+	const uint32_t step = request.query.queryItemValue("step").toUInt(&valid_step);
+	if(!valid_step || !step)
+	{
+		SetError(400, "step has to be a positive number of seconds", response);
+		return;
+	}
+
+	Selection selection;
+	HotWindow::Buckets buckets;
+	if(!Select(request, window_ptr_->window_seconds(), &selection, response) ||
+			!window_ptr_->Downsample(selection.device, selection.from, selection.to, step,
+				&buckets))
+		return;
+
+	QByteArray & body = response->body;
+	response->content_type = "application/json";
+	body.append("{\"device_id\":\"");
+	body.append(device_table_ptr_->entry(selection.device).device_id.c_str());
+	body.append("\",\"step\":");
+	body.append(QByteArray::number(step));
+	body.append(",\"times\":");
+	AppendTimes(buckets.unix_seconds, &body);
+	body.append(",\"counts\":");
+	AppendTimes(buckets.counts, &body);
+	body.append(",\"sensors\":{");
+	for (unsigned int sensor = 0; sensor < buckets.sensor_count; ++sensor) {
+		if(selection.sensor >= 0 && int(sensor) != selection.sensor)
+			continue;
+		if(body.endsWith('}'))
+			body.append(',');
+		body.append('"');
+		body.append(DatabaseManager::SensorIdValue(sensor).toUtf8());
+		body.append("\":{\"min\":");
+		AppendColumn(buckets.min_celsius, buckets.sensor_count, sensor, &body);
+		body.append(",\"max\":");
+		AppendColumn(buckets.max_celsius, buckets.sensor_count, sensor, &body);
+		body.append(",\"mean\":");
+		AppendColumn(buckets.mean_celsius, buckets.sensor_count, sensor, &body);
+		body.append('}');
+	}
+	body.append("}}");
+}
+
+bool HotWindowApi::Select(const LocalHttpServer::Request & request,
+		const uint32_t default_span_seconds, Selection * selection,
+		LocalHttpServer::Response * response) const
+{
+	const QString device_id = request.query.queryItemValue("device");
+	uint64_t mac;
+	if(!ParseMACAddress(device_id.utf16(), device_id.size(), &mac))
+	{
+		SetError(400, "device has to be a Bluetooth address", response);
+		return false;
+	}
+
+	// the newest reading bounds the default time range and tells the number of sensors
+	HotWindow::Readings latest;
+	selection->device = device_table_ptr_->Find(mac);
+	if(selection->device == INVALID_DEVICE_HANDLE ||
+			!window_ptr_->Latest(selection->device, &latest))
+	{
+		SetError(404, "no readings of device in the hot window", response);
+		return false;
+	}
+
+	bool valid_time = true;
+	selection->to = request.query.hasQueryItem("to") ?
+		request.query.queryItemValue("to").toUInt(&valid_time) : latest.unix_seconds[0];
+	const uint32_t default_from = selection->to > default_span_seconds ?
+		selection->to - default_span_seconds : 0;
+	if(valid_time)
+		selection->from = request.query.hasQueryItem("from") ?
+			request.query.queryItemValue("from").toUInt(&valid_time) : default_from;
+	if(!valid_time || selection->from > selection->to)
+	{
+		SetError(400, "from and to have to be unix seconds with from <= to", response);
+		return false;
+	}
+
+	selection->sensor = -1;
+	if(request.query.hasQueryItem("sensor"))
+	{
+		const QString sensor_id = request.query.queryItemValue("sensor");
+		for (unsigned int sensor = 0; sensor < latest.sensor_count; ++sensor) {
+			if(sensor_id == DatabaseManager::SensorIdValue(sensor))
+				selection->sensor = sensor;
+		}
+		if(selection->sensor < 0)
+		{
+			SetError(404, "device has no such sensor", response);
+			return false;
+		}
+	}
+	return true;
+}
+
+void HotWindowApi::AppendLatest(const DeviceHandle device, QByteArray * body) const
+{
+	body->append("\"device_id\":\"");
+	body->append(device_table_ptr_->entry(device).device_id.c_str());
+	body->append('"');
+	HotWindow::Readings latest;
+	if(!window_ptr_->Latest(device, &latest))
+		return;
+
+	body->append(",\"time\":");
+	body->append(QByteArray::number(latest.unix_seconds[0]));
+	body->append(",\"sensors\":{");
+	for (unsigned int sensor = 0; sensor < latest.sensor_count; ++sensor) {
+		body->append(sensor ? ",\"" : "\"");
+		body->append(DatabaseManager::SensorIdValue(sensor).toUtf8());
+		body->append("\":");
+		body->append(QByteArray::number(latest.celsius[sensor], 'f', 2));
+	}
+	body->append('}');
+}
+
+void HotWindowApi::AppendColumn(const std::vector<float> & values,
+		const unsigned int sensor_count, const unsigned int sensor, QByteArray * body)
+{
+	body->append('[');
+	for (std::size_t index = sensor; index < values.size(); index += sensor_count) {
+		if(index != sensor)
+			body->append(',');
+		body->append(QByteArray::number(values[index], 'f', 2));
+	}
+	body->append(']');
+}
+
+void HotWindowApi::AppendTimes(const std::vector<uint32_t> & unix_seconds, QByteArray * body)
+{
+	body->append('[');
+	for (std::size_t index = 0; index < unix_seconds.size(); ++index) {
+		if(index)
+			body->append(',');
+		body->append(QByteArray::number(unix_seconds[index]));
+	}
+	body->append(']');
+}
+
+void HotWindowApi::SetError(const int status, const char * message,
+		LocalHttpServer::Response * response)
+{
+	response->status = status;
+	response->content_type = "application/json";
+	response->body = QByteArray("{\"error\":\"") + message + "\"}";
+}
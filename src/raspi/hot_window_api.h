@@ -0,0 +1,96 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef HOT_WINDOW_API_H_B8PW4JZE
+#define HOT_WINDOW_API_H_B8PW4JZE
+
+#include <cstdint>
+#include <vector>
+
+#include <QByteArray>
+
+#include "device_table.h"
+#include "hot_window.h"
+#include "local_http_server.h"
+
+// Answers "what is the hive doing now" queries from a HotWindow, the database is never asked.
+// Devices are given by their Bluetooth address, sensors by their sensor_id tag and times as
+// unix seconds, all answers are JSON:
+// 	/api/latest[?device=..]						newest reading
+// 	/api/range?device=..[&sensor=..][&from=..][&to=..]		readings, default last hour
+// 	/api/downsample?device=..&step=..[&sensor=..][&from=..][&to=..]	min, max and mean per
+// 									step, default whole window
+// to defaults to the newest reading of the device. Without a sensor all sensors are answered.
+class HotWindowApi
+{
+public:
+	HotWindowApi (const HotWindow * window_ptr, const DeviceTable * device_table_ptr) :
+		window_ptr_(window_ptr),
+		device_table_ptr_(device_table_ptr)
+	{}
+	~HotWindowApi () {}
+
+	// Registers the endpoints above at server, the handlers run in the thread of server.
+	void AddHandlers(LocalHttpServer * server);
+
+	void Latest(const LocalHttpServer::Request & request,
+			LocalHttpServer::Response * response) const;
+	void Range(const LocalHttpServer::Request & request,
+			LocalHttpServer::Response * response) const;
+	void Downsample(const LocalHttpServer::Request & request,
+			LocalHttpServer::Response * response) const;
+
+private:
+	// Time range and sensor selection of a query.
+	struct Selection
+	{
+		DeviceHandle device;
+		uint32_t from;
+		uint32_t to;
+		// index of the requested sensor, -1 for all sensors
+		int sensor;
+	};
+
+	// Parses device, sensor, from and to of request, from defaults to default_span_seconds
+	// before to. Sets an error response and returns false for invalid or unknown values.
+	bool Select(const LocalHttpServer::Request & request, const uint32_t default_span_seconds,
+			Selection * selection, LocalHttpServer::Response * response) const;
+
+	// Appends "device_id":"..","time":.. and the sensors of the newest reading of device.
+	void AppendLatest(const DeviceHandle device, QByteArray * body) const;
+
+	// Appends values[index * sensor_count + sensor] of every index as JSON array.
+	static void AppendColumn(const std::vector<float> & values, const unsigned int sensor_count,
+			const unsigned int sensor, QByteArray * body);
+	static void AppendTimes(const std::vector<uint32_t> & unix_seconds, QByteArray * body);
+	static void SetError(const int status, const char * message,
+			LocalHttpServer::Response * response);
+
+	static const uint32_t default_range_seconds = 3600;
+
+	const HotWindow * window_ptr_;
+	const DeviceTable * device_table_ptr_;
+};
+
+
+#endif /* end of include guard: HOT_WINDOW_API_H_B8PW4JZE */
@@ -0,0 +1,453 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// End-to-end ingest benchmark. Runs SerialCommunicator, Scheduler<5> and DatabaseManager in
+// one process against simulated nodes (in-memory QIODevice) and a local HTTP stand-in for
+// InfluxDB that accepts /write and /query. Results are printed as JSON.
+//
+// Example usage:
+// 	beehive_ingest_benchmark --sessions 500 --readings 150 --mode data --output result.json
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <QByteArray>
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QEventLoop>
+#include <QIODevice>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "database_manager.h"
+#include "device_table.h"
+#include "latency_histogram.h"
+#include "local_http_server.h"
+#include "MAC_device_parser.h"
+#include "scheduler.h"
+#include "serial_communication.h"
+#include "session_statistics.h"
+#include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+
+// Counts every heap allocation of the process, including the ones made by Qt.
+static std::atomic<unsigned long long> allocation_count(0);
+static std::atomic<unsigned long long> allocated_bytes(0);
+
+void * operator new(std::size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	void * memory = std::malloc(size ? size : 1);
+	if(!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void * memory) noexcept
+{
+	std::free(memory);
+}
+
+
+namespace {
+
+// Serial port stand-in that plays back the node side of one session and swallows
+// everything the master writes.
+class SimulatedNodeDevice : public QIODevice
+{
+public:
+	explicit SimulatedNodeDevice (const QByteArray & node_script) :
+		node_script_(node_script),
+		read_position_(0),
+		bytes_written_(0)
+	{}
+
+	bool isSequential() const override { return true; }
+
+	qint64 bytesAvailable() const override
+	{
+		return (node_script_.size() - read_position_) + QIODevice::bytesAvailable();
+	}
+
+	// Data of the node is either there or will never arrive.
+	bool waitForReadyRead(int) override { return bytesAvailable() > 0; }
+	bool waitForBytesWritten(int) override { return true; }
+
+	qint64 bytes_read() const { return read_position_; }
+	qint64 bytes_written() const { return bytes_written_; }
+
+protected:
+	qint64 readData(char * data, qint64 max_size) override
+	{
+		const qint64 length = std::min<qint64>(max_size, node_script_.size() - read_position_);
+		std::memcpy(data, node_script_.constData() + read_position_, length);
+		read_position_ += length;
+		return length;
+	}
+
+	qint64 writeData(const char *, qint64 max_size) override
+	{
+		bytes_written_ += max_size;
+		return max_size;
+	}
+
+private:
+	const QByteArray node_script_;
+	qint64 read_position_;
+	qint64 bytes_written_;
+};
+
+// A node sends DATA with its readings at its rendezvous, DUMP if it missed the last one.
+enum SessionMode { DATA_SESSION, DUMP_SESSION, INIT_SESSION };
+
+// Creates the bytes a node sends during one session of the given mode.
+QByteArray CreateNodeScript(const SessionMode mode, const unsigned int number_of_readings,
+		const unsigned int seed)
+{
+	static const unsigned int interval_length_seconds = 300;
+
+	QByteArray script;
+	if(mode == INIT_SESSION)
+	{
+		script.append(char(INIT_MSG));
+		script.append(char(FINI_MSG));
+		return script;
+	}
+
+	script.append(char(mode == DATA_SESSION ? DATA_MSG : DUMP_MSG));
+
+	temperature_readings_header header = temperature_readings_header();
+	DatabaseManager::TimeConvertToDeviceTime(std::chrono::system_clock::now() -
+			std::chrono::seconds(interval_length_seconds * number_of_readings),
+			&header.start_time);
+	header.interval_length_seconds = interval_length_seconds;
+	header.number_of_readings = number_of_readings;
+	header.sensor_count = TEMPERATURES_PER_READING;
+	header.adc_bits = TEMPERATURE_BITS;
+	header.reading_bytes = TEMPERATURE_READING_WIRE_BYTES;
+	DatabaseManager::TimeConvertToDeviceTime(std::chrono::system_clock::now(), &header.node_time);
+	unsigned char header_bytes[HEADER_WIRE_BYTES];
+	EncodeHeader(header, header_bytes);
+	script.append((const char *) header_bytes, HEADER_WIRE_BYTES);
+
+	// around 35 degree celsius with some noise
+	for (unsigned int i = 0; i < number_of_readings; ++i) {
+		uint16_t values[4];
+		for (unsigned int sensor = 0; sensor < 4; ++sensor)
+			values[sensor] = (320 + ((seed + i * 7 + sensor * 13) % 16)) & 0x3FF;
+
+		const temperature_reading reading =
+			PackTemperatures(values[0], values[1], values[2], values[3]);
+		script.append((const char *) reading.temperatures_packed, TEMPERATURE_READING_WIRE_BYTES);
+	}
+
+	return script;
+}
+
+double Percentile(const std::vector<double> & sorted_values, const double percentile)
+{
+	if(sorted_values.empty())
+		return 0.0;
+	const std::size_t index = std::min(sorted_values.size() - 1,
+			static_cast<std::size_t>(percentile * sorted_values.size()));
+	return sorted_values[index];
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser options;
+	options.setApplicationDescription("End-to-end ingest benchmark of the beehive reader");
+	options.addHelpOption();
+	const QCommandLineOption sessions_option("sessions", "Number of simulated sessions.", "n", "200");
+	const QCommandLineOption readings_option("readings", "Readings per dump.", "n", "150");
+	const QCommandLineOption devices_option("devices", "Number of simulated nodes.", "n", "9");
+	const QCommandLineOption mode_option("mode",
+			"Session type: data, dump or init.", "mode", "data");
+	const QCommandLineOption output_option("output", "Write JSON result to file.", "file");
+	const QCommandLineOption verbose_option("verbose", "Keep the log output of the reader.");
+	options.addOption(sessions_option);
+	options.addOption(readings_option);
+	options.addOption(devices_option);
+	options.addOption(mode_option);
+	options.addOption(output_option);
+	options.addOption(verbose_option);
+	options.process(app);
+
+	const unsigned int number_of_sessions = options.value(sessions_option).toUInt();
+	const unsigned int number_of_readings = options.value(readings_option).toUInt();
+	const unsigned int number_of_devices = std::max(1u, options.value(devices_option).toUInt());
+
+	SessionMode mode;
+	if(options.value(mode_option) == "data")
+		mode = DATA_SESSION;
+	else if(options.value(mode_option) == "dump")
+		mode = DUMP_SESSION;
+	else if(options.value(mode_option) == "init")
+		mode = INIT_SESSION;
+	else
+	{
+		std::cout << "unknown mode " << options.value(mode_option).toStdString() <<
+			", expected data, dump or init - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// InfluxDB stand-in, served from its own thread because the scheduler blocks the main
+	// thread while it waits for /query.
+	std::atomic<unsigned long long> write_requests(0);
+	std::atomic<unsigned long long> query_requests(0);
+
+	QThread influx_thread;
+	LocalHttpServer * influx_stub = new LocalHttpServer;
+	influx_stub->AddHandler("/write", [&write_requests](const LocalHttpServer::Request &,
+				LocalHttpServer::Response * response)
+			{
+				write_requests.fetch_add(1, std::memory_order_relaxed);
+				response->status = 204;
+			});
+	influx_stub->AddHandler("/query", [&query_requests](const LocalHttpServer::Request &,
+				LocalHttpServer::Response * response)
+			{
+				// one scheduled collection start five minutes from now
+				query_requests.fetch_add(1, std::memory_order_relaxed);
+				QJsonObject tags;
+				tags.insert("device_id", QString("20:15:04:10:00:00"));
+				QJsonArray point;
+				point.append(QDateTime::currentDateTimeUtc().addSecs(300).toString(Qt::ISODate));
+				point.append(1);
+				QJsonArray values;
+				values.append(point);
+				QJsonObject series;
+				series.insert("name", QString("collection_events"));
+				series.insert("tags", tags);
+				series.insert("values", values);
+				QJsonArray series_array;
+				series_array.append(series);
+				QJsonObject result;
+				result.insert("series", series_array);
+				QJsonArray results;
+				results.append(result);
+				QJsonObject body;
+				body.insert("results", results);
+
+				response->content_type = "application/json";
+				response->body = QJsonDocument(body).toJson(QJsonDocument::Compact);
+			});
+	influx_stub->moveToThread(&influx_thread);
+	QObject::connect(&influx_thread, SIGNAL(finished()), influx_stub, SLOT(deleteLater()));
+	influx_thread.start();
+
+	bool listening = false;
+	QMetaObject::invokeMethod(influx_stub, "ListenTcp", Qt::BlockingQueuedConnection,
+			Q_RETURN_ARG(bool, listening), Q_ARG(quint16, 0));
+	if(!listening)
+	{
+		influx_thread.quit();
+		influx_thread.wait();
+		return EXIT_FAILURE;
+	}
+
+	// device mapping of the simulated nodes
+	QTemporaryDir mapping_dir;
+	const QString mapping_filename = QDir(mapping_dir.path()).filePath("devices_mapping.txt");
+	std::vector<QString> device_ids;
+	std::vector<DeviceHandle> device_handles;
+	{
+		std::ofstream mapping_file(mapping_filename.toStdString());
+		for (unsigned int i = 0; i < number_of_devices; ++i) {
+			const QString device_id = QString("20:15:04:10:%1:%2")
+				.arg((i >> 8) & 0xFF, 2, 16, QChar('0'))
+				.arg(i & 0xFF, 2, 16, QChar('0'));
+			device_ids.push_back(device_id);
+			mapping_file << device_id.toStdString() << "\t\tBenchNode" << i <<
+				"\t/dev/null" << std::endl;
+		}
+	}
+
+	MACDeviceParser parser(mapping_filename.toStdString());
+	parser.ParseForDevices();
+	for (const QString & device_id : device_ids)
+		device_handles.push_back(parser.device_table().Intern(device_id.utf16(), device_id.size()));
+
+	SessionStatistics session_statistics(&parser.device_table());
+
+	DatabaseManager db_manager("mydb",
+			"test_user", "passwd_1234",
+			"127.0.0.1", "/query", "/write", influx_stub->tcp_port(),
+			parser, &session_statistics);
+
+	// like in the reader the database writes run in a thread of their own
+	QThread database_thread;
+	db_manager.moveToThread(&database_thread);
+	database_thread.start();
+
+	Scheduler<5> scheduler(&db_manager, &parser, &session_statistics);
+	SerialCommunicator serial_communicator(&db_manager, &scheduler, &session_statistics);
+
+	db_manager.Init(&app);
+
+	// the node scripts are created up front so only the pipeline is measured
+	std::vector<QByteArray> node_scripts;
+	node_scripts.reserve(number_of_devices);
+	for (unsigned int i = 0; i < number_of_devices; ++i)
+		node_scripts.push_back(CreateNodeScript(mode, number_of_readings, i));
+
+	std::streambuf * cout_buffer = std::cout.rdbuf();
+	if(!options.isSet(verbose_option))
+		std::cout.rdbuf(nullptr);
+
+	std::vector<double> session_latencies_us;
+	session_latencies_us.reserve(number_of_sessions);
+	unsigned long long serial_bytes_received = 0;
+	unsigned long long serial_bytes_sent = 0;
+
+	const unsigned long long allocations_before = allocation_count.load();
+	const unsigned long long allocated_bytes_before = allocated_bytes.load();
+	const auto benchmark_start = std::chrono::steady_clock::now();
+
+	for (unsigned int session = 0; session < number_of_sessions; ++session) {
+		const unsigned int device = session % number_of_devices;
+		SimulatedNodeDevice node_device(node_scripts[device]);
+		node_device.open(QIODevice::ReadWrite);
+
+		const auto session_start = std::chrono::steady_clock::now();
+		serial_communicator.PerformCommunication(&node_device, device_handles[device]);
+		const auto session_end = std::chrono::steady_clock::now();
+
+		session_latencies_us.push_back(std::chrono::duration<double, std::micro>(
+					session_end - session_start).count());
+		serial_bytes_received += node_device.bytes_read();
+		serial_bytes_sent += node_device.bytes_written();
+	}
+
+	// wait until every database write has been answered, each time the replies run out
+	// the database manager posts a quit to this thread
+	db_manager.WaitForQueuedRequests();
+	while(db_manager.open_network_replies() > 0)
+		app.processEvents(QEventLoop::WaitForMoreEvents);
+
+	const auto benchmark_end = std::chrono::steady_clock::now();
+	const unsigned long long allocations = allocation_count.load() - allocations_before;
+	const unsigned long long allocation_bytes = allocated_bytes.load() - allocated_bytes_before;
+
+	std::cout.rdbuf(cout_buffer);
+	std::cout.clear();
+
+	const double elapsed_s = std::chrono::duration<double>(benchmark_end - benchmark_start).count();
+	const unsigned int readings_per_session = mode == INIT_SESSION ? 0 : number_of_readings;
+	std::sort(session_latencies_us.begin(), session_latencies_us.end());
+
+	QJsonObject latency;
+	latency.insert("p50", Percentile(session_latencies_us, 0.50));
+	latency.insert("p99", Percentile(session_latencies_us, 0.99));
+	latency.insert("max", session_latencies_us.empty() ? 0.0 : session_latencies_us.back());
+
+	// per phase latencies of all nodes as recorded by the reader itself
+	QJsonObject phase_latencies;
+	for (int phase = 0; phase < NUMBER_OF_SESSION_PHASES; ++phase) {
+		LatencyHistogram phase_histogram;
+		session_statistics.ForEachNode([&phase_histogram, phase](const std::string &,
+					const NodeSessionStatistics & node)
+				{
+					phase_histogram.Add(node.phases[phase]);
+				});
+		if(!phase_histogram.count())
+			continue;
+
+		QJsonObject phase_latency;
+		phase_latency.insert("count", double(phase_histogram.count()));
+		phase_latency.insert("p50", double(phase_histogram.Percentile(0.50)));
+		phase_latency.insert("p99", double(phase_histogram.Percentile(0.99)));
+		phase_latency.insert("max", double(phase_histogram.max()));
+		phase_latencies.insert(SessionStatistics::PhaseName(static_cast<SessionPhase>(phase)),
+				phase_latency);
+	}
+
+	QJsonObject wire;
+	wire.insert("serial_from_nodes", double(serial_bytes_received));
+	wire.insert("serial_to_nodes", double(serial_bytes_sent));
+	wire.insert("http_to_database", double(influx_stub->bytes_received()));
+	wire.insert("http_from_database", double(influx_stub->bytes_sent()));
+
+	QJsonObject http_requests;
+	http_requests.insert("write", double(write_requests.load()));
+	http_requests.insert("query", double(query_requests.load()));
+
+	QJsonObject result;
+	result.insert("mode", options.value(mode_option));
+	result.insert("sessions", double(number_of_sessions));
+	result.insert("readings_per_dump", double(readings_per_session));
+	result.insert("devices", double(number_of_devices));
+	result.insert("elapsed_s", elapsed_s);
+	result.insert("dumps_per_second", elapsed_s > 0 ? number_of_sessions / elapsed_s : 0.0);
+	result.insert("readings_per_second", elapsed_s > 0 ?
+			double(number_of_sessions) * readings_per_session / elapsed_s : 0.0);
+	result.insert("session_latency_us", latency);
+	result.insert("phase_latency_us", phase_latencies);
+	result.insert("allocations", double(allocations));
+	result.insert("allocated_bytes", double(allocation_bytes));
+	result.insert("allocations_per_reading", number_of_sessions * readings_per_session ?
+			double(allocations) / (double(number_of_sessions) * readings_per_session) : 0.0);
+	result.insert("bytes_on_wire", wire);
+	result.insert("http_requests", http_requests);
+	result.insert("dump_ring_full_waits", double(db_manager.dump_ring_full_waits().load()));
+
+	const QByteArray result_json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+	if(options.isSet(output_option))
+	{
+		std::ofstream output_file(options.value(output_option).toStdString());
+		output_file << result_json.toStdString();
+	}
+	else
+		std::cout << result_json.toStdString();
+
+	db_manager.Shutdown();
+	database_thread.quit();
+	database_thread.wait();
+
+	QMetaObject::invokeMethod(influx_stub, "Close", Qt::BlockingQueuedConnection);
+	influx_thread.quit();
+	influx_thread.wait();
+
+	return EXIT_SUCCESS;
+}
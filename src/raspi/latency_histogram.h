@@ -0,0 +1,156 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef LATENCY_HISTOGRAM_H_W7RLQ2XE
+#define LATENCY_HISTOGRAM_H_W7RLQ2XE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// HDR style histogram of latencies in microseconds.
+// Values below SUB_BUCKET_COUNT are counted exactly, every larger power of two range is
+// split into SUB_BUCKET_COUNT / 2 linear sub buckets. Each value is therefore kept with a
+// relative error below 2 / SUB_BUCKET_COUNT (3.1%) over the whole range up to
+// 2^MAX_VALUE_BITS us, in about 9 KB per histogram.
+// Recording is a handful of bit operations and relaxed atomic increments without any
+// allocation, so it can stay enabled in production and may be called from any thread.
+class LatencyHistogram
+{
+public:
+	static const unsigned int SUB_BUCKET_BITS = 6;
+	static const unsigned int SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+	static const unsigned int MAX_VALUE_BITS = 40;
+	static const unsigned int BUCKET_COUNT =
+		(MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) << (SUB_BUCKET_BITS - 1);
+
+	LatencyHistogram () :
+		total_count_(0),
+		total_sum_(0),
+		max_value_(0)
+	{
+		for (auto & bucket : buckets_)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+
+	LatencyHistogram (const LatencyHistogram &) = delete;
+	LatencyHistogram & operator=(const LatencyHistogram &) = delete;
+
+	void Record(uint64_t value_us)
+	{
+		if(value_us >= (uint64_t(1) << MAX_VALUE_BITS))
+			value_us = (uint64_t(1) << MAX_VALUE_BITS) - 1;
+
+		buckets_[BucketIndex(value_us)].fetch_add(1, std::memory_order_relaxed);
+		total_count_.fetch_add(1, std::memory_order_relaxed);
+		total_sum_.fetch_add(value_us, std::memory_order_relaxed);
+
+		uint64_t current_max = max_value_.load(std::memory_order_relaxed);
+		while(value_us > current_max &&
+				!max_value_.compare_exchange_weak(current_max, value_us,
+					std::memory_order_relaxed))
+		{}
+	}
+
+	// Records the time elapsed since start.
+	void RecordSince(const std::chrono::steady_clock::time_point start)
+	{
+		Record(std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - start).count());
+	}
+
+	// Adds all values of other to this histogram.
+	void Add(const LatencyHistogram & other)
+	{
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i)
+			buckets_[i].fetch_add(other.bucket_count(i), std::memory_order_relaxed);
+		total_count_.fetch_add(other.count(), std::memory_order_relaxed);
+		total_sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+
+		const uint64_t other_max = other.max();
+		uint64_t current_max = max_value_.load(std::memory_order_relaxed);
+		while(other_max > current_max &&
+				!max_value_.compare_exchange_weak(current_max, other_max,
+					std::memory_order_relaxed))
+		{}
+	}
+
+	// Returns the upper bound of the bucket that holds the given quantile (0.0 .. 1.0).
+	uint64_t Percentile(const double quantile) const
+	{
+		const uint64_t number_of_values = count();
+		if(!number_of_values)
+			return 0;
+
+		uint64_t rank = static_cast<uint64_t>(quantile * number_of_values + 0.5);
+		if(rank < 1)
+			rank = 1;
+
+		uint64_t seen = 0;
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+			seen += bucket_count(i);
+			if(seen >= rank)
+				return BucketUpperBound(i) < max() ? BucketUpperBound(i) : max();
+		}
+		return max();
+	}
+
+	// access functions
+	uint64_t count() const { return total_count_.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return total_sum_.load(std::memory_order_relaxed); }
+	uint64_t max() const { return max_value_.load(std::memory_order_relaxed); }
+	uint64_t bucket_count(const unsigned int index) const
+	{
+		return buckets_[index].load(std::memory_order_relaxed);
+	}
+
+	static unsigned int BucketIndex(const uint64_t value)
+	{
+		if(value < SUB_BUCKET_COUNT)
+			return static_cast<unsigned int>(value);
+
+		const unsigned int highest_bit = 63 - __builtin_clzll(value);
+		const unsigned int shift = highest_bit - SUB_BUCKET_BITS + 1;
+		return (shift << (SUB_BUCKET_BITS - 1)) + static_cast<unsigned int>(value >> shift);
+	}
+
+	// Largest value that is counted in bucket index.
+	static uint64_t BucketUpperBound(const unsigned int index)
+	{
+		if(index < SUB_BUCKET_COUNT)
+			return index;
+
+		const unsigned int shift = (index >> (SUB_BUCKET_BITS - 1)) - 1;
+		const uint64_t sub_bucket = index - (shift << (SUB_BUCKET_BITS - 1));
+		return ((sub_bucket + 1) << shift) - 1;
+	}
+
+private:
+	std::atomic<uint64_t> buckets_[BUCKET_COUNT];
+	std::atomic<uint64_t> total_count_;
+	std::atomic<uint64_t> total_sum_;
+	std::atomic<uint64_t> max_value_;
+};
+
+
+#endif /* end of include guard: LATENCY_HISTOGRAM_H_W7RLQ2XE */
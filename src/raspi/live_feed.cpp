@@ -0,0 +1,209 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "live_feed.h"
+
+
+LiveFeed::~LiveFeed()
+{
+	if(header_)
+		munmap(header_, mapped_bytes_);
+}
+
+bool LiveFeed::Open()
+{
+	if(header_ || !slot_count_)
+		return false;
+
+	// a new file, readers still mapping the old one must not see it reinitialized
+	if(unlink(path_.c_str()) && errno != ENOENT)
+	{
+		std::cout << "could not replace live feed " << path_ << ": " << std::strerror(errno) <<
+			std::endl;
+		return false;
+	}
+
+	const std::size_t feed_bytes = sizeof(live_feed_header) +
+		std::size_t(slot_count_) * sizeof(live_feed_slot);
+	const int feed_fd = open(path_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if(feed_fd < 0 || ftruncate(feed_fd, feed_bytes))
+	{
+		std::cout << "could not create live feed " << path_ << ": " << std::strerror(errno) <<
+			std::endl;
+		if(feed_fd >= 0)
+			close(feed_fd);
+		return false;
+	}
+
+	void * const data = mmap(nullptr, feed_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+			feed_fd, 0);
+	close(feed_fd);
+	if(data == MAP_FAILED)
+	{
+		std::cout << "could not map live feed " << path_ << ": " << std::strerror(errno) <<
+			std::endl;
+		return false;
+	}
+
+	// ftruncate zeroed the file, every sequence is even and nothing is published yet
+	header_ = static_cast<live_feed_header *>(data);
+	slots_ = reinterpret_cast<live_feed_slot *>(header_ + 1);
+	mapped_bytes_ = feed_bytes;
+	header_->version = LIVE_FEED_VERSION;
+	header_->header_bytes = sizeof(live_feed_header);
+	header_->slot_bytes = sizeof(live_feed_slot);
+	header_->slot_count = slot_count_;
+	header_->magic.store(LIVE_FEED_MAGIC, std::memory_order_release);
+
+	std::cout << "live feed " << path_ << std::endl;
+	return true;
+}
+
+void LiveFeed::Publish(const uint64_t device_mac, const uint32_t unix_seconds,
+		const double * celsius, const unsigned int sensor_count)
+{
+	if(!header_)
+		return;
+
+	const uint32_t record = header_->published.load(std::memory_order_relaxed);
+	live_feed_slot & slot = slots_[record % slot_count_];
+
+	const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.record = record;
+	slot.device_mac = device_mac;
+	slot.unix_seconds = unix_seconds;
+	slot.sensor_count = sensor_count < MAX_SENSOR_COUNT ? sensor_count : MAX_SENSOR_COUNT;
+	for (unsigned int sensor = 0; sensor < MAX_SENSOR_COUNT; ++sensor)
+		slot.celsius[sensor] = sensor < slot.sensor_count ? float(celsius[sensor]) : 0.0f;
+
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	header_->published.store(record + 1, std::memory_order_release);
+}
+
+
+LiveFeedReader::~LiveFeedReader()
+{
+	if(header_)
+		munmap(const_cast<live_feed_header *>(header_), mapped_bytes_);
+}
+
+bool LiveFeedReader::Open(const std::string & path)
+{
+	const int feed_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat feed_stat;
+	if(feed_fd < 0 || fstat(feed_fd, &feed_stat) ||
+			std::size_t(feed_stat.st_size) < sizeof(live_feed_header))
+	{
+		if(feed_fd >= 0)
+			close(feed_fd);
+		return false;
+	}
+
+	void * const data = mmap(nullptr, feed_stat.st_size, PROT_READ, MAP_SHARED, feed_fd, 0);
+	close(feed_fd);
+	if(data == MAP_FAILED)
+		return false;
+
+	const live_feed_header * const header = static_cast<const live_feed_header *>(data);
+	if(header->magic.load(std::memory_order_acquire) != LIVE_FEED_MAGIC ||
+			header->version != LIVE_FEED_VERSION ||
+			header->header_bytes != sizeof(live_feed_header) ||
+			header->slot_bytes != sizeof(live_feed_slot) || !header->slot_count ||
+			std::size_t(feed_stat.st_size) < sizeof(live_feed_header) +
+			std::size_t(header->slot_count) * sizeof(live_feed_slot))
+	{
+		munmap(data, feed_stat.st_size);
+		return false;
+	}
+
+	if(header_)
+		munmap(const_cast<live_feed_header *>(header_), mapped_bytes_);
+	header_ = header;
+	slots_ = reinterpret_cast<const live_feed_slot *>(header_ + 1);
+	mapped_bytes_ = feed_stat.st_size;
+	next_record_ = header_->published.load(std::memory_order_acquire);
+	return true;
+}
+
+bool LiveFeedReader::Next(Record * record)
+{
+	if(!header_)
+		return false;
+
+	for (;;) {
+		const uint32_t published = header_->published.load(std::memory_order_acquire);
+		if(published == next_record_)
+			return false;
+
+		// the oldest records may already be overwritten
+		if(published - next_record_ > header_->slot_count)
+		{
+			records_missed_ += published - next_record_ - header_->slot_count;
+			next_record_ = published - header_->slot_count;
+		}
+
+		const live_feed_slot & slot = slots_[next_record_ % header_->slot_count];
+		const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if(sequence & 1)
+		{
+			// the writer is lapping us right now
+			++records_missed_;
+			++next_record_;
+			continue;
+		}
+
+		const uint32_t slot_record = slot.record;
+		record->device_mac = slot.device_mac;
+		record->unix_seconds = slot.unix_seconds;
+		record->sensor_count = slot.sensor_count < MAX_SENSOR_COUNT ?
+			slot.sensor_count : MAX_SENSOR_COUNT;
+		std::memcpy(record->celsius, slot.celsius, sizeof(record->celsius));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(slot.sequence.load(std::memory_order_relaxed) != sequence ||
+				slot_record != next_record_)
+		{
+			// overwritten while or before it was copied
+			++records_missed_;
+			++next_record_;
+			continue;
+		}
+
+		++next_record_;
+		return true;
+	}
+}
@@ -0,0 +1,156 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef LIVE_FEED_H_K3VN8QTD
+#define LIVE_FEED_H_K3VN8QTD
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../protocol_definitions/protocol_codec.h"
+
+// Layout of the live feed file, usually placed in /dev/shm.
+//
+// live_feed_header | slot_count * live_feed_slot
+//
+// Record n is written to slot n % slot_count, header.published is the number of records
+// written so far. Slots are protected by a seqlock: the writer makes sequence odd, fills the
+// slot and makes sequence even again. A reader of record n copies the slot between two loads
+// of sequence and keeps the copy if both loads were equal and even and the copy holds
+// record n. A larger record number means the writer already lapped the reader.
+// All integers are stored in host byte order, atomics are plain 32 bit integers.
+
+// changed with every change of the layout
+static const uint32_t LIVE_FEED_MAGIC = 0x464c5742; // "BWLF"
+static const uint32_t LIVE_FEED_VERSION = 1;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+		"the feed is shared between processes, its atomics must not use locks");
+
+struct live_feed_header {
+	// written last when the feed is created
+	std::atomic<uint32_t> magic;
+	uint32_t version;
+	uint32_t header_bytes;
+	uint32_t slot_bytes;
+	uint32_t slot_count;
+	std::atomic<uint32_t> published;
+	uint32_t reserved[10];
+};
+static_assert(sizeof(live_feed_header) == 64, "readers in other languages hardcode the layout");
+
+struct live_feed_slot {
+	// odd while the slot is written
+	std::atomic<uint32_t> sequence;
+	uint32_t record;
+	uint64_t device_mac;
+	uint32_t unix_seconds;
+	uint8_t sensor_count;
+	uint8_t reserved[3];
+	float celsius[MAX_SENSOR_COUNT];
+	uint32_t padding[2];
+};
+static_assert(sizeof(live_feed_slot) == 64, "readers in other languages hardcode the layout");
+
+// Publishes decoded readings into the live feed. There is a single writer, the thread of
+// DatabaseManager, publishing never blocks on or waits for readers.
+class LiveFeed
+{
+public:
+	static const uint32_t DEFAULT_SLOT_COUNT = 4096;
+
+	LiveFeed (const std::string & path, const uint32_t slot_count = DEFAULT_SLOT_COUNT) :
+		path_(path),
+		slot_count_(slot_count),
+		header_(nullptr),
+		slots_(nullptr),
+		mapped_bytes_(0)
+	{}
+	~LiveFeed ();
+
+	LiveFeed (const LiveFeed &) = delete;
+	LiveFeed & operator=(const LiveFeed &) = delete;
+
+	// Replaces the file at path by an empty feed. Readers of an earlier feed keep their old
+	// mapping and have to open the feed again. Returns false if it could not be created.
+	bool Open();
+
+	void Publish(const uint64_t device_mac, const uint32_t unix_seconds,
+			const double * celsius, const unsigned int sensor_count);
+
+	// access functions
+	const std::string & path() const { return path_; }
+
+private:
+	const std::string path_;
+	const uint32_t slot_count_;
+	live_feed_header * header_;
+	live_feed_slot * slots_;
+	std::size_t mapped_bytes_;
+};
+
+// Follows a live feed from the record published last when it was opened. Any number of
+// readers may follow the same feed, they only read the shared memory.
+class LiveFeedReader
+{
+public:
+	struct Record
+	{
+		uint64_t device_mac;
+		uint32_t unix_seconds;
+		unsigned int sensor_count;
+		float celsius[MAX_SENSOR_COUNT];
+	};
+
+	LiveFeedReader () :
+		header_(nullptr),
+		slots_(nullptr),
+		mapped_bytes_(0),
+		next_record_(0),
+		records_missed_(0)
+	{}
+	~LiveFeedReader ();
+
+	LiveFeedReader (const LiveFeedReader &) = delete;
+	LiveFeedReader & operator=(const LiveFeedReader &) = delete;
+
+	// Maps the feed at path. Returns false if there is no complete feed of this version.
+	bool Open(const std::string & path);
+
+	// Copies the next record and returns true, returns false if there is none yet. Records
+	// overwritten before they were read are skipped and counted in records_missed().
+	bool Next(Record * record);
+
+	// access functions
+	uint64_t records_missed() const { return records_missed_; }
+
+private:
+	const live_feed_header * header_;
+	const live_feed_slot * slots_;
+	std::size_t mapped_bytes_;
+	uint32_t next_record_;
+	uint64_t records_missed_;
+};
+
+
+#endif /* end of include guard: LIVE_FEED_H_K3VN8QTD */
@@ -0,0 +1,127 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// Follows the live feed of the reader and prints every reading as it is decoded, one line of
+// unix time, MAC address and the temperatures of its sensors. A feed that is created again by
+// a restarted reader is followed as well.
+//
+// Example usage:
+// 	beehive_live_feed --feed /dev/shm/beehive_live
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QString>
+
+#include "live_feed.h"
+
+#include <sys/stat.h>
+
+
+// Inode of the feed at path, 0 if there is none.
+static ino_t FeedInode(const std::string & path)
+{
+	struct stat feed_stat;
+	return stat(path.c_str(), &feed_stat) ? 0 : feed_stat.st_ino;
+}
+
+int main(int argc, char *argv[])
+{
+	// an idle feed is checked this often for being created again
+	static const auto reopen_check_interval = std::chrono::seconds(2);
+
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser options;
+	options.setApplicationDescription("Prints the readings published to a live feed.");
+	options.addHelpOption();
+	const QCommandLineOption feed_option("feed", "Live feed file of the reader.", "file");
+	const QCommandLineOption poll_option("poll", "Milliseconds between polls of an idle feed.",
+			"ms", "100");
+	options.addOption(feed_option);
+	options.addOption(poll_option);
+	options.process(app);
+
+	bool valid_value = false;
+	const int poll_ms = options.value(poll_option).toInt(&valid_value);
+	if(!options.isSet(feed_option) || !valid_value || poll_ms <= 0)
+	{
+		std::cout << "no feed or invalid poll interval given - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const std::string path = options.value(feed_option).toStdString();
+
+	LiveFeedReader reader;
+	ino_t feed_inode = FeedInode(path);
+	if(!reader.Open(path))
+	{
+		std::cout << "no live feed at " << path << " - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	LiveFeedReader::Record record;
+	uint64_t records_missed = 0;
+	auto last_reopen_check = std::chrono::steady_clock::now();
+	for (;;) {
+		if(!reader.Next(&record))
+		{
+			const auto now = std::chrono::steady_clock::now();
+			if(now - last_reopen_check >= reopen_check_interval)
+			{
+				last_reopen_check = now;
+				// a restarted reader replaces the file, the old mapping is never written again
+				const ino_t current_inode = FeedInode(path);
+				if(current_inode && current_inode != feed_inode && reader.Open(path))
+				{
+					feed_inode = current_inode;
+					std::cout << "# feed created again, following the new one" << std::endl;
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+			continue;
+		}
+
+		if(reader.records_missed() != records_missed)
+		{
+			std::cout << "# " << reader.records_missed() - records_missed <<
+				" readings overwritten before they were read" << std::endl;
+			records_missed = reader.records_missed();
+		}
+
+		char line[32];
+		std::snprintf(line, sizeof(line), "%u %02X:%02X:%02X:%02X:%02X:%02X", record.unix_seconds,
+				unsigned((record.device_mac >> 40) & 0xFF), unsigned((record.device_mac >> 32) & 0xFF),
+				unsigned((record.device_mac >> 24) & 0xFF), unsigned((record.device_mac >> 16) & 0xFF),
+				unsigned((record.device_mac >> 8) & 0xFF), unsigned(record.device_mac & 0xFF));
+		std::cout << line;
+		for (unsigned int sensor = 0; sensor < record.sensor_count; ++sensor)
+			std::cout << " " << record.celsius[sensor];
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,235 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <iostream>
+#include <utility>
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QIODevice>
+#include <QList>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUrl>
+#include <QUrlQuery>
+
+#include "local_http_server.h"
+
+
+LocalHttpServer::LocalHttpServer(QObject * parent) :
+	QObject(parent),
+	tcp_server_(this),
+	local_server_(this),
+	bytes_received_(0),
+	bytes_sent_(0),
+	requests_served_(0)
+{
+	connect(&tcp_server_, SIGNAL(newConnection()), this, SLOT(NewTcpConnection()));
+	connect(&local_server_, SIGNAL(newConnection()), this, SLOT(NewLocalConnection()));
+}
+
+void LocalHttpServer::AddHandler(const QByteArray & path, Handler handler)
+{
+	handlers_.insert(path, std::move(handler));
+}
+
+bool LocalHttpServer::ListenTcp(const quint16 port)
+{
+	if(!tcp_server_.listen(QHostAddress::LocalHost, port))
+	{
+		std::cout << "HTTP server could not listen on port " << port << ": " <<
+			tcp_server_.errorString().toStdString() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool LocalHttpServer::ListenUnix(const QString & socket_path)
+{
+	QLocalServer::removeServer(socket_path);
+	if(!local_server_.listen(socket_path))
+	{
+		std::cout << "HTTP server could not listen on " << socket_path.toStdString() << ": " <<
+			local_server_.errorString().toStdString() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void LocalHttpServer::Close()
+{
+	tcp_server_.close();
+	local_server_.close();
+	for (QIODevice * client : receive_buffers_.keys()) {
+		client->close();
+		client->deleteLater();
+	}
+	receive_buffers_.clear();
+}
+
+// slots:
+void LocalHttpServer::NewTcpConnection()
+{
+	while(tcp_server_.hasPendingConnections())
+		AcceptClient(tcp_server_.nextPendingConnection());
+}
+
+void LocalHttpServer::NewLocalConnection()
+{
+	while(local_server_.hasPendingConnections())
+		AcceptClient(local_server_.nextPendingConnection());
+}
+
+void LocalHttpServer::AcceptClient(QIODevice * client)
+{
+	receive_buffers_.insert(client, QByteArray());
+	// QTcpSocket and QLocalSocket both provide a disconnected() signal
+	connect(client, SIGNAL(readyRead()), this, SLOT(ReadFromClient()));
+	connect(client, SIGNAL(disconnected()), this, SLOT(ClientDisconnected()));
+}
+
+void LocalHttpServer::ReadFromClient()
+{
+	QIODevice * client = qobject_cast<QIODevice *>(sender());
+	if(!client || !receive_buffers_.contains(client))
+		return;
+
+	QByteArray & buffer = receive_buffers_[client];
+	const QByteArray received = client->readAll();
+	bytes_received_.fetch_add(received.size(), std::memory_order_relaxed);
+	buffer.append(received);
+
+	ServeRequests(client, &buffer);
+}
+
+void LocalHttpServer::ClientDisconnected()
+{
+	QIODevice * client = qobject_cast<QIODevice *>(sender());
+	if(!client)
+		return;
+
+	receive_buffers_.remove(client);
+	client->deleteLater();
+}
+
+void LocalHttpServer::ServeRequests(QIODevice * client, QByteArray * buffer)
+{
+	static const QByteArray header_end("\r\n\r\n");
+	static const QByteArray content_length_key("content-length");
+
+	while(true)
+	{
+		const int header_length = buffer->indexOf(header_end);
+		if(header_length < 0)
+		{
+			// drop clients that never finish their request header
+			if(buffer->size() > MAX_HEADER_SIZE)
+			{
+				receive_buffers_.remove(client);
+				client->close();
+				client->deleteLater();
+			}
+			return;
+		}
+
+		const QList<QByteArray> header_lines = buffer->left(header_length).split('\n');
+		const QList<QByteArray> request_line = header_lines.first().trimmed().split(' ');
+
+		int content_length = 0;
+		bool valid_content_length = true;
+		for (int i = 1; i < header_lines.size() && valid_content_length; ++i) {
+			const int separator = header_lines[i].indexOf(':');
+			if(separator > 0 &&
+					header_lines[i].left(separator).trimmed().toLower() == content_length_key)
+				content_length = header_lines[i].mid(separator + 1).trimmed().toInt(
+						&valid_content_length);
+		}
+
+		// a negative length would never consume the request and serve it forever
+		if(!valid_content_length || content_length < 0 || content_length > MAX_BODY_SIZE ||
+				request_line.size() < 2)
+		{
+			receive_buffers_.remove(client);
+			client->close();
+			client->deleteLater();
+			return;
+		}
+
+		// wait for the remaining body
+		const int request_length = header_length + header_end.size() + content_length;
+		if(buffer->size() < request_length)
+			return;
+
+		Request request;
+		request.method = request_line[0];
+		const QUrl url = QUrl::fromEncoded(request_line[1]);
+		request.path = url.path().toUtf8();
+		request.query = QUrlQuery(url);
+		request.body = buffer->mid(header_length + header_end.size(), content_length);
+		buffer->remove(0, request_length);
+
+		Response response;
+		const auto handler = handlers_.constFind(request.path);
+		if(handler != handlers_.constEnd())
+			(*handler)(request, &response);
+		else
+		{
+			response.status = 404;
+			response.body = "not found\n";
+		}
+
+		QByteArray reply;
+		reply.reserve(128 + response.body.size());
+		reply.append("HTTP/1.1 ").append(QByteArray::number(response.status)).append(' ')
+			.append(ReasonPhrase(response.status)).append("\r\n");
+		if(response.status != 204)
+		{
+			reply.append("Content-Type: ").append(response.content_type).append("\r\n");
+			reply.append("Content-Length: ").append(QByteArray::number(response.body.size()))
+				.append("\r\n");
+		}
+		reply.append("Connection: keep-alive\r\n\r\n");
+		if(response.status != 204)
+			reply.append(response.body);
+
+		client->write(reply);
+		bytes_sent_.fetch_add(reply.size(), std::memory_order_relaxed);
+		requests_served_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+const char * LocalHttpServer::ReasonPhrase(const int status)
+{
+	switch (status) {
+		case 200: return "OK";
+		case 204: return "No Content";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 503: return "Service Unavailable";
+		default: return "Internal Server Error";
+	}
+}
@@ -0,0 +1,119 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef LOCAL_HTTP_SERVER_H_K3VQZ8MD
+#define LOCAL_HTTP_SERVER_H_K3VQZ8MD
+
+#include <atomic>
+#include <functional>
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QLocalServer>
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <QUrlQuery>
+
+// Minimal HTTP/1.1 server for endpoints that are only reachable from the local machine.
+// It listens on a TCP port of the loopback interface and/or on a Unix domain socket and
+// dispatches each request by its path to a registered handler. Keep-alive and pipelined
+// requests are supported, chunked transfer encoding is not.
+// Example usage:
+// 	LocalHttpServer server;
+// 	server.AddHandler("/ping", [](const LocalHttpServer::Request &,
+// 				LocalHttpServer::Response * response) { response->body = "pong"; });
+// 	server.ListenTcp(8080);
+class LocalHttpServer : public QObject
+{
+	Q_OBJECT
+public:
+	struct Request {
+		QByteArray method;
+		QByteArray path;
+		QUrlQuery query;
+		QByteArray body;
+	};
+
+	struct Response {
+		Response() : status(200), content_type("text/plain; charset=utf-8") {}
+		int status;
+		QByteArray content_type;
+		QByteArray body;
+	};
+
+	typedef std::function<void(const Request &, Response *)> Handler;
+
+	explicit LocalHttpServer (QObject * parent = nullptr);
+	~LocalHttpServer () {}
+
+	// Registers handler for all requests to path. Must be called before the server
+	// starts listening.
+	void AddHandler(const QByteArray & path, Handler handler);
+
+	// access functions
+	quint16 tcp_port() const { return tcp_server_.serverPort(); }
+	quint64 bytes_received() const { return bytes_received_.load(std::memory_order_relaxed); }
+	quint64 bytes_sent() const { return bytes_sent_.load(std::memory_order_relaxed); }
+	quint64 requests_served() const { return requests_served_.load(std::memory_order_relaxed); }
+
+public slots:
+	// Starts listening on the loopback interface. Port 0 picks a free port, see tcp_port().
+	bool ListenTcp(const quint16 port);
+
+	// Starts listening on a Unix domain socket at socket_path. A stale socket file
+	// left behind by a previous process is removed.
+	bool ListenUnix(const QString & socket_path);
+
+	void Close();
+
+private slots:
+	void NewTcpConnection();
+	void NewLocalConnection();
+	void ReadFromClient();
+	void ClientDisconnected();
+
+private:
+	void AcceptClient(QIODevice * client);
+
+	// Serves all complete requests in the receive buffer of client.
+	void ServeRequests(QIODevice * client, QByteArray * buffer);
+
+	static const char * ReasonPhrase(const int status);
+
+	// Requests with larger header or body are rejected.
+	static const int MAX_HEADER_SIZE = 8 * 1024;
+	static const int MAX_BODY_SIZE = 16 * 1024 * 1024;
+
+	QTcpServer tcp_server_;
+	QLocalServer local_server_;
+	QHash<QByteArray, Handler> handlers_;
+	QHash<QIODevice *, QByteArray> receive_buffers_;
+	std::atomic<quint64> bytes_received_;
+	std::atomic<quint64> bytes_sent_;
+	std::atomic<quint64> requests_served_;
+};
+
+
+#endif /* end of include guard: LOCAL_HTTP_SERVER_H_K3VQZ8MD */
@@ -22,6 +22,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <csignal>
 #include <ctime>
 #include <memory>
 #include <string>
@@ -29,42 +30,285 @@
 #include <utility>
 #include <vector>
 
+#include <QByteArray>
+#include <QCommandLineOption>
+#include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QObject>
+#include <QSocketNotifier>
+#include <QString>
+#include <QStringList>
 #include <QThread>
 
+#include "anomaly_detector.h"
 #include "bluetooth_manager.h"
 #include "database_manager.h"
+#include "device_registry_watcher.h"
+#include "dump_archive.h"
+#include "hot_window.h"
+#include "hot_window_api.h"
+#include "live_feed.h"
+#include "local_http_server.h"
 #include "MAC_device_parser.h"
+#include "metrics_registry.h"
+#include "rfcomm_binder.h"
 #include "scheduler.h"
+#include "session_statistics.h"
 #include "../protocol_definitions/communication_structs.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+// SIGTERM and SIGINT are turned into a byte on this pipe, the event loop quits when it arrives
+static int shutdown_signal_pipe[2] = {-1, -1};
+
+static void HandleShutdownSignal(int)
+{
+	const char signal_byte = 1;
+	// only async signal safe calls in here, a full pipe already has a shutdown pending
+	const ssize_t written = write(shutdown_signal_pipe[1], &signal_byte, sizeof(signal_byte));
+	(void) written;
+}
+
+// Quits app on SIGTERM and SIGINT so the daemon drains its queued dumps before it exits.
+static bool InstallShutdownSignalHandlers(QCoreApplication * app)
+{
+	if(pipe(shutdown_signal_pipe) != 0)
+		return false;
+	fcntl(shutdown_signal_pipe[1], F_SETFL, O_NONBLOCK);
+
+	QSocketNotifier * notifier = new QSocketNotifier(shutdown_signal_pipe[0],
+			QSocketNotifier::Read, app);
+	// the byte is left in the pipe, the event loop does not run again after quitting
+	QObject::connect(notifier, SIGNAL(activated(int)), app, SLOT(quit()));
+
+	struct sigaction action;
+	action.sa_handler = HandleShutdownSignal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	return sigaction(SIGTERM, &action, nullptr) == 0 && sigaction(SIGINT, &action, nullptr) == 0;
+}
+
 
 int main(int argc, char *argv[])
 {
-	if(argc < 2)
+	static const std::string filename("devices_mapping.txt");
+	// default local port of the Prometheus metrics endpoint
+	static const quint16 default_metrics_port = 9105;
+	// default seconds between two probes of nodes without a planned rendezvous
+	static const int default_probe_interval = 300;
+	// default hours of readings kept in memory for the query API, as much as the mailed export
+	static const int default_hot_window_hours = 48;
+	// shortest sampling interval the scheduler hands out, half of its 5 minute blocks
+	static const int shortest_interval_seconds = 150;
+
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser command_line_parser;
+	command_line_parser.setApplicationDescription("Collects temperature readings of the beehive nodes.");
+	command_line_parser.addHelpOption();
+	command_line_parser.addPositionalArgument("devices",
+			"Bluetooth addresses of the nodes to talk to once (ignored in daemon mode).",
+			"[devices...]");
+	const QCommandLineOption daemon_option("daemon",
+			"Keep running and connect to every node at its planned rendezvous.");
+	const QCommandLineOption rfcomm_only_option("rfcomm-only",
+			"Talk to the nodes through their bound /dev/rfcommN ports only, without powering on "
+			"or even requiring a local Bluetooth adapter.");
+	const QCommandLineOption interval_option("interval",
+			"Seconds between two probes of nodes without a planned rendezvous in daemon mode.",
+			"seconds", QString::number(default_probe_interval));
+	const QCommandLineOption metrics_port_option("metrics-port",
+			"Local TCP port of the metrics endpoint, 0 disables it.", "port",
+			QString::number(default_metrics_port));
+	const QCommandLineOption metrics_socket_option("metrics-socket",
+			"Additionally serve the metrics endpoint on this unix socket.", "path");
+	const QCommandLineOption archive_option("archive",
+			"Append every received dump unmodified to the dump archive in this directory.",
+			"directory");
+	const QCommandLineOption hot_window_option("hot-window-hours",
+			"Hours of readings kept in memory and served under /api of the metrics endpoint, "
+			"0 disables it.", "hours", QString::number(default_hot_window_hours));
+	const QCommandLineOption live_feed_option("live-feed",
+			"Publish every decoded reading to local readers through this shared memory file, "
+			"e.g. /dev/shm/beehive_live, beehive_live_feed prints them.", "path");
+	const QCommandLineOption alert_command_option("alert-command",
+			"Run this program with device id, type, sensor, value and unix time of every alert.",
+			"program");
+	command_line_parser.addOption(daemon_option);
+	command_line_parser.addOption(rfcomm_only_option);
+	command_line_parser.addOption(interval_option);
+	command_line_parser.addOption(metrics_port_option);
+	command_line_parser.addOption(metrics_socket_option);
+	command_line_parser.addOption(archive_option);
+	command_line_parser.addOption(alert_command_option);
+	command_line_parser.addOption(hot_window_option);
+	command_line_parser.addOption(live_feed_option);
+	command_line_parser.process(app);
+
+	const bool daemon_mode = command_line_parser.isSet(daemon_option);
+	const bool rfcomm_only = command_line_parser.isSet(rfcomm_only_option);
+	const QStringList devices = command_line_parser.positionalArguments();
+
+	if(!daemon_mode && devices.isEmpty())
 	{
 		std::cout << "no devices found - nothing to do - quit" << std::endl;
 		return EXIT_SUCCESS;
 	}
 
-	static const std::string filename("devices_mapping.txt");
+	bool valid_interval = false;
+	const int probe_interval = command_line_parser.value(interval_option).toInt(&valid_interval);
+	if(!valid_interval || probe_interval <= 0)
+	{
+		std::cout << "invalid interval - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
 
-	QCoreApplication app(argc, argv);
+	bool valid_port = false;
+	const quint16 metrics_port = command_line_parser.value(metrics_port_option).toUShort(&valid_port);
+	if(!valid_port)
+	{
+		std::cout << "invalid metrics port - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bool valid_hot_window = false;
+	const int hot_window_hours = command_line_parser.value(hot_window_option).toInt(&valid_hot_window);
+	if(!valid_hot_window || hot_window_hours < 0)
+	{
+		std::cout << "invalid hot window hours - quit" << std::endl;
+		return EXIT_FAILURE;
+	}
 
 	MACDeviceParser parser(filename);
 
+	std::unique_ptr<DumpArchive> dump_archive;
+	if(command_line_parser.isSet(archive_option))
+	{
+		dump_archive = std::unique_ptr<DumpArchive>(new DumpArchive(
+					command_line_parser.value(archive_option).toStdString(),
+					&parser.device_table()));
+		if(!dump_archive->Open())
+		{
+			std::cout << "dump archive not writable - quit" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	MetricsRegistry metrics_registry;
+	SessionStatistics session_statistics(&parser.device_table(), &metrics_registry);
+
 	DatabaseManager db_manager("mydb", 
 			"test_user", "passwd_1234", 
 			"localhost", "/query", "/write", 8086, 
-			parser);
+			parser, &session_statistics);
+	db_manager.set_alert_command(command_line_parser.value(alert_command_option));
+
+	std::unique_ptr<HotWindow> hot_window;
+	if(hot_window_hours)
+	{
+		hot_window = std::unique_ptr<HotWindow>(new HotWindow(hot_window_hours * 3600,
+					hot_window_hours * 3600 / shortest_interval_seconds));
+		db_manager.SetHotWindow(hot_window.get());
+	}
+
+	std::unique_ptr<LiveFeed> live_feed;
+	if(command_line_parser.isSet(live_feed_option))
+	{
+		live_feed = std::unique_ptr<LiveFeed>(new LiveFeed(
+					command_line_parser.value(live_feed_option).toStdString()));
+		if(!live_feed->Open())
+		{
+			std::cout << "live feed not writable - quit" << std::endl;
+			return EXIT_FAILURE;
+		}
+		db_manager.SetLiveFeed(live_feed.get());
+	}
+
+	// encoding and database writes overlap with the serial sessions of the main thread
+	QThread database_thread;
+	db_manager.moveToThread(&database_thread);
+	database_thread.start();
+
+	const auto stop_database_thread = [&db_manager, &database_thread]()
+	{
+		db_manager.Shutdown();
+		database_thread.quit();
+		database_thread.wait();
+	};
 
 	Scheduler<5> scheduler(&db_manager,
-			&parser);
+			&parser, &session_statistics);
+
+	BluetoothManager bt_manager(&parser, &scheduler, &db_manager, &session_statistics);
+	bt_manager.SetDumpArchive(dump_archive.get());
+	bt_manager.set_rfcomm_only(rfcomm_only);
 
-	BluetoothManager bt_manager(&parser, &scheduler, &db_manager);
+	// in daemon mode the application lives on after all database replies arrived
+	db_manager.Init(daemon_mode ? nullptr : &app);
 
-	db_manager.Init(&app);
+	// the daemon picks up changes of the device mapping without restarting
+	DeviceRegistryWatcher registry_watcher(&parser);
+	RfcommBinder rfcomm_binder(&parser);
+	QObject::connect(&registry_watcher, SIGNAL(DevicesChanged(QStringList, QStringList)),
+			&bt_manager, SLOT(UpdateKnownDevices(QStringList, QStringList)));
+	QObject::connect(&registry_watcher, SIGNAL(DevicesChanged(QStringList, QStringList)),
+			&rfcomm_binder, SLOT(Bind(QStringList)));
+
+	metrics_registry.RegisterGauge(db_manager.writes_in_flight(), "beehive_db_writes_in_flight",
+			"Database writes waiting for their reply.");
+	metrics_registry.RegisterGauge(db_manager.queued_dumps(), "beehive_dump_ring_occupancy",
+			"Received dumps waiting for the database encoder.");
+	metrics_registry.RegisterCounter(db_manager.dump_ring_full_waits(),
+			"beehive_dump_ring_full_total",
+			"Received dumps that found the dump ring full and had to wait.");
+	for (int type = 0; type < AnomalyDetector::NUMBER_OF_ALERT_TYPES; ++type) {
+		const AnomalyDetector::AlertType alert_type = static_cast<AnomalyDetector::AlertType>(type);
+		metrics_registry.RegisterCounter(db_manager.alerts_raised(alert_type),
+				"beehive_alerts_total", "Alerts raised while decoding dumps by type.",
+				MetricsRegistry::Label("type", AnomalyDetector::TypeName(alert_type)));
+	}
+	metrics_registry.RegisterGauge(bt_manager.pending_sessions(), "beehive_session_queue_depth",
+			"Devices and services waiting for their session.");
+	if(dump_archive)
+		metrics_registry.RegisterCounter(dump_archive->append_failures(),
+				"beehive_archive_append_failures_total",
+				"Received dumps that could not be appended to the dump archive.");
+
+	std::string metrics_text;
+	LocalHttpServer metrics_server;
+	metrics_server.AddHandler("/metrics", [&metrics_registry, &metrics_text](
+				const LocalHttpServer::Request &, LocalHttpServer::Response * response)
+			{
+				metrics_registry.WritePrometheus(&metrics_text);
+				response->content_type = MetricsRegistry::content_type;
+				response->body = QByteArray(metrics_text.data(), metrics_text.size());
+			});
+	std::unique_ptr<HotWindowApi> hot_window_api;
+	if(hot_window)
+	{
+		hot_window_api = std::unique_ptr<HotWindowApi>(new HotWindowApi(hot_window.get(),
+					&parser.device_table()));
+		hot_window_api->AddHandlers(&metrics_server);
+	}
+
+	// queries are answered while the main thread is blocked in a serial session
+	QThread http_thread;
+	metrics_server.moveToThread(&http_thread);
+	http_thread.start();
+	if(metrics_port)
+		QMetaObject::invokeMethod(&metrics_server, "ListenTcp", Qt::BlockingQueuedConnection,
+				Q_ARG(quint16, metrics_port));
+	if(command_line_parser.isSet(metrics_socket_option))
+		QMetaObject::invokeMethod(&metrics_server, "ListenUnix", Qt::BlockingQueuedConnection,
+				Q_ARG(QString, command_line_parser.value(metrics_socket_option)));
+
+	const auto stop_http_thread = [&metrics_server, &http_thread]()
+	{
+		QMetaObject::invokeMethod(&metrics_server, "Close", Qt::BlockingQueuedConnection);
+		http_thread.quit();
+		http_thread.wait();
+	};
 
 	// TESTS
 	//parser.ParseForDevices();
@@ -124,18 +368,56 @@ int main(int argc, char *argv[])
 	//scheduler.ScheduleNextCollectionStart(device_test_id);
 
 
-	if( bt_manager.CheckLocalBluetoothDevice() )
+	if( rfcomm_only || bt_manager.CheckLocalBluetoothDevice() )
 	{
-		std::cout << "Local Bluetooth device is available" << std::endl;
-		bt_manager.Init(&app, argc, argv);
+		if(rfcomm_only)
+			std::cout << "Using rfcomm ports only" << std::endl;
+		else
+			std::cout << "Local Bluetooth device is available" << std::endl;
+		if(daemon_mode)
+		{
+			if(!InstallShutdownSignalHandlers(&app))
+				std::cout << "cannot handle SIGTERM - queued dumps are lost on stop" << std::endl;
+			bt_manager.InitDaemon(probe_interval);
+			rfcomm_binder.BindAll();
+			registry_watcher.Start();
+		}
+		else
+			bt_manager.Init(&app, devices);
 	}
 	else{
 		std::cout << "No Local Bluetooth device available" << std::endl;
+		stop_http_thread();
+		stop_database_thread();
 		return EXIT_FAILURE;
 	}
 
-	if(db_manager.open_network_replies())
+	// the readings of the sessions above may still be queued to the database thread
+	db_manager.WaitForQueuedRequests();
+	if(daemon_mode)
+	{
+		// returns after SIGTERM or SIGINT, the dumps still queued to the database thread are
+		// encoded and their writes given time to complete before the threads are stopped
 		app.exec();
+		db_manager.WaitForQueuedRequests();
+		const auto drain_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while(db_manager.open_network_replies() && std::chrono::steady_clock::now() < drain_deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		if(db_manager.open_network_replies())
+			std::cout << db_manager.open_network_replies()
+				<< " database writes still open at shutdown" << std::endl;
+	}
+	else
+	{
+		// replies may have run out between two sessions already, every time they did
+		// the event loop is quit once more
+		while(db_manager.open_network_replies())
+			app.exec();
+	}
+
+	stop_http_thread();
+	stop_database_thread();
+	session_statistics.Print(std::cout);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,213 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "metrics_registry.h"
+
+const char *MetricsRegistry::content_type = "text/plain; version=0.0.4; charset=utf-8";
+
+namespace {
+
+// Upper bounds in microseconds of the exported histogram buckets.
+const uint64_t histogram_bounds_us[] = {
+	1000, 5000, 10000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000, 30000000, 60000000 };
+
+const char * const histogram_bounds_label[] = {
+	"le=\"0.001\"", "le=\"0.005\"", "le=\"0.01\"", "le=\"0.05\"", "le=\"0.1\"",
+	"le=\"0.25\"", "le=\"0.5\"", "le=\"1\"", "le=\"2.5\"", "le=\"5\"", "le=\"10\"",
+	"le=\"30\"", "le=\"60\"" };
+
+const unsigned int number_of_histogram_bounds =
+	sizeof(histogram_bounds_us) / sizeof(histogram_bounds_us[0]);
+
+} // namespace
+
+
+void MetricsRegistry::RegisterCounter(const std::atomic<uint64_t> & counter, const char * name,
+		const char * help, const std::string & labels)
+{
+	Register(COUNTER, &counter, name, help, labels);
+}
+
+void MetricsRegistry::RegisterGauge(const std::atomic<int64_t> & gauge, const char * name,
+		const char * help, const std::string & labels)
+{
+	Register(GAUGE, &gauge, name, help, labels);
+}
+
+void MetricsRegistry::RegisterAgeGauge(const std::atomic<int64_t> & unix_seconds,
+		const char * name, const char * help, const std::string & labels)
+{
+	Register(AGE_GAUGE, &unix_seconds, name, help, labels);
+}
+
+void MetricsRegistry::RegisterHistogram(const LatencyHistogram & histogram, const char * name,
+		const char * help, const std::string & labels)
+{
+	Register(HISTOGRAM, &histogram, name, help, labels);
+}
+
+void MetricsRegistry::Register(const MetricType type, const void * metric, const char * name,
+		const char * help, const std::string & labels)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// insert behind the last entry of the same family
+	auto position = entries_.end();
+	for (auto entry = entries_.begin(); entry != entries_.end(); ++entry) {
+		if(!std::strcmp(entry->name, name))
+			position = entry + 1;
+	}
+	entries_.insert(position, Entry{type, metric, name, help, labels});
+}
+
+void MetricsRegistry::WritePrometheus(std::string * output,
+		const std::chrono::system_clock::time_point now) const
+{
+	const int64_t now_seconds = std::chrono::duration_cast<std::chrono::seconds>(
+			now.time_since_epoch()).count();
+	char value[32];
+
+	output->clear();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	const char * family = nullptr;
+	for (const Entry & entry : entries_) {
+		if(!family || std::strcmp(family, entry.name))
+		{
+			family = entry.name;
+			output->append("# HELP ").append(entry.name).append(" ").append(entry.help)
+				.append("\n# TYPE ").append(entry.name).append(" ")
+				.append(TypeName(entry.type)).append("\n");
+		}
+
+		switch (entry.type) {
+			case COUNTER:
+			{
+				const auto * counter = static_cast<const std::atomic<uint64_t> *>(entry.metric);
+				std::snprintf(value, sizeof(value), "%" PRIu64,
+						counter->load(std::memory_order_relaxed));
+				AppendSample(output, entry.name, "", entry.labels, nullptr, value);
+				break;
+			}
+			case GAUGE:
+			{
+				const auto * gauge = static_cast<const std::atomic<int64_t> *>(entry.metric);
+				std::snprintf(value, sizeof(value), "%" PRId64,
+						gauge->load(std::memory_order_relaxed));
+				AppendSample(output, entry.name, "", entry.labels, nullptr, value);
+				break;
+			}
+			case AGE_GAUGE:
+			{
+				const auto * unix_seconds =
+					static_cast<const std::atomic<int64_t> *>(entry.metric);
+				const int64_t timestamp = unix_seconds->load(std::memory_order_relaxed);
+				if(!timestamp)
+					break;
+				std::snprintf(value, sizeof(value), "%" PRId64, now_seconds - timestamp);
+				AppendSample(output, entry.name, "", entry.labels, nullptr, value);
+				break;
+			}
+			case HISTOGRAM:
+			{
+				const auto * histogram = static_cast<const LatencyHistogram *>(entry.metric);
+
+				// cumulative counts of all internal buckets below each exported bound
+				uint64_t cumulative_count = 0;
+				unsigned int bucket = 0;
+				for (unsigned int bound = 0; bound < number_of_histogram_bounds; ++bound) {
+					while(bucket < LatencyHistogram::BUCKET_COUNT &&
+							LatencyHistogram::BucketUpperBound(bucket) <=
+							histogram_bounds_us[bound])
+						cumulative_count += histogram->bucket_count(bucket++);
+
+					std::snprintf(value, sizeof(value), "%" PRIu64, cumulative_count);
+					AppendSample(output, entry.name, "_bucket", entry.labels,
+							histogram_bounds_label[bound], value);
+				}
+
+				const uint64_t count = histogram->count();
+				std::snprintf(value, sizeof(value), "%" PRIu64, count);
+				AppendSample(output, entry.name, "_bucket", entry.labels, "le=\"+Inf\"", value);
+				std::snprintf(value, sizeof(value), "%.6f", histogram->sum() / 1e6);
+				AppendSample(output, entry.name, "_sum", entry.labels, nullptr, value);
+				std::snprintf(value, sizeof(value), "%" PRIu64, count);
+				AppendSample(output, entry.name, "_count", entry.labels, nullptr, value);
+				break;
+			}
+		}
+	}
+}
+
+const char * MetricsRegistry::TypeName(const MetricType type)
+{
+	switch (type) {
+		case COUNTER: return "counter";
+		case HISTOGRAM: return "histogram";
+		default: return "gauge";
+	}
+}
+
+void MetricsRegistry::AppendSample(std::string * output, const char * name, const char * suffix,
+		const std::string & labels, const char * extra_label, const char * value)
+{
+	output->append(name).append(suffix);
+	if(!labels.empty() || extra_label)
+	{
+		output->append("{").append(labels);
+		if(extra_label)
+		{
+			if(!labels.empty())
+				output->append(",");
+			output->append(extra_label);
+		}
+		output->append("}");
+	}
+	output->append(" ").append(value).append("\n");
+}
+
+std::string MetricsRegistry::Label(const char * name, const std::string & value)
+{
+	std::string label(name);
+	label.append("=\"");
+	for (const char character : value) {
+		if(character == '\\' || character == '"')
+			label.push_back('\\');
+		if(character == '\n')
+			label.append("\\n");
+		else
+			label.push_back(character);
+	}
+	label.append("\"");
+	return label;
+}
@@ -0,0 +1,108 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef METRICS_REGISTRY_H_F9ZT2KCW
+#define METRICS_REGISTRY_H_F9ZT2KCW
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.h"
+
+// Registry of counters, gauges and histograms that are exported in the Prometheus text
+// format. The metrics themselves are plain atomics or LatencyHistograms owned by the
+// components that update them, the registry only keeps references. Updating a metric is
+// a relaxed atomic operation, registering one is meant for startup or the first session
+// of a node. Rendering reuses the capacity of the output string and does not allocate
+// once it has grown to its working size.
+// Example usage:
+// 	std::atomic<uint64_t> bytes_received(0);
+// 	registry.RegisterCounter(bytes_received, "beehive_bytes_received_total",
+// 			"Bytes received from nodes.", MetricsRegistry::Label("device", id));
+class MetricsRegistry
+{
+public:
+	MetricsRegistry () {}
+	~MetricsRegistry () {}
+
+	MetricsRegistry (const MetricsRegistry &) = delete;
+	MetricsRegistry & operator=(const MetricsRegistry &) = delete;
+
+	// Metrics with equal name must be registered with equal help text and distinct labels.
+	// labels is a comma separated list of name="value" pairs, see Label().
+	void RegisterCounter(const std::atomic<uint64_t> & counter, const char * name,
+			const char * help, const std::string & labels = std::string());
+
+	void RegisterGauge(const std::atomic<int64_t> & gauge, const char * name,
+			const char * help, const std::string & labels = std::string());
+
+	// Exports the seconds elapsed since the unix time stored in unix_seconds. Nothing is
+	// exported while unix_seconds is 0.
+	void RegisterAgeGauge(const std::atomic<int64_t> & unix_seconds, const char * name,
+			const char * help, const std::string & labels = std::string());
+
+	// Exports histogram of microseconds as a Prometheus histogram in seconds.
+	void RegisterHistogram(const LatencyHistogram & histogram, const char * name,
+			const char * help, const std::string & labels = std::string());
+
+	// Writes all registered metrics in the Prometheus text format (version 0.0.4) to output.
+	void WritePrometheus(std::string * output,
+			const std::chrono::system_clock::time_point now =
+			std::chrono::system_clock::now()) const;
+
+	// Returns the escaped label pair name="value".
+	static std::string Label(const char * name, const std::string & value);
+
+	// Content type of the text format written by WritePrometheus().
+	static const char * content_type;
+
+private:
+	enum MetricType { COUNTER, GAUGE, AGE_GAUGE, HISTOGRAM };
+
+	struct Entry {
+		MetricType type;
+		const void * metric;
+		const char * name;
+		const char * help;
+		std::string labels;
+	};
+
+	void Register(const MetricType type, const void * metric, const char * name,
+			const char * help, const std::string & labels);
+
+	static const char * TypeName(const MetricType type);
+
+	static void AppendSample(std::string * output, const char * name, const char * suffix,
+			const std::string & labels, const char * extra_label, const char * value);
+
+	mutable std::mutex mutex_;
+	// grouped by name, so every family is written as one block
+	std::vector<Entry> entries_;
+};
+
+
+#endif /* end of include guard: METRICS_REGISTRY_H_F9ZT2KCW */
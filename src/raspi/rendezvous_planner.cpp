@@ -0,0 +1,129 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "device_table.h"
+#include "rendezvous_planner.h"
+#include "../protocol_definitions/communication_structs.h"
+
+
+void RendezvousPlanner::AddDevice(const DeviceHandle device)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	devices_.emplace(device,
+			Device{std::chrono::system_clock::time_point(), false, false, 0});
+}
+
+void RendezvousPlanner::RemoveDevice(const DeviceHandle device)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	devices_.erase(device);
+}
+
+void RendezvousPlanner::Plan(const DeviceHandle device,
+		const std::chrono::system_clock::time_point expected_wake)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Device & planned_device = devices_[device];
+
+	planned_device.next_connect = expected_wake - lead_time_;
+	planned_device.planned = true;
+	planned_device.in_flight = false;
+	planned_device.failures = 0;
+}
+
+void RendezvousPlanner::SessionFinished(const DeviceHandle device_handle, const bool success,
+		const std::chrono::system_clock::time_point now)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto device = devices_.find(device_handle);
+	// a new plan made during the session replaces the old one
+	if(device == devices_.end() || !device->second.in_flight)
+		return;
+
+	device->second.in_flight = false;
+	if(!success && device->second.planned && ++device->second.failures <= MAX_RETRIES)
+	{
+		device->second.next_connect = now + retry_interval_;
+		return;
+	}
+
+	device->second.planned = false;
+	device->second.failures = 0;
+	device->second.next_connect = now + probe_interval_;
+}
+
+std::vector<DeviceHandle> RendezvousPlanner::TakeDue(const std::chrono::system_clock::time_point now)
+{
+	std::vector<std::pair<std::chrono::system_clock::time_point, DeviceHandle>> due;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto & device : devices_) {
+		if(!device.second.in_flight && device.second.next_connect <= now)
+		{
+			device.second.in_flight = true;
+			due.emplace_back(device.second.next_connect, device.first);
+		}
+	}
+
+	// longest waiting node first
+	std::sort(due.begin(), due.end());
+	std::vector<DeviceHandle> result;
+	result.reserve(due.size());
+	for (const auto & device : due)
+		result.push_back(device.second);
+	return result;
+}
+
+std::chrono::system_clock::time_point RendezvousPlanner::NextDue(
+		const std::chrono::system_clock::time_point now) const
+{
+	std::chrono::system_clock::time_point next_due = now + probe_interval_;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (const auto & device : devices_) {
+		if(!device.second.in_flight && device.second.next_connect < next_due)
+			next_due = device.second.next_connect;
+	}
+	return next_due;
+}
+
+std::chrono::system_clock::time_point RendezvousPlanner::ExpectedWake(
+		const std::chrono::system_clock::time_point collection_start,
+		const uint32_t interval_length_seconds)
+{
+	// the first reading is taken at collection_start
+	return collection_start +
+		std::chrono::seconds(uint64_t(MAX_NUMBER_OF_READINGS - 1) * interval_length_seconds);
+}
+
+void RendezvousPlanner::set_probe_interval(const std::chrono::seconds probe_interval)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	probe_interval_ = probe_interval;
+}
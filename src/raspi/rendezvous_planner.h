@@ -0,0 +1,105 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef RENDEZVOUS_PLANNER_H_F5MW0RXC
+#define RENDEZVOUS_PLANNER_H_F5MW0RXC
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "device_table.h"
+
+// Keeps track of when each node powers its Bluetooth module so the master can open the rfcomm
+// port right before instead of scanning for nodes.
+// A node starts collecting at the collection start time of its rendezvous answer, takes
+// MAX_NUMBER_OF_READINGS readings every interval and powers up Bluetooth together with its last
+// reading. It then waits a few minutes for the master, so a missed connect can simply be
+// retried. A node the master missed keeps sampling and powers up again with backoff, it is
+// found by the probes of devices without a plan (new nodes waiting for INIT or nodes whose
+// plan got lost) every probe interval.
+class RendezvousPlanner
+{
+public:
+	RendezvousPlanner (const std::chrono::seconds lead_time,
+			const std::chrono::seconds retry_interval,
+			const std::chrono::seconds probe_interval) :
+		lead_time_(lead_time),
+		retry_interval_(retry_interval),
+		probe_interval_(probe_interval)
+	{}
+	~RendezvousPlanner () {}
+
+	// Adds a known device without a plan, it is probed right away.
+	void AddDevice(const DeviceHandle device);
+
+	// Forgets device, e.g. after it was removed from the device mapping.
+	void RemoveDevice(const DeviceHandle device);
+
+	// Plans a connect to device right before expected_wake.
+	void Plan(const DeviceHandle device,
+			const std::chrono::system_clock::time_point expected_wake);
+
+	// Reports the outcome of a connect handed out by TakeDue. Failed planned connects are
+	// retried every retry interval up to MAX_RETRIES times, afterwards the device is probed.
+	void SessionFinished(const DeviceHandle device, const bool success,
+			const std::chrono::system_clock::time_point now);
+
+	// Returns all devices due at now. They are not handed out again until SessionFinished
+	// or Plan is called for them.
+	std::vector<DeviceHandle> TakeDue(const std::chrono::system_clock::time_point now);
+
+	// Earliest time a device becomes due, now + probe interval if nothing is planned.
+	std::chrono::system_clock::time_point NextDue(
+			const std::chrono::system_clock::time_point now) const;
+
+	// Time the node powers Bluetooth after starting its collection at collection_start.
+	static std::chrono::system_clock::time_point ExpectedWake(
+			const std::chrono::system_clock::time_point collection_start,
+			const uint32_t interval_length_seconds);
+
+	// mutators
+	void set_probe_interval(const std::chrono::seconds probe_interval);
+
+private:
+	struct Device
+	{
+		std::chrono::system_clock::time_point next_connect;
+		bool planned;
+		bool in_flight;
+		unsigned int failures;
+	};
+
+	static const unsigned int MAX_RETRIES = 5;
+
+	std::chrono::seconds lead_time_;
+	std::chrono::seconds retry_interval_;
+	std::chrono::seconds probe_interval_;
+	mutable std::mutex mutex_;
+	std::unordered_map<DeviceHandle, Device> devices_;
+};
+
+
+#endif /* end of include guard: RENDEZVOUS_PLANNER_H_F5MW0RXC */
@@ -0,0 +1,145 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <iostream>
+#include <memory>
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+#include "device_registry.h"
+#include "MAC_device_parser.h"
+#include "rfcomm_binder.h"
+
+
+RfcommBinder::RfcommBinder(MACDeviceParser * parser_ptr, QObject * parent) :
+	QObject(parent),
+	parser_ptr_(parser_ptr),
+	step_(STEP_BIND)
+{
+	connect(&rfcomm_process_, SIGNAL(finished(int, QProcess::ExitStatus)),
+			this, SLOT(BindFinished(int, QProcess::ExitStatus)));
+	connect(&rfcomm_process_, SIGNAL(error(QProcess::ProcessError)),
+			this, SLOT(BindFailed(QProcess::ProcessError)));
+}
+
+void RfcommBinder::Bind(const QStringList & device_ids)
+{
+	for (const QString & device_id : device_ids) {
+		if(!pending_devices_.contains(device_id))
+			pending_devices_.append(device_id);
+	}
+
+	if(rfcomm_process_.state() == QProcess::NotRunning)
+		BindNext();
+}
+
+void RfcommBinder::BindAll()
+{
+	QStringList device_ids;
+	const auto registry = parser_ptr_->registry();
+	for (const auto & device : registry->devices())
+		device_ids.append(QString::fromStdString(device.device_id));
+	Bind(device_ids);
+}
+
+void RfcommBinder::BindNext()
+{
+	static const QString rfcomm_path_prefix("/dev/rfcomm");
+
+	const auto registry = parser_ptr_->registry();
+	while(!pending_devices_.isEmpty()) {
+		const QString device_id = pending_devices_.takeFirst();
+		const DeviceRegistry::Device * const device =
+			registry->Find(device_id.utf16(), device_id.size());
+		if(!device)
+			continue;
+
+		const QString file_path = QString::fromStdString(device->file_path);
+		bool valid_number = false;
+		const unsigned int port_number =
+			file_path.mid(rfcomm_path_prefix.size()).toUInt(&valid_number);
+		if(!file_path.startsWith(rfcomm_path_prefix) || !valid_number)
+			continue;
+
+		device_id_ = QString::fromStdString(device->device_id);
+		port_number_ = QString::number(port_number);
+		// an existing port may still be bound to the device that had it before
+		Run(QFile::exists(file_path) ? STEP_SHOW : STEP_BIND);
+		return;
+	}
+}
+
+void RfcommBinder::Run(const Step step)
+{
+	step_ = step;
+	switch (step) {
+		case STEP_SHOW:
+			rfcomm_process_.start("rfcomm", QStringList() << "show" << port_number_);
+			break;
+		case STEP_RELEASE:
+			std::cout << "release /dev/rfcomm" << port_number_.toStdString() <<
+				" for " << device_id_.toStdString() << std::endl;
+			rfcomm_process_.start("rfcomm", QStringList() << "release" << port_number_);
+			break;
+		case STEP_BIND:
+			std::cout << "bind /dev/rfcomm" << port_number_.toStdString() <<
+				" to " << device_id_.toStdString() << std::endl;
+			rfcomm_process_.start("rfcomm", QStringList() << "bind" << port_number_ << device_id_);
+			break;
+	}
+}
+
+void RfcommBinder::BindFinished(const int exit_code, const QProcess::ExitStatus exit_status)
+{
+	const bool succeeded = exit_status == QProcess::NormalExit && exit_code == 0;
+	switch (step_) {
+		case STEP_SHOW:
+			// e.g. "rfcomm0: 00:11:22:33:44:55 channel 1 clean"
+			if(succeeded && QString::fromLatin1(rfcomm_process_.readAllStandardOutput())
+					.contains(device_id_, Qt::CaseInsensitive))
+				break;
+			Run(STEP_RELEASE);
+			return;
+		case STEP_RELEASE:
+			// a port that is not bound cannot be released, binding tells if it is usable
+			Run(STEP_BIND);
+			return;
+		case STEP_BIND:
+			if(!succeeded)
+				std::cout << "rfcomm bind failed: " <<
+					rfcomm_process_.readAllStandardError().toStdString() << std::endl;
+			break;
+	}
+	BindNext();
+}
+
+void RfcommBinder::BindFailed(const QProcess::ProcessError error)
+{
+	// finished() is not emitted if the process could not be started at all
+	if(error == QProcess::FailedToStart)
+	{
+		std::cout << "could not start rfcomm" << std::endl;
+		BindNext();
+	}
+}
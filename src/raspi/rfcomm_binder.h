@@ -0,0 +1,77 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef RFCOMM_BINDER_H_S0GD5UHX
+#define RFCOMM_BINDER_H_S0GD5UHX
+
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+
+#include "MAC_device_parser.h"
+
+// Creates the rfcomm port bindings of known devices on demand by running
+// 'rfcomm bind <n> <MAC>' for every device whose /dev/rfcomm<n> does not exist yet. A port
+// that exists is checked with 'rfcomm show <n>' and released and bound again if it belongs
+// to another MAC, e.g. after a device got the port of a removed one.
+// This replaces the fixed list of bindings in init.sh. Binding needs CAP_NET_ADMIN.
+class RfcommBinder : public QObject
+{
+	Q_OBJECT
+public:
+	explicit RfcommBinder (MACDeviceParser * parser_ptr, QObject * parent = nullptr);
+	~RfcommBinder () {}
+
+public slots:
+	// Binds the ports of the given devices, one rfcomm process at a time.
+	void Bind(const QStringList & device_ids);
+	// Binds the ports of all known devices.
+	void BindAll();
+
+private slots:
+	void BindNext();
+	void BindFinished(const int exit_code, const QProcess::ExitStatus exit_status);
+	void BindFailed(const QProcess::ProcessError error);
+
+private:
+	// rfcomm commands run for a device, in this order
+	enum Step {
+		STEP_SHOW,
+		STEP_RELEASE,
+		STEP_BIND
+	};
+
+	// Runs step for the current device.
+	void Run(const Step step);
+
+	MACDeviceParser *parser_ptr_;
+	QProcess rfcomm_process_;
+	QStringList pending_devices_;
+	// device the running rfcomm process is about
+	QString device_id_;
+	QString port_number_;
+	Step step_;
+};
+
+
+#endif /* end of include guard: RFCOMM_BINDER_H_S0GD5UHX */
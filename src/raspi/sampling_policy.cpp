@@ -0,0 +1,138 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+#include "database_manager.h"
+#include "device_table.h"
+#include "sampling_policy.h"
+#include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
+
+
+constexpr double SamplingPolicy::high_activity;
+constexpr double SamplingPolicy::low_activity;
+constexpr double SamplingPolicy::smoothing_factor;
+
+void SamplingPolicy::AddDump(const DeviceHandle device,
+		const temperature_readings_header & header,
+		const unsigned char * readings,
+		const std::size_t number_of_readings)
+{
+	const ReadingDecoder decoder(header);
+	if(number_of_readings < 2 || !header.interval_length_seconds || !decoder.valid())
+		return;
+
+	// mean squared successive difference of all sensors, in degrees so it does not depend
+	// on the ADC resolution of the node
+	const double scale_factor = DatabaseManager::RawToCelsius(1, decoder.adc_bits());
+	uint16_t previous[MAX_SENSOR_COUNT];
+	uint16_t current[MAX_SENSOR_COUNT];
+	decoder.Unpack(readings, 0, previous);
+
+	double squared_differences = 0.0;
+	for (std::size_t i = 1; i < number_of_readings; ++i) {
+		decoder.Unpack(readings, i, current);
+		for (unsigned int sensor = 0; sensor < decoder.sensor_count(); ++sensor) {
+			const double difference =
+				(int(current[sensor]) - int(previous[sensor])) * scale_factor;
+			squared_differences += difference * difference;
+			previous[sensor] = current[sensor];
+		}
+	}
+
+	// normalize to one minute, successive differences grow with the interval
+	const double activity = squared_differences /
+		(decoder.sensor_count() * (number_of_readings - 1.0)) /
+		(header.interval_length_seconds / 60.0);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto known_device = devices_.find(device);
+	if(known_device == devices_.end())
+	{
+		devices_.emplace(device, DeviceActivity{activity, 1, header.interval_length_seconds});
+		return;
+	}
+
+	known_device->second.smoothed_activity += smoothing_factor *
+		(activity - known_device->second.smoothed_activity);
+	++known_device->second.number_of_dumps;
+	known_device->second.last_interval_seconds = header.interval_length_seconds;
+}
+
+uint32_t SamplingPolicy::LastInterval(const DeviceHandle device) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto known_device = devices_.find(device);
+	return known_device != devices_.end() ? known_device->second.last_interval_seconds : 0;
+}
+
+uint32_t SamplingPolicy::IntervalFor(const DeviceHandle device,
+		const std::chrono::system_clock::time_point time_point) const
+{
+	const Season season = SeasonAt(time_point);
+	int level = season == SEASON_BROOD ? 0 : season == SEASON_WINTER ? 2 : 1;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto known_device = devices_.find(device);
+		if(known_device != devices_.end())
+		{
+			if(known_device->second.smoothed_activity >= high_activity)
+				--level;
+			else if(known_device->second.smoothed_activity <= low_activity &&
+					known_device->second.number_of_dumps >= minimum_dumps)
+				++level;
+		}
+	}
+
+	if(level < 0)
+		level = 0;
+	if(level > maximum_level)
+		level = maximum_level;
+
+	// level 0 halves the base interval, every further level doubles it
+	const uint32_t interval = level ? base_interval_seconds_ << (level - 1) : base_interval_seconds_ / 2;
+	return interval;
+}
+
+SamplingPolicy::Season SamplingPolicy::SeasonAt(const std::chrono::system_clock::time_point time_point)
+{
+	const std::time_t time_c = std::chrono::system_clock::to_time_t(time_point);
+	std::tm local_time;
+	localtime_r(&time_c, &local_time);
+
+	// tm_mon counts from 0 = January
+	switch (local_time.tm_mon) {
+		case 10: case 11: case 0: case 1:
+			return SEASON_WINTER;
+		case 3: case 4: case 5: case 6: case 7:
+			return SEASON_BROOD;
+		default:
+			return SEASON_TRANSITION;
+	}
+}
@@ -0,0 +1,98 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef SAMPLING_POLICY_H_N8QV3LZA
+#define SAMPLING_POLICY_H_N8QV3LZA
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "device_table.h"
+#include "../protocol_definitions/communication_structs.h"
+
+// Chooses the sampling interval of every node from the season and the activity seen in its
+// recent dumps. Intervals are always base_interval_seconds scaled by a power of two, so the
+// samples of a node keep their position within the schedule blocks:
+//
+//	level	interval		used for
+//	0	base / 2		brood season, high activity in spring and autumn
+//	1	base			spring and autumn, brood season with low activity
+//	2	2 * base		winter, low activity in spring and autumn
+//	3	4 * base		winter with low activity
+//
+// Activity is the mean squared difference of successive readings per minute, averaged over
+// the sensors of a node and smoothed over its dumps.
+class SamplingPolicy
+{
+public:
+	enum Season { SEASON_WINTER, SEASON_TRANSITION, SEASON_BROOD };
+
+	explicit SamplingPolicy (const uint32_t base_interval_seconds) :
+		base_interval_seconds_(base_interval_seconds)
+	{}
+	~SamplingPolicy () {}
+
+	// Updates the activity estimate of device from a received dump.
+	void AddDump(const DeviceHandle device,
+			const temperature_readings_header & header,
+			const unsigned char * readings,
+			const std::size_t number_of_readings);
+
+	// Interval of the last dump received from device, 0 if there was none.
+	uint32_t LastInterval(const DeviceHandle device) const;
+
+	// Returns the sampling interval device should use from time_point on.
+	uint32_t IntervalFor(const DeviceHandle device,
+			const std::chrono::system_clock::time_point time_point) const;
+
+	// Season of the local calendar month of time_point (northern hemisphere).
+	static Season SeasonAt(const std::chrono::system_clock::time_point time_point);
+
+private:
+	struct DeviceActivity
+	{
+		double smoothed_activity;
+		unsigned int number_of_dumps;
+		uint32_t last_interval_seconds;
+	};
+
+	// activity in degree Celsius squared per minute
+	static constexpr double high_activity = 0.05;
+	static constexpr double low_activity = 0.005;
+	// weight of the newest dump in the smoothed activity
+	static constexpr double smoothing_factor = 0.3;
+	// dumps needed before low activity may slow a node down
+	static const unsigned int minimum_dumps = 2;
+	static const int maximum_level = 3;
+
+	const uint32_t base_interval_seconds_;
+	mutable std::mutex mutex_;
+	std::unordered_map<DeviceHandle, DeviceActivity> devices_;
+};
+
+
+#endif /* end of include guard: SAMPLING_POLICY_H_N8QV3LZA */
@@ -20,67 +20,174 @@
 // TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
 #include <future>
 #include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <iostream>
 #include <memory>
 #include <ratio>
+#include <string>
 #include <utility>
 #include <vector>
 
-#include <QString>
-#include <QJsonArray>
-
 #include "database_manager.h"
+#include "device_table.h"
+#include "latency_histogram.h"
 #include "MAC_device_parser.h"
+#include "rendezvous_planner.h"
+#include "sampling_policy.h"
 #include "scheduler.h"
+#include "session_statistics.h"
+#include "slot_allocator.h"
 #include "../protocol_definitions/communication_structs.h"
 
 
+template<int Granularity> const int Scheduler<Granularity>::scheduling_horizon_hours_;
+template<int Granularity> const int Scheduler<Granularity>::default_slot_seconds_;
+template<int Granularity> const int Scheduler<Granularity>::guard_seconds_;
+template<int Granularity> const int Scheduler<Granularity>::rendezvous_lead_seconds_;
+template<int Granularity> const int Scheduler<Granularity>::rendezvous_retry_seconds_;
+
 template<int Granularity>
 std::unique_ptr<rendezvous_answer> 
-Scheduler<Granularity>::ScheduleNextCollectionStart(const QString device_id)
+Scheduler<Granularity>::ScheduleNextCollectionStart(const DeviceHandle device)
 {
-	std::unique_ptr<rendezvous_answer> result_ptr(new rendezvous_answer);
+	std::unique_ptr<rendezvous_answer> result_ptr(new rendezvous_answer());
 
 	const std::chrono::system_clock::time_point current_time = 
 		std::chrono::system_clock::now();
 
-	//const std::vector< std::pair<std::string,std::chrono::system_clock::time_point> > 
 	const auto returned_vector = std::move(
 			db_manager_ptr_->FetchCollectionStartTimes(current_time));
 	std::cout << "Fetched " << returned_vector.size() << " collection start times" << std::endl;
 
-	std::chrono::system_clock::time_point last_time_point;
-	if(!returned_vector.empty())
-		last_time_point = std::move(returned_vector.front().second);
-	else
-		last_time_point = current_time;
-
-	std::chrono::minutes duration_mins_epoch =  
-		std::chrono::duration_cast< std::chrono::minutes >(last_time_point.time_since_epoch());
-	
-	//std::cout << "duration length: " << duration_mins_epoch.count() << std::endl;
-	duration_mins_epoch += std::chrono::minutes(Granularity) - (duration_mins_epoch % std::chrono::minutes(Granularity));
-	//std::cout << "duration length after increase: " << duration_mins_epoch.count() << std::endl;
+	slot_allocator_.SetSlotLength(MeasuredSlotLength());
 
-	const auto difference = std::chrono::duration_cast<std::chrono::seconds>(
-			duration_mins_epoch - current_time.time_since_epoch());
+	// rendezvous of the other nodes, possibly set by an earlier process
+	for (const auto & collection : returned_vector)
+		slot_allocator_.Reserve(collection.device,
+				RendezvousPlanner::ExpectedWake(collection.start_time, StoredInterval(collection)));
 
-	static const int guard_seconds = 10;
-	// are we now too close to scheduled start time? -then add another interval
-	if(difference.count() <= guard_seconds)
-		duration_mins_epoch += std::chrono::minutes(Granularity);
+	const uint32_t interval = SamplingInterval(device);
+	const auto collection_length = RendezvousPlanner::ExpectedWake(
+			std::chrono::system_clock::time_point(), interval).time_since_epoch();
 
-	const auto scheduled_time = std::chrono::system_clock::time_point(duration_mins_epoch);
+	// never schedule the collection start closer to now than guard_seconds_
+	const auto expected_wake = slot_allocator_.Allocate(device,
+			current_time + std::chrono::seconds(guard_seconds_) + collection_length);
+	const auto scheduled_time = expected_wake - collection_length;
 
-	//std::cout << "fetched time: " << last_time_point.time_since_epoch().count() << std::endl;
-	//std::cout << "scheduled time: " << scheduled_time.time_since_epoch().count() << std::endl;
-	db_manager_ptr_->ScheduledTimeToDatabase(device_id, scheduled_time);
+	db_manager_ptr_->ScheduledTimeToDatabase(device, scheduled_time, interval);
 	std::cout << "Pushed scheduled time " << scheduled_time.time_since_epoch().count() << " to database" << std::endl;
+	PlanRendezvous(device, expected_wake);
+
 	db_manager_ptr_->TimeConvertToDeviceTime(scheduled_time, 
 			&(result_ptr->collection_start_time));
+	result_ptr->interval_length_seconds = interval;
 	return std::move(result_ptr);
 }
 
+template<int Granularity>
+void Scheduler<Granularity>::SeedRendezvousPlans()
+{
+	const auto scheduled_collections = db_manager_ptr_->FetchCollectionStartTimes(
+			std::chrono::system_clock::now());
+
+	for (const auto & collection : scheduled_collections) {
+		const auto expected_wake = RendezvousPlanner::ExpectedWake(collection.start_time,
+				StoredInterval(collection));
+		slot_allocator_.Reserve(collection.device, expected_wake);
+		PlanRendezvous(collection.device, expected_wake);
+	}
+}
+
+template<int Granularity>
+void Scheduler<Granularity>::PlanAfterDump(const DeviceHandle device)
+{
+	const uint32_t interval = sampling_policy_.LastInterval(device);
+	if(!interval)
+		return;
+
+	// the node starts over with its next reading one interval from now
+	const auto expected_wake = RendezvousPlanner::ExpectedWake(
+			std::chrono::system_clock::now() + std::chrono::seconds(interval), interval);
+	slot_allocator_.Reserve(device, expected_wake);
+	PlanRendezvous(device, expected_wake);
+}
+
+template<int Granularity>
+void Scheduler<Granularity>::RecordDump(const DeviceHandle device,
+		const temperature_readings_header & header,
+		const unsigned char * readings,
+		const std::size_t number_of_readings,
+		const std::chrono::system_clock::time_point node_time_read)
+{
+	sampling_policy_.AddDump(device, header, readings, number_of_readings);
+
+	// the node time stays zero if the node could not read its RTC
+	if(header.node_time.date)
+	{
+		std::chrono::system_clock::time_point node_time;
+		DatabaseManager::TimeConvertToHostTime(header.node_time, &node_time);
+		// the RTC counts whole seconds, on average it was read half way through one
+		clock_drift_.AddSample(device, node_time + std::chrono::milliseconds(500),
+				node_time_read);
+	}
+}
+
+template<int Granularity>
+uint32_t Scheduler<Granularity>::SamplingInterval(const DeviceHandle device) const
+{
+	const uint32_t interval = sampling_policy_.IntervalFor(device,
+			std::chrono::system_clock::now());
+	std::cout << "sampling interval of " <<
+		MAC_parser_ptr_->device_table().entry(device).device_id << ": " <<
+		interval << "s" << std::endl;
+	return interval;
+}
+
+template<int Granularity>
+uint32_t Scheduler<Granularity>::StoredInterval(const ScheduledCollection & collection)
+{
+	return collection.interval_length_seconds > 1 ? collection.interval_length_seconds :
+		Granularity * 60;
+}
+
+template<int Granularity>
+void Scheduler<Granularity>::PlanRendezvous(const DeviceHandle device,
+		const std::chrono::system_clock::time_point expected_wake)
+{
+	planner_.Plan(device, expected_wake);
+	// the missing dump alert waits for the same wake
+	db_manager_ptr_->RendezvousPlanned(device, expected_wake);
+
+	const std::time_t wake_c_time = std::chrono::system_clock::to_time_t(expected_wake);
+	std::cout << "planned rendezvous with " <<
+		MAC_parser_ptr_->device_table().entry(device).device_id << " at " <<
+		std::ctime(&wake_c_time);
+}
+
+template<int Granularity>
+std::chrono::seconds Scheduler<Granularity>::MeasuredSlotLength() const
+{
+	if(!statistics_ptr_)
+		return std::chrono::seconds(default_slot_seconds_);
+
+	LatencyHistogram sessions;
+	statistics_ptr_->ForEachNode([&sessions](const std::string &, const NodeSessionStatistics & node)
+			{
+				sessions.Add(node.completed_sessions);
+			});
+
+	if(sessions.count() < minimum_sessions_for_slot_length_)
+		return std::chrono::seconds(default_slot_seconds_);
+
+	const auto p99 = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::microseconds(sessions.Percentile(0.99)));
+	return std::min(p99 + std::chrono::seconds(1 + guard_seconds_),
+			std::chrono::seconds(Granularity * 60 / minimum_slots_per_frame_));
+}
+
 template class 	Scheduler<5>;
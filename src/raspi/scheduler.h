@@ -25,32 +25,102 @@
 #ifndef SCHEDULER_H_ZETRFAXG
 #define SCHEDULER_H_ZETRFAXG
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
-#include <QString>
-
+#include "clock_drift_estimator.h"
 #include "database_manager.h"
+#include "device_table.h"
 #include "MAC_device_parser.h"
+#include "rendezvous_planner.h"
+#include "sampling_policy.h"
+#include "session_statistics.h"
+#include "slot_allocator.h"
 #include "../protocol_definitions/communication_structs.h"
 
 template< int Granularity = 5>
 class Scheduler
 {
 public:
+	// statistics_ptr provides the measured session durations the slot length is derived from.
 	Scheduler (DatabaseManager * db_manager_ptr,
-			MACDeviceParser * MAC_parser_ptr) :
+			MACDeviceParser * MAC_parser_ptr,
+			SessionStatistics * statistics_ptr) :
 		db_manager_ptr_(db_manager_ptr),
-		MAC_parser_ptr_(MAC_parser_ptr)
+		MAC_parser_ptr_(MAC_parser_ptr),
+		statistics_ptr_(statistics_ptr),
+		slot_allocator_(std::chrono::minutes(Granularity),
+				std::chrono::hours(scheduling_horizon_hours_),
+				std::chrono::seconds(default_slot_seconds_)),
+		sampling_policy_(Granularity * 60),
+		planner_(std::chrono::seconds(rendezvous_lead_seconds_),
+				std::chrono::seconds(rendezvous_retry_seconds_),
+				std::chrono::minutes(Granularity))
 	{}
 
 	~Scheduler () {}
 
-	// Schedule next collection start for the given device
-	std::unique_ptr<rendezvous_answer> ScheduleNextCollectionStart(const QString device_id);
+	// Schedule next collection start and sampling interval for the given device. The slot is
+	// chosen for the expected wake-up of the node which is handed to the rendezvous planner.
+	std::unique_ptr<rendezvous_answer> ScheduleNextCollectionStart(const DeviceHandle device);
+
+	// Plans the rendezvous of every device with a collection start in the database.
+	void SeedRendezvousPlans();
+
+	// Plans the next rendezvous of a node that dumped its readings and keeps collecting
+	// with its current schedule.
+	void PlanAfterDump(const DeviceHandle device);
+
+	// Feeds a completely received dump of device into its sampling policy and the clock
+	// drift estimate, node_time_read is when the node read the node time of the header.
+	void RecordDump(const DeviceHandle device,
+			const temperature_readings_header & header,
+			const unsigned char * readings,
+			const std::size_t number_of_readings,
+			const std::chrono::system_clock::time_point node_time_read);
+
+	// Sampling interval in seconds the given device should use from now on.
+	uint32_t SamplingInterval(const DeviceHandle device) const;
+
+	// access functions
+	RendezvousPlanner & planner() { return planner_; }
+	ClockDriftEstimator & clock_drift() { return clock_drift_; }
 
 private:
+	// Interval stored with a collection start, entries written before the interval was
+	// stored used one block.
+	static uint32_t StoredInterval(const ScheduledCollection & collection);
+
+	// Plans the rendezvous of device at expected_wake.
+	void PlanRendezvous(const DeviceHandle device,
+			const std::chrono::system_clock::time_point expected_wake);
+
+	// Returns the p99 duration of the completed sessions of all nodes plus a guard interval,
+	// at most the frame divided by minimum_slots_per_frame_, or default_slot_seconds_ as long as
+	// there are too few sessions for a percentile.
+	std::chrono::seconds MeasuredSlotLength() const;
+
 	DatabaseManager *db_manager_ptr_;
 	MACDeviceParser *MAC_parser_ptr_;
+	SessionStatistics *statistics_ptr_;
+	SlotAllocator slot_allocator_;
+	SamplingPolicy sampling_policy_;
+	RendezvousPlanner planner_;
+	ClockDriftEstimator clock_drift_;
+
+	// slots are allocated up to the latest possible wake-up
+	static const int scheduling_horizon_hours_ = DatabaseManager::collection_lookback_hours;
+	static const int default_slot_seconds_ = 20;
+	static const int guard_seconds_ = 10;
+	// open the port this long before the expected wake-up
+	static const int rendezvous_lead_seconds_ = 2;
+	static const int rendezvous_retry_seconds_ = 30;
+	static const unsigned int minimum_sessions_for_slot_length_ = 20;
+	// sessions that run into timeouts must not grow the slots until few nodes fit a frame
+	static const int minimum_slots_per_frame_ = 4;
 
 	// The hour is devided into minute blocks of size Granularity
 	static const unsigned int granularity_min_ = Granularity;
@@ -37,15 +37,21 @@
 #include <QFutureWatcher>
 
 #include "database_manager.h"
+#include "device_table.h"
+#include "dump_archive.h"
 #include "serial_communication.h"
+#include "session_statistics.h"
 #include "../protocol_definitions/communication_structs.h"
+#include "../protocol_definitions/protocol_codec.h"
 
 
-void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const QString & peer_name)
+bool SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const DeviceHandle peer)
 {
+	const auto session_start = std::chrono::steady_clock::now();
+	NodeSessionStatistics * const node_statistics = statistics_ptr_->Node(peer);
+
 	unsigned int request_number = 0;
 	bool socket_no_error = true;
-	enum message_enum { OKAY_MSG = 0,  INIT_MSG = 1, DATA_MSG = 2, DUMP_MSG = 3, TIME_MSG = 4, TEST_MSG = 5, FINI_MSG = 6 };
 
 	while(request_number < MAX_REQUESTS && socket_no_error)
 	{
@@ -61,8 +67,12 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 		// wait for request response upto TIMEOUT_MS
 		//socket_no_error = ReceiveNChars(command_str, bt_socket_ptr,
 		//		TIMEOUT_MS, MAX_COMMAND_LENGTH);
+		const auto command_wait_start = std::chrono::steady_clock::now();
 		socket_no_error = ReceiveNChars(command_str, bt_socket_ptr,
 				TIMEOUT_MS, 1);
+		node_statistics->Record(PHASE_COMMAND_WAIT, command_wait_start);
+		if(socket_no_error)
+			++node_statistics->bytes_received;
 
 
 		// check for CASE A - slave has sent 'INIT' 
@@ -73,24 +83,21 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 			std::cout << "INIT requested" << std::endl;
 			// start scheduling handling for the requesting device
 			std::future<std::unique_ptr<rendezvous_answer>> future_schedule =
-				std::async(
-					std::launch::async,
-					&Scheduler<5>::ScheduleNextCollectionStart, 
-					scheduler_, 
-					peer_name);
+				ScheduleAsync(peer, node_statistics);
 
 			bt_socket_ptr->putChar(OKAY_MSG);
 
 			const auto answer_unique_ptr( std::move(future_schedule.get()) );
-			//TODO change to 5 * 60 seconds value after DEBUG
-			answer_unique_ptr->interval_length_seconds = 300;
-			bt_socket_ptr->write((char *) answer_unique_ptr.get(), 
-					sizeof(rendezvous_answer));
+
+			const auto answer_start = std::chrono::steady_clock::now();
+			WriteRendezvousAnswer(bt_socket_ptr, *answer_unique_ptr);
 
 			struct timestamp stamp;
-			DatabaseManager::TimeConvertToDeviceTime(std::chrono::system_clock::now(),
-					&stamp);
-			bt_socket_ptr->write((char *) &stamp, sizeof(timestamp));
+			const auto time_sync = std::chrono::system_clock::now();
+			DatabaseManager::TimeConvertToDeviceTime(time_sync, &stamp);
+			WriteTimestamp(bt_socket_ptr, stamp);
+			scheduler_->clock_drift().Synchronized(peer);
+			node_statistics->Record(PHASE_ANSWER_WRITE, answer_start);
 		}
 
 		// check for CASE B1 - slave has sent 'DATA'
@@ -98,13 +105,15 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 		else if(command_str[0] == DATA_MSG)
 		{
 			std::cout << "DATA requested" << std::endl;
-			std::future<std::unique_ptr<rendezvous_answer>> future_schedule =
-				std::async(
-					std::launch::async,
-					&Scheduler<5>::ScheduleNextCollectionStart, 
-					scheduler_, 
-					peer_name);
-
+			// backpressure, the node is not answered until its dump can be stored
+			DumpSlot * const dump_slot = AcquireDumpSlot();
+			if(!dump_slot)
+			{
+				socket_no_error = false;
+				break;
+			}
+
+			const auto okay_time = std::chrono::system_clock::now();
 			bt_socket_ptr->putChar(OKAY_MSG);
 
 			//unsigned int counter = 0;
@@ -117,14 +126,22 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 			//	++counter;
 			//}
 
-			ReceiveAndStoreTemperatures(bt_socket_ptr, peer_name);
+			socket_no_error = ReceiveAndStoreTemperatures(bt_socket_ptr, peer,
+					dump_slot, node_statistics, okay_time);
 
-			auto answer_unique_ptr( move(future_schedule.get()) );
-			//TODO change to 5 * 60 seconds value after DEBUG
-			answer_unique_ptr->interval_length_seconds = 300;
-			bt_socket_ptr->write((char *) answer_unique_ptr.get(), 
-					sizeof(rendezvous_answer));
+			// the answer tells the node to clear its readings, a dump that was not stored is
+			// not answered and the node sends it again at its next attempt
+			if(!socket_no_error)
+				break;
+
+			// scheduled once the dump is stored, its sampling policy has seen the dump then
+			auto answer_unique_ptr( ScheduleAsync(peer, node_statistics).get() );
+			SetTimeSyncIfDrifted(peer, answer_unique_ptr.get());
+
+			const auto answer_start = std::chrono::steady_clock::now();
+			WriteRendezvousAnswer(bt_socket_ptr, *answer_unique_ptr);
 			bt_socket_ptr->waitForBytesWritten(500);
+			node_statistics->Record(PHASE_ANSWER_WRITE, answer_start);
 			break;
 		}
 		// check for CASE B2 - slave has sent 'DUMP'
@@ -132,16 +149,29 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 		else if(command_str[0] == DUMP_MSG)
 		{
 			std::cout << "DUMP requested" << std::endl;
+			DumpSlot * const dump_slot = AcquireDumpSlot();
+			if(!dump_slot)
+			{
+				socket_no_error = false;
+				break;
+			}
+
+			const auto okay_time = std::chrono::system_clock::now();
 			bt_socket_ptr->putChar(OKAY_MSG);
 
-			ReceiveAndStoreTemperatures(bt_socket_ptr, peer_name);
+			socket_no_error = ReceiveAndStoreTemperatures(bt_socket_ptr, peer,
+					dump_slot, node_statistics, okay_time);
+			// the node keeps its schedule and collects another full set of readings
+			if(socket_no_error)
+				scheduler_->PlanAfterDump(peer);
 
 			//std::thread thread = std::thread(&DatabaseManager::PushRendezvousEvent,
 			//		db_manager_ptr_, peer_name, 
 			//		std::chrono::system_clock::now());
 			//thread.detach();
-			emit RendezvousEvent(peer_name, std::move(std::chrono::system_clock::now()));
-			break;
+			emit RendezvousEvent(peer, std::move(std::chrono::system_clock::now()));
+			// the node continues with FINI or with DATA of the readings it took while the
+			// dump waited for us
 		}
 		// check for CASE C - slave has sent 'TIME'
 		//else if(!strncmp(TIME_MSG_STR, command_str, MAX_COMMAND_LENGTH))
@@ -151,27 +181,30 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 			bt_socket_ptr->putChar(OKAY_MSG);
 
 			struct timestamp stamp;
-			DatabaseManager::TimeConvertToDeviceTime(std::chrono::system_clock::now(),
-					&stamp);
-			bt_socket_ptr->write((char *) &stamp, sizeof(timestamp));
-			emit TimeEvent(peer_name, std::move(std::chrono::system_clock::now()));
+			const auto time_sync = std::chrono::system_clock::now();
+			DatabaseManager::TimeConvertToDeviceTime(time_sync, &stamp);
+			WriteTimestamp(bt_socket_ptr, stamp);
+			scheduler_->clock_drift().Synchronized(peer);
+			emit TimeEvent(peer, std::move(std::chrono::system_clock::now()));
 		}
 		// check for CASE D - slave has sent 'TEST'
 		//else if(!strncmp(TEST_MSG_STR, command_str, MAX_COMMAND_LENGTH))
 		else if(command_str[0] == TEST_MSG)
 		{
 			std::cout << "TEST requested" << std::endl;
-			std::shared_ptr<struct timestamp> stamp_ptr(new timestamp);
+			unsigned char stamp_bytes[TIMESTAMP_WIRE_BYTES];
 			std::shared_ptr<struct temperature_reading> temperatures_ptr(new temperature_reading);
 
-			ReceiveNChars((char *) stamp_ptr.get(), bt_socket_ptr, TIMEOUT_MS, sizeof(timestamp));
+			ReceiveNChars((char *) stamp_bytes, bt_socket_ptr, TIMEOUT_MS, TIMESTAMP_WIRE_BYTES);
+			std::shared_ptr<struct timestamp> stamp_ptr(
+					new timestamp(DecodeTimestamp(stamp_bytes)));
 			ReceiveNChars((char *) temperatures_ptr.get(), bt_socket_ptr, TIMEOUT_MS, sizeof(temperature_reading));
 
 			//auto db_manager_thread = std::thread(&DatabaseManager::HandleTestData, db_manager_ptr_,
 			//		peer_name,
 			//		std::move(stamp_ptr), std::move(temperatures_ptr));
 			//db_manager_thread.detach();
-			emit PushTestToDBManager(peer_name, stamp_ptr, temperatures_ptr);
+			emit PushTestToDBManager(peer, stamp_ptr, temperatures_ptr);
 		}
 		//else if(!strncmp(FINI_MSG_STR, command_str, MAX_COMMAND_LENGTH))
 		else if(command_str[0] == FINI_MSG)
@@ -183,7 +216,11 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 		else
 		{
 			std::cout << "Error while parsing command" << std::endl;
-			emit ErrorEvent(peer_name, std::chrono::system_clock::now(), 0);
+			if(socket_no_error)
+				++node_statistics->unknown_commands;
+			else
+				++node_statistics->timeouts;
+			emit ErrorEvent(peer, std::chrono::system_clock::now(), 0);
 			// TODO refine error handling in case the received command is not recognized 
 			socket_no_error = false;
 		}
@@ -195,7 +232,30 @@ void SerialCommunicator::PerformCommunication(QIODevice * bt_socket_ptr, const Q
 	// bt_socket_ptr->disconnectFromService();
 	std::cout << "leaving serial handler" << std::endl;
 	bt_socket_ptr->close();
+	node_statistics->Record(PHASE_SESSION, session_start);
+	if(socket_no_error)
+	{
+		node_statistics->completed_sessions.RecordSince(session_start);
+		++node_statistics->sessions_completed;
+	}
+	else
+		++node_statistics->sessions_failed;
 
+	return socket_no_error;
+}
+
+std::future<std::unique_ptr<rendezvous_answer>> SerialCommunicator::ScheduleAsync(
+		const DeviceHandle peer, NodeSessionStatistics * node_statistics)
+{
+	Scheduler<5> * const scheduler = scheduler_;
+	return std::async(std::launch::async, [scheduler, peer, node_statistics]()
+			{
+				const auto schedule_start = std::chrono::steady_clock::now();
+				std::unique_ptr<rendezvous_answer> answer_ptr =
+					scheduler->ScheduleNextCollectionStart(peer);
+				node_statistics->Record(PHASE_SCHEDULE, schedule_start);
+				return answer_ptr;
+			});
 }
 
 
@@ -231,29 +291,127 @@ bool SerialCommunicator::ReceiveNChars(char * receive_buffer,
 }
 
 
-bool SerialCommunicator::ReceiveAndStoreTemperatures(QIODevice * socket_ptr, const QString & peer_name, const int timeout_ms)
+void SerialCommunicator::SetTimeSyncIfDrifted(const DeviceHandle peer,
+		rendezvous_answer * answer_ptr)
+{
+	// the offset must stay below the limit until the node dumps its next readings
+	const auto now = std::chrono::system_clock::now();
+	const auto next_dump = now +
+		std::chrono::seconds(answer_ptr->interval_length_seconds * MAX_NUMBER_OF_READINGS);
+	if(!scheduler_->clock_drift().NeedsSync(peer, next_dump))
+		return;
+
+	std::cout << "clock of node drifted, sending time" << std::endl;
+	DatabaseManager::TimeConvertToDeviceTime(now, &answer_ptr->time_sync);
+	scheduler_->clock_drift().Synchronized(peer);
+}
+
+void SerialCommunicator::WriteRendezvousAnswer(QIODevice * socket_ptr,
+		const rendezvous_answer & answer)
+{
+	unsigned char answer_bytes[RENDEZVOUS_ANSWER_WIRE_BYTES];
+	EncodeRendezvousAnswer(answer, answer_bytes);
+	socket_ptr->write((const char *) answer_bytes, RENDEZVOUS_ANSWER_WIRE_BYTES);
+}
+
+void SerialCommunicator::WriteTimestamp(QIODevice * socket_ptr, const timestamp & stamp)
+{
+	unsigned char stamp_bytes[TIMESTAMP_WIRE_BYTES];
+	EncodeTimestamp(stamp, stamp_bytes);
+	socket_ptr->write((const char *) stamp_bytes, TIMESTAMP_WIRE_BYTES);
+}
+
+DumpSlot * SerialCommunicator::AcquireDumpSlot()
+{
+	DumpSlot * const dump_slot = db_manager_ptr_->AcquireDumpSlot(TIMEOUT_MS);
+	if(!dump_slot)
+		std::cout << "dump ring still full after " << TIMEOUT_MS <<
+			"ms, refusing dump" << std::endl;
+	return dump_slot;
+}
+
+bool SerialCommunicator::ReceiveAndStoreTemperatures(QIODevice * socket_ptr, const DeviceHandle peer,
+		DumpSlot * dump_slot, NodeSessionStatistics * node_statistics,
+		const std::chrono::system_clock::time_point okay_time, const int timeout_ms)
 {		
 	// TODO add error handling if receiving failed
 	// receive data header
 	std::cout << "receive temperatures header" << std::endl;
-	std::shared_ptr<struct temperature_readings_header> temperature_hdr_ptr(new temperature_readings_header);
-	bool socket_no_error = ReceiveNChars( (char *) temperature_hdr_ptr.get(),
-			socket_ptr, timeout_ms, sizeof(temperature_readings_header));
+	const auto header_start = std::chrono::steady_clock::now();
+	unsigned char header_bytes[HEADER_WIRE_BYTES] = {0};
+	bool socket_no_error = ReceiveNChars( (char *) header_bytes,
+			socket_ptr, timeout_ms, HEADER_WIRE_BYTES);
+	node_statistics->Record(PHASE_HEADER, header_start);
+	const auto header_time = std::chrono::system_clock::now();
+	if(socket_no_error)
+		node_statistics->bytes_received += HEADER_WIRE_BYTES;
+	else
+		++node_statistics->timeouts;
+
+	// a node never collects more, anything else is a corrupted header
+	const HeaderView header_view(header_bytes);
+	if(header_view.number_of_readings() > MAX_NUMBER_OF_READINGS)
+	{
+		std::cout << "header announces " << header_view.number_of_readings() <<
+			" readings, expected at most " << MAX_NUMBER_OF_READINGS << std::endl;
+		return false;
+	}
+	dump_slot->header = header_view.header();
+	const bool header_no_error = socket_no_error;
 
-	const unsigned int number_of_readings = temperature_hdr_ptr->number_of_readings;
+	// the node announces its reading format, formats without a kernel cannot be stored
+	const ReadingDecoder decoder(dump_slot->header);
+	if(!decoder.valid())
+	{
+		std::cout << "header announces " << unsigned(header_view.sensor_count()) <<
+			" sensors of " << unsigned(header_view.adc_bits()) << " bits in " <<
+			header_view.reading_bytes() << " bytes, format is not supported" << std::endl;
+		return false;
+	}
 
-	std::cout << "receive temperature data" << std::endl;
+	const unsigned int number_of_readings = dump_slot->header.number_of_readings;
+	const unsigned int payload_bytes = number_of_readings * decoder.reading_bytes();
 
-	std::shared_ptr<std::vector<temperature_reading>> 
-		collected_data(new std::vector<temperature_reading>(number_of_readings));
-	// receive data
-	socket_no_error = ReceiveNChars( (char *) collected_data->data(), 
-			socket_ptr, timeout_ms, sizeof(temperature_reading) * number_of_readings);
+	std::cout << "receive temperature data" << std::endl;
 
-	emit PushValuesToDB(peer_name, 
-			std::move(temperature_hdr_ptr),
-			std::move(collected_data));
+	// receive data, readings are plain bytes and land in place
+	const auto payload_start = std::chrono::steady_clock::now();
+	socket_no_error = ReceiveNChars( (char *) dump_slot->readings, 
+			socket_ptr, timeout_ms, payload_bytes);
+	node_statistics->Record(PHASE_PAYLOAD, payload_start);
+	if(socket_no_error)
+		node_statistics->bytes_received += payload_bytes;
+	else
+		++node_statistics->timeouts;
+
+	socket_no_error = socket_no_error && header_no_error;
+	if(socket_no_error)
+	{
+		node_statistics->last_dump_unix_seconds = std::chrono::duration_cast<std::chrono::seconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+		// the node read the node time of its header right after our OKAY arrived
+		scheduler_->RecordDump(peer, dump_slot->header, dump_slot->readings,
+				number_of_readings, okay_time + std::chrono::milliseconds(OKAY_LATENCY_MS));
+
+		std::chrono::system_clock::time_point start_time;
+		DatabaseManager::TimeConvertToHostTime(dump_slot->header.start_time, &start_time);
+		const ClockDriftEstimator::Estimate clock_estimate =
+			scheduler_->clock_drift().EstimateAt(peer, start_time);
+		dump_slot->clock_offset_seconds = clock_estimate.offset_seconds;
+		dump_slot->clock_drift = clock_estimate.drift;
+
+		// the raw dump is archived with the arrival of its header which is closest to the node
+		// time it carries, and with the clock estimate its readings are stored with
+		if(archive_ptr_ && !archive_ptr_->Append(peer, header_time, header_bytes,
+					dump_slot->readings, clock_estimate.offset_seconds, clock_estimate.drift))
+			std::cout << "dump not archived, " << archive_ptr_->append_failures() <<
+				" dumps missing in the archive" << std::endl;
+
+		// an incomplete or rejected dump is not committed, its slot is reused by the next one
+		// and the node keeps the readings as it is not answered
+		dump_slot->device = peer;
+		db_manager_ptr_->CommitDumpSlot();
+	}
 
 	return socket_no_error;
 }
-
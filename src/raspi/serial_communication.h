@@ -25,12 +25,19 @@
 #ifndef SERIAL_COMMUNICATION_H_RCSZ7HS1
 #define SERIAL_COMMUNICATION_H_RCSZ7HS1
 
+#include <future>
+#include <memory>
+
 #include <QObject>
 #include <QIODevice>
 #include <QMetaType>
 
+#include "clock_drift_estimator.h"
 #include "database_manager.h"
+#include "device_table.h"
+#include "dump_archive.h"
 #include "scheduler.h"
+#include "session_statistics.h"
 #include "../protocol_definitions/communication_structs.h"
 
 static const char OKAY_MSG_STR[] = {0};
@@ -42,59 +49,89 @@ static const char TEST_MSG_STR[] = {5};
 static const char FINI_MSG_STR[] = {6};
 
 static const int TIMEOUT_MS = 8000;
+// one way latency of the OKAY over the rfcomm link, the node reads its RTC once it arrived
+static const int OKAY_LATENCY_MS = 30;
 static const unsigned int MAX_COMMAND_LENGTH = 5;
 static const unsigned int MAX_REQUESTS = 4;
 
-Q_DECLARE_METATYPE(std::chrono::system_clock::time_point);
 Q_DECLARE_METATYPE(temperature_readings_header);
 
 class SerialCommunicator : public QObject
 {
 	Q_OBJECT
 public:
-	SerialCommunicator (DatabaseManager *db_manager_ptr, Scheduler<5> *scheduler):
+	SerialCommunicator (DatabaseManager *db_manager_ptr, Scheduler<5> *scheduler,
+			SessionStatistics *statistics_ptr):
 		db_manager_ptr_(db_manager_ptr),
-		scheduler_(scheduler)
+		scheduler_(scheduler),
+		statistics_ptr_(statistics_ptr),
+		archive_ptr_(nullptr)
 	{
-		qRegisterMetaType<std::chrono::system_clock::time_point>();
 		qRegisterMetaType<temperature_readings_header>();
-		connect(this, SIGNAL(PushValuesToDB(const QString, 
-						std::shared_ptr<temperature_readings_header>, 
-						std::shared_ptr<std::vector<temperature_reading>>)), 
-				db_manager_ptr_, SLOT(PushValuesToDatabase(const QString, 
-						std::shared_ptr<temperature_readings_header>, 
-						std::shared_ptr<std::vector<temperature_reading>>)));
-
-		connect(this, SIGNAL(TimeEvent(const QString, std::chrono::system_clock::time_point)),
-				db_manager_ptr_, SLOT(PushTimeRequestEvent(const QString, 
+		// the database manager may live in a thread of its own
+		qRegisterMetaType<std::shared_ptr<timestamp>>("std::shared_ptr<timestamp>");
+		qRegisterMetaType<std::shared_ptr<temperature_reading>>(
+				"std::shared_ptr<temperature_reading>");
+
+		connect(this, SIGNAL(TimeEvent(const DeviceHandle, std::chrono::system_clock::time_point)),
+				db_manager_ptr_, SLOT(PushTimeRequestEvent(const DeviceHandle, 
 						std::chrono::system_clock::time_point)));
 	}
 
 	~SerialCommunicator () {}
 
 	// Takes a connected socket and handles communication with the other end.
-	// If a data dump is received it is passed to the database manager.
-	void PerformCommunication(QIODevice * bt_socket_ptr, const QString & peer_name);
+	// If a data dump is received it is passed to the database manager through its dump
+	// ring. Sessions of all nodes have to run in the same thread, it is the only producer
+	// of that ring.
+	// Returns false if the session ended with a timeout or an unknown command.
+	bool PerformCommunication(QIODevice * bt_socket_ptr, const DeviceHandle peer);
+
+	// mutators
+	// Every completely received dump is appended to archive_ptr before it is handed to the
+	// database manager, nullptr disables archiving.
+	void SetDumpArchive(DumpArchive * archive_ptr) { archive_ptr_ = archive_ptr; }
 private:
 
 	// Receives from socket N bytes and timeouts for each received byte after timeout in ms.
 	bool ReceiveNChars(char * receive_buffer, QIODevice * socket_ptr, const int timeout_ms, const long N);
-	bool ReceiveAndStoreTemperatures(QIODevice * socket_ptr, const QString & peer_name, const int timeout_ms = TIMEOUT_MS);
+	// Receives a dump into dump_slot and commits it to the database manager if it arrived
+	// completely. okay_time is when the OKAY answering the request of the dump was sent.
+	bool ReceiveAndStoreTemperatures(QIODevice * socket_ptr, const DeviceHandle peer,
+			DumpSlot * dump_slot, NodeSessionStatistics * node_statistics,
+			const std::chrono::system_clock::time_point okay_time,
+			const int timeout_ms = TIMEOUT_MS);
+
+	// Write answers in the wire format of protocol_codec.h.
+	static void WriteRendezvousAnswer(QIODevice * socket_ptr, const rendezvous_answer & answer);
+	static void WriteTimestamp(QIODevice * socket_ptr, const timestamp & stamp);
+
+	// Fills the time sync of answer_ptr if the clock of peer would drift too far until its
+	// next dump.
+	void SetTimeSyncIfDrifted(const DeviceHandle peer, rendezvous_answer * answer_ptr);
+
+	// Returns a free dump slot of the database manager. If the encoder does not catch up
+	// within TIMEOUT_MS nullptr is returned and the dump has to be refused.
+	DumpSlot * AcquireDumpSlot();
+
+	// Runs the scheduler for peer asynchronously and records its duration.
+	std::future<std::unique_ptr<rendezvous_answer>> ScheduleAsync(const DeviceHandle peer,
+			NodeSessionStatistics * node_statistics);
 
 public slots:
 
 signals:
-	void PushValuesToDB(const QString device_id, std::shared_ptr<temperature_readings_header> temp_header,
-			std::shared_ptr<std::vector<temperature_reading>> collected_data);
-	void PushTestToDBManager(const QString device_id, std::shared_ptr<timestamp> stamp,
+	void PushTestToDBManager(const DeviceHandle device, std::shared_ptr<timestamp> stamp,
 			std::shared_ptr<temperature_reading> collected_data);
-	void TimeEvent(const QString, const std::chrono::system_clock::time_point time_point);
-	void RendezvousEvent(const QString, const std::chrono::system_clock::time_point time_point);
-	void ErrorEvent(const QString, const std::chrono::system_clock::time_point time_point, const int err_val);
+	void TimeEvent(const DeviceHandle, const std::chrono::system_clock::time_point time_point);
+	void RendezvousEvent(const DeviceHandle, const std::chrono::system_clock::time_point time_point);
+	void ErrorEvent(const DeviceHandle, const std::chrono::system_clock::time_point time_point, const int err_val);
 
 private:
 	DatabaseManager * db_manager_ptr_;
 	Scheduler<5> * scheduler_;
+	SessionStatistics * statistics_ptr_;
+	DumpArchive * archive_ptr_;
 
 public:
 
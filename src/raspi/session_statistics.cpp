@@ -0,0 +1,118 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "device_table.h"
+#include "latency_histogram.h"
+#include "metrics_registry.h"
+#include "session_statistics.h"
+
+
+NodeSessionStatistics * SessionStatistics::Node(const DeviceHandle device)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(device >= nodes_.size())
+		nodes_.resize(device + 1);
+
+	std::unique_ptr<NodeSessionStatistics> & node = nodes_[device];
+	if(!node)
+	{
+		node = std::unique_ptr<NodeSessionStatistics>(new NodeSessionStatistics);
+		if(registry_ptr_)
+			RegisterNodeMetrics(device_table_ptr_->entry(device).key, *node);
+	}
+	return node.get();
+}
+
+void SessionStatistics::RegisterNodeMetrics(const std::string & device_key,
+		const NodeSessionStatistics & node)
+{
+	const std::string device_label = MetricsRegistry::Label("device", device_key);
+
+	for (int phase = 0; phase < NUMBER_OF_SESSION_PHASES; ++phase) {
+		registry_ptr_->RegisterHistogram(node.phases[phase], "beehive_session_phase_seconds",
+				"Duration of the protocol phases of node sessions.",
+				device_label + "," + MetricsRegistry::Label("phase",
+					PhaseName(static_cast<SessionPhase>(phase))));
+	}
+
+	registry_ptr_->RegisterCounter(node.sessions_completed, "beehive_sessions_total",
+			"Sessions with nodes by outcome.",
+			device_label + "," + MetricsRegistry::Label("outcome", "completed"));
+	registry_ptr_->RegisterCounter(node.sessions_failed, "beehive_sessions_total",
+			"Sessions with nodes by outcome.",
+			device_label + "," + MetricsRegistry::Label("outcome", "failed"));
+	registry_ptr_->RegisterCounter(node.port_open_failures, "beehive_sessions_total",
+			"Sessions with nodes by outcome.",
+			device_label + "," + MetricsRegistry::Label("outcome", "port_open_failed"));
+	registry_ptr_->RegisterCounter(node.timeouts, "beehive_session_timeouts_total",
+			"Receive timeouts while talking to a node.", device_label);
+	registry_ptr_->RegisterCounter(node.unknown_commands, "beehive_unknown_commands_total",
+			"Commands received from a node that are not part of the protocol.", device_label);
+	registry_ptr_->RegisterCounter(node.bytes_received, "beehive_bytes_received_total",
+			"Bytes received from a node.", device_label);
+	registry_ptr_->RegisterAgeGauge(node.last_dump_unix_seconds,
+			"beehive_last_dump_age_seconds",
+			"Seconds since the last successfully received dump of a node.", device_label);
+}
+
+void SessionStatistics::Print(std::ostream & stream) const
+{
+	ForEachNode([&stream](const std::string & device_id, const NodeSessionStatistics & node)
+			{
+				stream << "session statistics of " << device_id <<
+					" (timeouts: " << node.timeouts.load() <<
+					", unknown commands: " << node.unknown_commands.load() <<
+					", port open failures: " << node.port_open_failures.load() << ")" << std::endl;
+
+				for (int phase = 0; phase < NUMBER_OF_SESSION_PHASES; ++phase) {
+					const LatencyHistogram & histogram = node.phases[phase];
+					if(!histogram.count())
+						continue;
+
+					stream << "\t" << PhaseName(static_cast<SessionPhase>(phase)) <<
+						"\tcount: " << histogram.count() <<
+						"\tp50: " << histogram.Percentile(0.50) << "us" <<
+						"\tp99: " << histogram.Percentile(0.99) << "us" <<
+						"\tmax: " << histogram.max() << "us" << std::endl;
+				}
+			});
+}
+
+const char * SessionStatistics::PhaseName(const SessionPhase phase)
+{
+	switch (phase) {
+		case PHASE_PORT_OPEN: return "port_open";
+		case PHASE_COMMAND_WAIT: return "command_wait";
+		case PHASE_HEADER: return "header";
+		case PHASE_PAYLOAD: return "payload";
+		case PHASE_SCHEDULE: return "schedule";
+		case PHASE_ANSWER_WRITE: return "answer_write";
+		case PHASE_DB_WRITE: return "db_write";
+		case PHASE_SESSION: return "session";
+		default: return "unknown";
+	}
+}
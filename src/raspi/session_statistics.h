@@ -0,0 +1,131 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef SESSION_STATISTICS_H_P4HC0YNB
+#define SESSION_STATISTICS_H_P4HC0YNB
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "device_table.h"
+#include "latency_histogram.h"
+#include "metrics_registry.h"
+
+// Phases of a session with a node in the order they usually occur.
+enum SessionPhase {
+	PHASE_PORT_OPEN = 0,	// opening the rfcomm serial port
+	PHASE_COMMAND_WAIT,	// waiting for the command byte of the node
+	PHASE_HEADER,		// receiving temperature_readings_header
+	PHASE_PAYLOAD,		// receiving the temperature readings
+	PHASE_SCHEDULE,		// scheduler including its database round-trip
+	PHASE_ANSWER_WRITE,	// writing the rendezvous answer to the node
+	PHASE_DB_WRITE,		// database write request until its reply arrived
+	PHASE_SESSION,		// whole session from first OKAY until the port is closed
+	NUMBER_OF_SESSION_PHASES
+};
+
+// Latency histograms and error counters of a single node.
+struct NodeSessionStatistics
+{
+	NodeSessionStatistics () :
+		timeouts(0),
+		unknown_commands(0),
+		port_open_failures(0),
+		sessions_completed(0),
+		sessions_failed(0),
+		bytes_received(0),
+		last_dump_unix_seconds(0)
+	{}
+
+	// Records the time elapsed since start for phase.
+	void Record(const SessionPhase phase, const std::chrono::steady_clock::time_point start)
+	{
+		phases[phase].RecordSince(start);
+	}
+
+	LatencyHistogram phases[NUMBER_OF_SESSION_PHASES];
+	// PHASE_SESSION of the sessions that ended without error
+	LatencyHistogram completed_sessions;
+	std::atomic<uint64_t> timeouts;
+	std::atomic<uint64_t> unknown_commands;
+	std::atomic<uint64_t> port_open_failures;
+	std::atomic<uint64_t> sessions_completed;
+	std::atomic<uint64_t> sessions_failed;
+	std::atomic<uint64_t> bytes_received;
+	// unix time of the last completely received dump, 0 if there was none yet
+	std::atomic<int64_t> last_dump_unix_seconds;
+};
+
+// Collects per node and per phase session latencies of SerialCommunicator, BluetoothManager
+// and DatabaseManager. Look up the node once per session with Node() and record through the
+// returned pointer, recording itself does not lock or allocate.
+class SessionStatistics
+{
+public:
+	// Nodes are indexed by their handle in device_table. If registry_ptr is given the
+	// metrics of every node are registered there when the node is seen for the first time.
+	explicit SessionStatistics (const DeviceTable * device_table_ptr,
+			MetricsRegistry * registry_ptr = nullptr) :
+		device_table_ptr_(device_table_ptr),
+		registry_ptr_(registry_ptr)
+	{}
+	~SessionStatistics () {}
+
+	// Returns the statistics of a valid device handle, creating them on first use. The
+	// returned pointer stays valid for the lifetime of this object.
+	NodeSessionStatistics * Node(const DeviceHandle device);
+
+	// Calls function(device_key, node_statistics) for every known node.
+	template<typename Function>
+	void ForEachNode(Function function) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (DeviceHandle device = 0; device < nodes_.size(); ++device) {
+			if(nodes_[device])
+				function(device_table_ptr_->entry(device).key, *nodes_[device]);
+		}
+	}
+
+	// Prints a latency summary (p50, p99, max) of every node and phase.
+	void Print(std::ostream & stream) const;
+
+	static const char * PhaseName(const SessionPhase phase);
+
+private:
+	void RegisterNodeMetrics(const std::string & device_key, const NodeSessionStatistics & node);
+
+	const DeviceTable * device_table_ptr_;
+	MetricsRegistry * registry_ptr_;
+	mutable std::mutex mutex_;
+	// indexed by DeviceHandle, nullptr for devices without a session yet
+	std::vector<std::unique_ptr<NodeSessionStatistics>> nodes_;
+};
+
+
+#endif /* end of include guard: SESSION_STATISTICS_H_P4HC0YNB */
@@ -0,0 +1,279 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "device_table.h"
+#include "slot_allocator.h"
+
+
+SlotAllocator::SlotAllocator(const std::chrono::seconds frame_length,
+		const std::chrono::seconds horizon,
+		const std::chrono::seconds slot_length) :
+	frame_seconds_(std::max<int64_t>(frame_length.count(), 1)),
+	horizon_seconds_(std::max<int64_t>(horizon.count(), frame_seconds_)),
+	slots_per_frame_(1),
+	slot_seconds_(frame_seconds_),
+	offset_bits_(0),
+	base_slot_(0),
+	ring_slots_(0)
+{
+	SetSlotLength(slot_length);
+}
+
+void SlotAllocator::SetSlotLength(const std::chrono::seconds slot_length)
+{
+	const int64_t requested_seconds = std::max<int64_t>(slot_length.count(), 1);
+	const int64_t slots_per_frame = std::max<int64_t>(frame_seconds_ / requested_seconds, 1);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(slots_per_frame == slots_per_frame_ && !occupancy_.empty())
+		return;
+
+	// remember reservations in seconds, slot numbers change with the slot length
+	const int64_t base_seconds = SlotStart(base_slot_);
+	std::unordered_map<DeviceHandle, int64_t> reserved_seconds;
+	for (const auto & reservation : reservations_)
+		reserved_seconds.emplace(reservation.first, SlotStart(reservation.second.slot));
+
+	slots_per_frame_ = slots_per_frame;
+	slot_seconds_ = frame_seconds_ / slots_per_frame_;
+	offset_bits_ = 0;
+	while((int64_t(1) << offset_bits_) < slots_per_frame_)
+		++offset_bits_;
+
+	// whole 64 bit words covering the horizon
+	ring_slots_ = ((horizon_seconds_ / slot_seconds_ + 1 + 63) / 64) * 64;
+	base_slot_ = SlotContaining(base_seconds);
+
+	for (auto & reservation : reservations_) {
+		reservation.second.slot = SlotContaining(reserved_seconds.at(reservation.first));
+		reservation.second.offset = reservation.second.slot % slots_per_frame_;
+	}
+	Rebuild();
+
+	std::cout << "slot allocator uses " << slots_per_frame_ << " slots of " <<
+		slot_seconds_ << "s per frame" << std::endl;
+}
+
+void SlotAllocator::Reserve(const DeviceHandle device,
+		const std::chrono::system_clock::time_point start_time)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Release(device);
+
+	const int64_t slot = SlotContaining(ToUnixSeconds(start_time));
+	reservations_[device] = Reservation{slot, slot % slots_per_frame_};
+	if(InWindow(slot))
+		SetOccupied(slot, true);
+}
+
+std::chrono::system_clock::time_point SlotAllocator::Allocate(const DeviceHandle device,
+		const std::chrono::system_clock::time_point earliest)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	const int64_t first_slot = SlotAt(ToUnixSeconds(earliest));
+	Advance(first_slot);
+
+	const auto reservation = reservations_.find(device);
+	const int64_t preferred_offset =
+		reservation != reservations_.end() ? reservation->second.offset : -1;
+	Release(device);
+
+	int64_t allocated_slot = -1;
+	for (int64_t frame_start = (first_slot / slots_per_frame_) * slots_per_frame_;
+			allocated_slot < 0 && frame_start < base_slot_ + ring_slots_;
+			frame_start += slots_per_frame_) {
+
+		// keep the position within the frame if possible
+		if(preferred_offset >= 0)
+		{
+			const int64_t slot = frame_start + preferred_offset;
+			if(slot >= first_slot && InWindow(slot) && !IsOccupied(slot))
+			{
+				allocated_slot = slot;
+				break;
+			}
+		}
+
+		for (int64_t index = 0; index < (int64_t(1) << offset_bits_); ++index) {
+			const int64_t offset = ReversedOffset(index);
+			const int64_t slot = frame_start + offset;
+			if(offset < slots_per_frame_ && slot >= first_slot &&
+					InWindow(slot) && !IsOccupied(slot))
+			{
+				allocated_slot = slot;
+				break;
+			}
+		}
+	}
+
+	if(allocated_slot < 0)
+	{
+		std::cout << "no free slot within the scheduling horizon - share a slot" << std::endl;
+		allocated_slot = (first_slot / slots_per_frame_) * slots_per_frame_ +
+			std::max<int64_t>(preferred_offset, 0);
+		if(allocated_slot < first_slot)
+			allocated_slot += slots_per_frame_;
+	}
+
+	reservations_[device] = Reservation{allocated_slot, allocated_slot % slots_per_frame_};
+	if(InWindow(allocated_slot))
+		SetOccupied(allocated_slot, true);
+
+	return std::chrono::system_clock::time_point(
+			std::chrono::seconds(SlotStart(allocated_slot)));
+}
+
+std::chrono::seconds SlotAllocator::slot_length() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return std::chrono::seconds(slot_seconds_);
+}
+
+int64_t SlotAllocator::slots_per_frame() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return slots_per_frame_;
+}
+
+int64_t SlotAllocator::occupied_slots() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	int64_t occupied = 0;
+	for (const uint64_t word : occupancy_)
+		occupied += __builtin_popcountll(word);
+	return occupied;
+}
+
+void SlotAllocator::Release(const DeviceHandle device)
+{
+	const auto reservation = reservations_.find(device);
+	if(reservation == reservations_.end())
+		return;
+
+	const int64_t slot = reservation->second.slot;
+	reservations_.erase(reservation);
+	if(!InWindow(slot))
+		return;
+
+	// slots are only shared if the horizon ran full or the database held a collision
+	for (const auto & other : reservations_) {
+		if(other.second.slot == slot)
+			return;
+	}
+	SetOccupied(slot, false);
+}
+
+int64_t SlotAllocator::SlotContaining(const int64_t unix_seconds) const
+{
+	const int64_t frame = unix_seconds / frame_seconds_;
+	const int64_t offset = std::min((unix_seconds - frame * frame_seconds_) / slot_seconds_,
+			slots_per_frame_ - 1);
+	return frame * slots_per_frame_ + offset;
+}
+
+int64_t SlotAllocator::SlotAt(const int64_t unix_seconds) const
+{
+	const int64_t slot = SlotContaining(unix_seconds);
+	return SlotStart(slot) < unix_seconds ? slot + 1 : slot;
+}
+
+int64_t SlotAllocator::SlotStart(const int64_t slot) const
+{
+	return (slot / slots_per_frame_) * frame_seconds_ + (slot % slots_per_frame_) * slot_seconds_;
+}
+
+bool SlotAllocator::InWindow(const int64_t slot) const
+{
+	return slot >= base_slot_ && slot < base_slot_ + ring_slots_;
+}
+
+bool SlotAllocator::IsOccupied(const int64_t slot) const
+{
+	const uint64_t bit = static_cast<uint64_t>(slot % ring_slots_);
+	return occupancy_[bit / 64] & (uint64_t(1) << (bit % 64));
+}
+
+void SlotAllocator::SetOccupied(const int64_t slot, const bool occupied)
+{
+	const uint64_t bit = static_cast<uint64_t>(slot % ring_slots_);
+	if(occupied)
+		occupancy_[bit / 64] |= uint64_t(1) << (bit % 64);
+	else
+		occupancy_[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+}
+
+void SlotAllocator::Advance(const int64_t first_slot)
+{
+	if(first_slot <= base_slot_)
+		return;
+
+	if(first_slot - base_slot_ >= ring_slots_)
+	{
+		base_slot_ = first_slot;
+		Rebuild();
+		return;
+	}
+
+	for (int64_t slot = base_slot_; slot < first_slot; ++slot)
+		SetOccupied(slot, false);
+
+	// reservations beyond the old horizon may have moved into the ring
+	const int64_t old_end = base_slot_ + ring_slots_;
+	base_slot_ = first_slot;
+	for (const auto & reservation : reservations_) {
+		if(reservation.second.slot >= old_end && InWindow(reservation.second.slot))
+			SetOccupied(reservation.second.slot, true);
+	}
+}
+
+void SlotAllocator::Rebuild()
+{
+	occupancy_.assign(ring_slots_ / 64, 0);
+	for (const auto & reservation : reservations_) {
+		if(InWindow(reservation.second.slot))
+			SetOccupied(reservation.second.slot, true);
+	}
+}
+
+int64_t SlotAllocator::ReversedOffset(const int64_t index) const
+{
+	int64_t reversed = 0;
+	for (int64_t bit = 0; bit < offset_bits_; ++bit) {
+		if(index & (int64_t(1) << bit))
+			reversed |= int64_t(1) << (offset_bits_ - 1 - bit);
+	}
+	return reversed;
+}
+
+int64_t SlotAllocator::ToUnixSeconds(const std::chrono::system_clock::time_point time_point)
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(time_point.time_since_epoch()).count();
+}
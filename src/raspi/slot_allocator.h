@@ -0,0 +1,118 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef SLOT_ALLOCATOR_H_K2T9DJQM
+#define SLOT_ALLOCATOR_H_K2T9DJQM
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "device_table.h"
+
+// Assigns collision free rendezvous slots to nodes.
+// Time is divided into frames of frame_length (the Granularity block of the Scheduler) and
+// every frame into slots_per_frame() slots of slot_length(). Occupied slots of the scheduling
+// horizon are kept in a ring bitmap indexed by the absolute slot number, so checking or
+// reserving a slot is O(1). Free offsets within a frame are handed out in bit-reversed order
+// which spreads the nodes evenly over the frame, and every node keeps its offset as long as it
+// is free so its rendezvous stays at the same position in later frames.
+class SlotAllocator
+{
+public:
+	SlotAllocator (const std::chrono::seconds frame_length,
+			const std::chrono::seconds horizon,
+			const std::chrono::seconds slot_length);
+	~SlotAllocator () {}
+
+	SlotAllocator (const SlotAllocator &) = delete;
+	SlotAllocator & operator=(const SlotAllocator &) = delete;
+
+	// Changes the slot length to the smallest fraction of a frame that is at least
+	// slot_length long. Existing reservations are moved to the slot they fall into.
+	void SetSlotLength(const std::chrono::seconds slot_length);
+
+	// Marks start_time as taken by device, e.g. a rendezvous fetched from the database.
+	void Reserve(const DeviceHandle device,
+			const std::chrono::system_clock::time_point start_time);
+
+	// Releases the current reservation of device and returns the start of the first free
+	// slot at or after earliest. If the whole horizon is taken the slot at the preferred
+	// offset of device is shared.
+	std::chrono::system_clock::time_point Allocate(const DeviceHandle device,
+			const std::chrono::system_clock::time_point earliest);
+
+	// access functions
+	std::chrono::seconds slot_length() const;
+	int64_t slots_per_frame() const;
+	// Number of reserved slots within the horizon.
+	int64_t occupied_slots() const;
+
+private:
+	struct Reservation
+	{
+		int64_t slot;
+		int64_t offset;
+	};
+
+	// Drops the reservation of device unless its slot is shared.
+	void Release(const DeviceHandle device);
+
+	// Converts between absolute slot numbers and unix seconds. SlotContaining returns the slot
+	// unix_seconds falls into, SlotAt the first slot starting at or after unix_seconds.
+	int64_t SlotContaining(const int64_t unix_seconds) const;
+	int64_t SlotAt(const int64_t unix_seconds) const;
+	int64_t SlotStart(const int64_t slot) const;
+
+	bool InWindow(const int64_t slot) const;
+	bool IsOccupied(const int64_t slot) const;
+	void SetOccupied(const int64_t slot, const bool occupied);
+
+	// Drops all slots before first_slot from the ring.
+	void Advance(const int64_t first_slot);
+	// Recreates the ring from reservations_ after the slot length changed.
+	void Rebuild();
+
+	// Returns index with its lowest offset_bits_ bits reversed. The result may be
+	// slots_per_frame_ or larger and has to be skipped then.
+	int64_t ReversedOffset(const int64_t index) const;
+
+	static int64_t ToUnixSeconds(const std::chrono::system_clock::time_point time_point);
+
+	const int64_t frame_seconds_;
+	const int64_t horizon_seconds_;
+	int64_t slots_per_frame_;
+	int64_t slot_seconds_;
+	int64_t offset_bits_;
+	// absolute number of the first slot in the ring
+	int64_t base_slot_;
+	int64_t ring_slots_;
+	std::vector<uint64_t> occupancy_;
+	std::unordered_map<DeviceHandle, Reservation> reservations_;
+	mutable std::mutex mutex_;
+};
+
+
+#endif /* end of include guard: SLOT_ALLOCATOR_H_K2T9DJQM */
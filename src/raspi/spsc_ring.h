@@ -0,0 +1,119 @@
+// BeeWarm - Freie Universität Berlin - AG Neurobiologie
+//
+// Copyright © 2015 Benjamin Aschenbrenner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef SPSC_RING_H_K3V8NQ1T
+#define SPSC_RING_H_K3V8NQ1T
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Fixed capacity ring of preallocated slots between exactly one producer and one consumer
+// thread. Slots are filled and drained in place, handing one over is a store and a load of
+// the two indices without any locking or allocation. The slots are allocated on the heap
+// once with the ring, so large slots do not blow up the object holding it.
+// The producer calls BeginWrite, fills the returned slot and publishes it with CommitWrite.
+// The consumer calls BeginRead, processes the slot and releases it with CommitRead.
+template<typename T, std::size_t Capacity>
+class SpscRing
+{
+	static_assert(Capacity >= 2 && !(Capacity & (Capacity - 1)),
+			"capacity of SpscRing has to be a power of two");
+public:
+	static const std::size_t CACHE_LINE_SIZE = 64;
+
+	SpscRing () :
+		write_index_(0),
+		read_index_(0),
+		cached_read_index_(0),
+		occupancy_(0),
+		slots_(new T[Capacity])
+	{}
+
+	SpscRing (const SpscRing &) = delete;
+	SpscRing & operator=(const SpscRing &) = delete;
+
+	// Producer: returns the next free slot or nullptr if the ring is full. Repeated calls
+	// return the same slot until it is committed.
+	T * BeginWrite()
+	{
+		const uint64_t write_index = write_index_.load(std::memory_order_relaxed);
+		if(write_index - cached_read_index_ == Capacity)
+		{
+			cached_read_index_ = read_index_.load(std::memory_order_acquire);
+			if(write_index - cached_read_index_ == Capacity)
+				return nullptr;
+		}
+		return &slots_[write_index & (Capacity - 1)];
+	}
+
+	// Producer: publishes the slot returned by BeginWrite. Returns true if the ring was
+	// empty before, i.e. the consumer may have to be woken up.
+	bool CommitWrite()
+	{
+		const uint64_t write_index = write_index_.load(std::memory_order_relaxed);
+		occupancy_.fetch_add(1, std::memory_order_relaxed);
+		// sequentially consistent, a consumer that drained the ring concurrently either
+		// sees the new slot or is seen by the load below
+		write_index_.store(write_index + 1, std::memory_order_seq_cst);
+		return read_index_.load(std::memory_order_seq_cst) == write_index;
+	}
+
+	// Consumer: returns the oldest published slot or nullptr if the ring is empty.
+	T * BeginRead()
+	{
+		const uint64_t read_index = read_index_.load(std::memory_order_relaxed);
+		if(write_index_.load(std::memory_order_seq_cst) == read_index)
+			return nullptr;
+		return &slots_[read_index & (Capacity - 1)];
+	}
+
+	// Consumer: hands the slot returned by BeginRead back to the producer.
+	void CommitRead()
+	{
+		occupancy_.fetch_sub(1, std::memory_order_relaxed);
+		read_index_.store(read_index_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_seq_cst);
+	}
+
+	// access functions
+	static std::size_t capacity() { return Capacity; }
+	// Number of published slots that are not released yet, readable from any thread.
+	const std::atomic<int64_t> & occupancy() const { return occupancy_; }
+
+private:
+	// the indices run freely, they are masked on access
+	std::atomic<uint64_t> write_index_;
+	char write_padding_[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> read_index_;
+	char read_padding_[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+	// only used by the producer
+	uint64_t cached_read_index_;
+	std::atomic<int64_t> occupancy_;
+	char occupancy_padding_[CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+	const std::unique_ptr<T[]> slots_;
+};
+
+
+#endif /* end of include guard: SPSC_RING_H_K3V8NQ1T */